@@ -126,6 +126,10 @@ extern void stp_dither_matrix_scale_exponentially(stp_dither_matrix_impl_t *mat,
 						  double exponent);
 extern void stp_dither_matrix_set_row(stp_dither_matrix_impl_t *mat, int y);
 extern stp_array_t *stp_find_standard_dither_array(int x_aspect, int y_aspect);
+extern const stp_dither_matrix_generic_t *
+stp_find_standard_dither_matrix(int x_aspect, int y_aspect);
+extern int stp_dither_matrix_write_binary(const char *xml_file,
+					  const char *output);
 
 
 typedef struct stp_dotsize
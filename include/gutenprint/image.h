@@ -124,6 +124,27 @@ typedef struct stp_image
   void *rep;
 } stp_image_t;
 
+/**
+ * Row pointer function.  This optional callback is an alternative to
+ * the image's get_row for applications that already hold the row in
+ * memory in the format get_row would produce.  Rather than copying
+ * the row, it stores a pointer to it in *data; the data must remain
+ * valid and unchanged until the next call to get_row or to this
+ * function.  If the row is not available in that form, it may store
+ * NULL in *data, in which case get_row is called for that row
+ * instead.  The return value and the other arguments are as for
+ * get_row.  It is supplied with stp_set_image_row_ptr_func(), and is
+ * kept out of stp_image_t so that the layout of that structure does
+ * not change.
+ * @param image the image in use.
+ * @param data where to store a pointer to the pixel data.
+ * @param byte_limit (image width * number of channels).
+ * @param row the row number.
+ */
+typedef stp_image_status_t (*stp_image_row_ptr_func_t)
+     (stp_image_t *image, const unsigned char **data, size_t byte_limit,
+      int row);
+
 extern void stp_image_init(stp_image_t *image);
 extern void stp_image_reset(stp_image_t *image);
 extern int stp_image_width(stp_image_t *image);
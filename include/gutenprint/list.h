@@ -320,7 +320,9 @@ extern "C" {
   /**
    * Set the data associated with a list item.
    * @warning Note that if a sortfunc is in use, changing the data
-   * will NOT re-sort the list!
+   * will NOT re-sort the list!  Likewise, the new data must have the
+   * same name and long name as the old, as the list's name index is
+   * not updated.
    * @param item the list item to use.
    * @param data the data to set.
    * @returns 0 on success, 1 on failure (if data is NULL).
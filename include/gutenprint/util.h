@@ -97,6 +97,7 @@ extern void stp_puts(const char *s, const stp_vars_t *v);
 extern void stp_putraw(const stp_raw_t *r, const stp_vars_t *v);
 extern void stp_send_command(const stp_vars_t *v, const char *command,
 			     const char *format, ...);
+extern void stp_flush_output(const stp_vars_t *v);
 
 extern void stp_erputc(int ch);
 
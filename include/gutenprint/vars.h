@@ -31,6 +31,7 @@
 
 #include <gutenprint/array.h>
 #include <gutenprint/curve.h>
+#include <gutenprint/image.h>
 #include <gutenprint/string-list.h>
 
 #ifdef __cplusplus
@@ -200,6 +201,28 @@ typedef const void *stp_const_parameter_list_t;
  */
 typedef void (*stp_outfunc_t) (void *data, const char *buffer, size_t bytes);
 
+/**
+ * One piece of output passed to an stp_outvfunc_t.
+ */
+typedef struct
+{
+  const char *data;		/*!< The data to output. */
+  size_t bytes;			/*!< The size of data (in bytes). */
+} stp_outvec_t;
+
+/**
+ * Gather output function.  If supplied, this is used in preference to
+ * the stp_outfunc_t when more than one piece of output is ready at
+ * once, so that the caller may write them with a single system call
+ * (e.g. writev).  The pieces must be written in order.
+ * @param data a pointer to an opaque object owned by the calling
+ *             application.
+ * @param vec the pieces of data to output.
+ * @param count the number of pieces.
+ */
+typedef void (*stp_outvfunc_t) (void *data, const stp_outvec_t *vec,
+				int count);
+
 
 /****************************************************************
 *                                                               *
@@ -382,6 +405,55 @@ extern void stp_set_outfunc(stp_vars_t *v, stp_outfunc_t val);
  */
 extern stp_outfunc_t stp_get_outfunc(const stp_vars_t *v);
 
+/**
+ * Set the gather function used to print output information.  This is
+ * optional; an outfunc must still be supplied.
+ * @param v the vars to use.
+ * @param val the value to set.
+ */
+extern void stp_set_outvfunc(stp_vars_t *v, stp_outvfunc_t val);
+
+/**
+ * Get the gather function used to print output information.
+ * @param v the vars to use.
+ * @returns the outvfunc.
+ */
+extern stp_outvfunc_t stp_get_outvfunc(const stp_vars_t *v);
+
+/**
+ * Set the size of the buffer used to collect output before it is
+ * passed to the outfunc.  Pending output is written first.  A size
+ * of zero passes all output to the outfunc immediately.
+ * @param v the vars to use.
+ * @param size the buffer size in bytes.
+ */
+extern void stp_set_output_buffer_size(stp_vars_t *v, size_t size);
+
+/**
+ * Get the size of the output buffer.
+ * @param v the vars to use.
+ * @returns the buffer size in bytes.
+ */
+extern size_t stp_get_output_buffer_size(const stp_vars_t *v);
+
+/**
+ * Set the function used to read rows of the image in place.  This is
+ * optional; the image's get_row callback is used if it is not set.
+ * It applies to the image passed to stp_print() with these vars.
+ * @param v the vars to use.
+ * @param val the value to set.
+ */
+extern void stp_set_image_row_ptr_func(stp_vars_t *v,
+				       stp_image_row_ptr_func_t val);
+
+/**
+ * Get the function used to read rows of the image in place.
+ * @param v the vars to use.
+ * @returns the image_row_ptr_func.
+ */
+extern stp_image_row_ptr_func_t
+stp_get_image_row_ptr_func(const stp_vars_t *v);
+
 /**
  * Set the function used to print error and diagnostic information.
  * These must be supplied by the caller.  errdata is passed as an
@@ -50,6 +50,13 @@ extern void stp_unregister_xml_preload(const char *filename);
 extern int stp_xml_init_defaults(void);
 extern int stp_xml_parse_file(const char *file);
 
+/* Name of the precompiled XML data file, in the XML data directory */
+#define STP_XML_PRECOMPILED_NAME "xml-precompiled.bin"
+
+extern stp_mxml_node_t *stp_xml_load_file(const char *file);
+extern int stp_xml_write_precompiled(const char *output, const char *dir,
+				     int count, const char **files);
+
 extern long stp_xmlstrtol(const char *value);
 extern unsigned long stp_xmlstrtoul(const char *value);
 extern double stp_xmlstrtod(const char *textval);
@@ -972,6 +972,35 @@ image_next_row(IMAGE *img)
   return status;
 }
 
+/*
+ * 8 and 16 bit rows are handed to the library exactly as read, so
+ * there is no need to copy them.
+ */
+static stp_image_status_t
+gutenprint_image_get_row_ptr(stp_image_t *image, const unsigned char **data,
+			     size_t byte_limit, int row)
+{
+  IMAGE *img = (IMAGE *)(image->rep);
+  int physical_row = row * img->yres / img->xres;
+
+  if (img->bps != 8 && img->bps != 16)
+    return STP_IMAGE_STATUS_OK;	/* Let gutenprint_image_get_row unpack it */
+  if ((physical_row < 0) || (physical_row >= img->height))
+    return STP_IMAGE_STATUS_ABORT;
+
+  /* Read until we reach the requested row. */
+  while (physical_row > img->row)
+    {
+      if (image_next_row(img))
+	return STP_IMAGE_STATUS_ABORT;
+    }
+
+  if (physical_row != img->row)
+    return STP_IMAGE_STATUS_ABORT;
+  *data = (const unsigned char *) img->row_buf;
+  return STP_IMAGE_STATUS_OK;
+}
+
 static stp_image_status_t
 gutenprint_image_get_row(stp_image_t *image, unsigned char *data, size_t byte_limit,
 		   int row)
@@ -1281,6 +1310,9 @@ main (int argc, char **argv)
   stp_set_outfunc(img.v, gutenprint_outfunc);
   stp_set_outdata(img.v, NULL);
 
+  /* 8 and 16 bit rows can be read in place. */
+  stp_set_image_row_ptr_func(img.v, gutenprint_image_get_row_ptr);
+
   memset(&si, 0, sizeof(si));
   si.width = gutenprint_image_width;
   si.height = gutenprint_image_height;
@@ -36,14 +36,389 @@
 #include <limits.h>
 #endif
 
+/*
+ * SSE2 versions of the bit folding and unpacking routines.  These are
+ * compiled with a target attribute and selected at runtime, so a
+ * generic i386 build still runs on processors without SSE2.  Each
+ * routine processes as many whole 16 byte blocks as it can and returns
+ * the number of input bytes consumed; the scalar code finishes the rest.
+ */
+#if defined(HAVE_EMMINTRIN_H) && defined(__GNUC__) && \
+  (defined(__i386__) || defined(__x86_64__))
+#define STPI_BIT_OPS_SSE2
+#include <emmintrin.h>
+
+#define SSE2_FUNC __attribute__((__target__("sse2")))
+
+int
+stpi_cpu_has_sse2(void)
+{
+#ifdef __SSE2__
+  return 1;
+#else
+  static int has_sse2 = -1;
+  if (has_sse2 < 0)
+    {
+      __builtin_cpu_init();
+      has_sse2 = __builtin_cpu_supports("sse2") ? 1 : 0;
+    }
+  return has_sse2;
+#endif
+}
+
+/* Spread the low 8 bits of each 16-bit lane to the even bit positions */
+static inline SSE2_FUNC __m128i
+spread_bits_2(__m128i x)
+{
+  x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi16(x, 4)),
+		    _mm_set1_epi16(0x0f0f));
+  x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi16(x, 2)),
+		    _mm_set1_epi16(0x3333));
+  x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi16(x, 1)),
+		    _mm_set1_epi16(0x5555));
+  return x;
+}
+
+/* Spread the low 8 bits of each 32-bit lane to every third bit */
+static inline SSE2_FUNC __m128i
+spread_bits_3(__m128i x)
+{
+  x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi32(x, 16)),
+		    _mm_set1_epi32(0x030000ff));
+  x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi32(x, 8)),
+		    _mm_set1_epi32(0x0300f00f));
+  x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi32(x, 4)),
+		    _mm_set1_epi32(0x030c30c3));
+  x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi32(x, 2)),
+		    _mm_set1_epi32(0x09249249));
+  return x;
+}
+
+/* Spread the low 8 bits of each 32-bit lane to every fourth bit */
+static inline SSE2_FUNC __m128i
+spread_bits_4(__m128i x)
+{
+  x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi32(x, 12)),
+		    _mm_set1_epi32(0x000f000f));
+  x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi32(x, 6)),
+		    _mm_set1_epi32(0x03030303));
+  x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi32(x, 3)),
+		    _mm_set1_epi32(0x11111111));
+  return x;
+}
+
+static inline SSE2_FUNC __m128i
+swap_bytes_16(__m128i x)
+{
+  return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+static inline SSE2_FUNC __m128i
+swap_bytes_32(__m128i x)
+{
+  x = swap_bytes_16(x);
+  return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xb1), 0xb1);
+}
+
+/* Reverse the order of all 16 bytes */
+static inline SSE2_FUNC __m128i
+reverse_bytes(__m128i x)
+{
+  x = _mm_shuffle_epi32(x, 0x1b);
+  return swap_bytes_32(x);
+}
+
+static SSE2_FUNC int
+fold_2bit_sse2(const unsigned char *line, int single_length,
+	       unsigned char *outbuf)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int i;
+  for (i = 0; i + 16 <= single_length; i += 16)
+    {
+      __m128i a = _mm_loadu_si128((const __m128i *) (line + i));
+      __m128i b = _mm_loadu_si128((const __m128i *) (line + single_length + i));
+      __m128i lo =
+	_mm_or_si128(spread_bits_2(_mm_unpacklo_epi8(a, zero)),
+		     _mm_slli_epi16(spread_bits_2(_mm_unpacklo_epi8(b, zero)),
+				    1));
+      __m128i hi =
+	_mm_or_si128(spread_bits_2(_mm_unpackhi_epi8(a, zero)),
+		     _mm_slli_epi16(spread_bits_2(_mm_unpackhi_epi8(b, zero)),
+				    1));
+      _mm_storeu_si128((__m128i *) (outbuf + 2 * i), swap_bytes_16(lo));
+      _mm_storeu_si128((__m128i *) (outbuf + 2 * i + 16), swap_bytes_16(hi));
+    }
+  return i;
+}
+
+static SSE2_FUNC int
+fold_3bit_sse2(const unsigned char *line, int single_length,
+	       unsigned char *outbuf)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int i, j, k;
+  for (i = 0; i + 16 <= single_length; i += 16)
+    {
+      __m128i planes[3];
+      for (j = 0; j < 3; j++)
+	planes[j] =
+	  _mm_loadu_si128((const __m128i *) (line + j * single_length + i));
+      for (j = 0; j < 4; j++)
+	{
+	  __m128i acc = zero;
+	  unsigned int words[4];
+	  for (k = 0; k < 3; k++)
+	    {
+	      __m128i x = (j < 2 ? _mm_unpacklo_epi8(planes[k], zero) :
+			   _mm_unpackhi_epi8(planes[k], zero));
+	      x = ((j & 1) ? _mm_unpackhi_epi16(x, zero) :
+		   _mm_unpacklo_epi16(x, zero));
+	      acc = _mm_or_si128(acc, _mm_slli_epi32(spread_bits_3(x), k));
+	    }
+	  _mm_storeu_si128((__m128i *) words, acc);
+	  for (k = 0; k < 4; k++)
+	    {
+	      unsigned char *out = outbuf + 3 * (i + j * 4 + k);
+	      out[0] = words[k] >> 16;
+	      out[1] = words[k] >> 8;
+	      out[2] = words[k];
+	    }
+	}
+    }
+  return i;
+}
+
+static SSE2_FUNC int
+fold_4bit_sse2(const unsigned char *line, int single_length,
+	       unsigned char *outbuf)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int i, j, k;
+  for (i = 0; i + 16 <= single_length; i += 16)
+    {
+      __m128i planes[4];
+      for (j = 0; j < 4; j++)
+	planes[j] =
+	  _mm_loadu_si128((const __m128i *) (line + j * single_length + i));
+      for (j = 0; j < 4; j++)
+	{
+	  __m128i acc = zero;
+	  for (k = 0; k < 4; k++)
+	    {
+	      __m128i x = (j < 2 ? _mm_unpacklo_epi8(planes[k], zero) :
+			   _mm_unpackhi_epi8(planes[k], zero));
+	      x = ((j & 1) ? _mm_unpackhi_epi16(x, zero) :
+		   _mm_unpacklo_epi16(x, zero));
+	      acc = _mm_or_si128(acc, _mm_slli_epi32(spread_bits_4(x), k));
+	    }
+	  _mm_storeu_si128((__m128i *) (outbuf + 4 * i + 16 * j),
+			   swap_bytes_32(acc));
+	}
+    }
+  return i;
+}
+
+/*
+ * Eight planes are a straight 8x8 bit transpose per pixel: gather the
+ * eight plane bytes of each pixel together, then peel off one bit of
+ * every byte at a time with movemask.
+ */
+static SSE2_FUNC int
+fold_8bit_sse2(const unsigned char *line, int single_length,
+	       unsigned char *outbuf)
+{
+  int i, j, k;
+  for (i = 0; i + 16 <= single_length; i += 16)
+    {
+      __m128i p[8];
+      __m128i t[8];
+      __m128i u[4];
+      __m128i pixels[8];
+      for (j = 0; j < 8; j++)
+	p[j] = _mm_loadu_si128((const __m128i *) (line + j * single_length + i));
+      for (j = 0; j < 4; j++)
+	{
+	  t[2 * j] = _mm_unpacklo_epi8(p[2 * j], p[2 * j + 1]);
+	  t[2 * j + 1] = _mm_unpackhi_epi8(p[2 * j], p[2 * j + 1]);
+	}
+      for (j = 0; j < 2; j++)
+	{
+	  u[0] = _mm_unpacklo_epi16(t[j], t[j + 2]);
+	  u[1] = _mm_unpackhi_epi16(t[j], t[j + 2]);
+	  u[2] = _mm_unpacklo_epi16(t[j + 4], t[j + 6]);
+	  u[3] = _mm_unpackhi_epi16(t[j + 4], t[j + 6]);
+	  pixels[4 * j + 0] = _mm_unpacklo_epi32(u[0], u[2]);
+	  pixels[4 * j + 1] = _mm_unpackhi_epi32(u[0], u[2]);
+	  pixels[4 * j + 2] = _mm_unpacklo_epi32(u[1], u[3]);
+	  pixels[4 * j + 3] = _mm_unpackhi_epi32(u[1], u[3]);
+	}
+      for (j = 0; j < 8; j++)
+	{
+	  __m128i x = pixels[j];
+	  unsigned char *out = outbuf + 8 * (i + 2 * j);
+	  for (k = 0; k < 8; k++)
+	    {
+	      int mask = _mm_movemask_epi8(x);
+	      out[k] = mask;
+	      out[k + 8] = mask >> 8;
+	      x = _mm_add_epi8(x, x);
+	    }
+	}
+    }
+  return i;
+}
+
+/*
+ * Unpacking is the inverse transpose.  Arrange the bits destined for
+ * each output plane into the top bit of successive bytes, in output
+ * order, and collect them with movemask.
+ */
+static inline SSE2_FUNC void
+unpack_movemask(__m128i x, int planes, unsigned char **outs)
+{
+  int j;
+  x = reverse_bytes(x);
+  for (j = 0; j < planes; j++)
+    {
+      int mask = _mm_movemask_epi8(x);
+      outs[j][0] = mask >> 8;
+      outs[j][1] = mask;
+      outs[j] += 2;
+      x = _mm_add_epi8(x, x);
+    }
+}
+
+static SSE2_FUNC int
+unpack_2_1_sse2(int length, const unsigned char *in, unsigned char **outs)
+{
+  int i;
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      __m128i x = _mm_loadu_si128((const __m128i *) (in + i));
+      __m128i a_lo = _mm_unpacklo_epi8(x, _mm_slli_epi16(x, 2));
+      __m128i a_hi = _mm_unpackhi_epi8(x, _mm_slli_epi16(x, 2));
+      __m128i b_lo = _mm_unpacklo_epi8(_mm_slli_epi16(x, 4),
+				       _mm_slli_epi16(x, 6));
+      __m128i b_hi = _mm_unpackhi_epi8(_mm_slli_epi16(x, 4),
+				       _mm_slli_epi16(x, 6));
+      unpack_movemask(_mm_unpacklo_epi16(a_lo, b_lo), 2, outs);
+      unpack_movemask(_mm_unpackhi_epi16(a_lo, b_lo), 2, outs);
+      unpack_movemask(_mm_unpacklo_epi16(a_hi, b_hi), 2, outs);
+      unpack_movemask(_mm_unpackhi_epi16(a_hi, b_hi), 2, outs);
+    }
+  return i;
+}
+
+static SSE2_FUNC int
+unpack_4_1_sse2(int length, const unsigned char *in, unsigned char **outs)
+{
+  int i;
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      __m128i x = _mm_loadu_si128((const __m128i *) (in + i));
+      __m128i y = _mm_slli_epi16(x, 4);
+      unpack_movemask(_mm_unpacklo_epi8(x, y), 4, outs);
+      unpack_movemask(_mm_unpackhi_epi8(x, y), 4, outs);
+    }
+  return i;
+}
+
+static SSE2_FUNC int
+unpack_8_1_sse2(int length, const unsigned char *in, unsigned char **outs)
+{
+  int i;
+  for (i = 0; i + 16 <= length; i += 16)
+    unpack_movemask(_mm_loadu_si128((const __m128i *) (in + i)), 8, outs);
+  return i;
+}
+/*
+ * PackBits run detection.  A literal stretch ends at the first byte that
+ * begins a run of three equal bytes; compare each block against itself
+ * shifted by one and two bytes.  The nonzero bytes of the literal are
+ * noted in the same pass.  Returns the offset at which scanning stopped
+ * and sets *found if that offset begins a run.
+ */
+static inline SSE2_FUNC void
+note_nonzero_mask(int *nz, int offset, unsigned mask)
+{
+  if (mask)
+    {
+      if (nz[0] < 0)
+	nz[0] = offset + __builtin_ctz(mask);
+      nz[1] = offset + 31 - __builtin_clz(mask);
+    }
+}
+
+static SSE2_FUNC int
+pack_tiff_literal_sse2(const unsigned char *line, int length, int base,
+		       int *nz, int *found)
+{
+  int i;
+  __m128i zero = _mm_setzero_si128();
+  for (i = 0; i + 18 <= length; i += 16)
+    {
+      __m128i a = _mm_loadu_si128((const __m128i *) (line + i));
+      __m128i b = _mm_loadu_si128((const __m128i *) (line + i + 1));
+      __m128i c = _mm_loadu_si128((const __m128i *) (line + i + 2));
+      unsigned runs =
+	_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, b),
+					_mm_cmpeq_epi8(b, c)));
+      unsigned nonzero = 0;
+      if (nz)
+	nonzero = ~_mm_movemask_epi8(_mm_cmpeq_epi8(a, zero)) & 0xffff;
+      if (runs)
+	{
+	  int k = __builtin_ctz(runs);
+	  if (nz)
+	    note_nonzero_mask(nz, base + i, nonzero & ((1u << k) - 1));
+	  *found = 1;
+	  return i + k;
+	}
+      if (nz)
+	note_nonzero_mask(nz, base + i, nonzero);
+    }
+  *found = 0;
+  return i;
+}
+
+/*
+ * Returns the number of bytes, starting at 1, that repeat line[0].
+ */
+static SSE2_FUNC int
+pack_tiff_run_sse2(const unsigned char *line, int length)
+{
+  int i;
+  __m128i repeat = _mm_set1_epi8(line[0]);
+  for (i = 1; i + 16 <= length; i += 16)
+    {
+      unsigned same =
+	_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)
+							 (line + i)),
+					 repeat));
+      if (same != 0xffff)
+	return i + __builtin_ctz(~same);
+    }
+  return i;
+}
+#endif /* STPI_BIT_OPS_SSE2 */
+
 void
 stp_fold(const unsigned char *line,
 	 int single_length,
 	 unsigned char *outbuf)
 {
-  int i;
-  memset(outbuf, 0, single_length * 2);
-  for (i = 0; i < single_length; i++)
+  int i = 0;
+#ifdef STPI_BIT_OPS_SSE2
+  if (stpi_cpu_has_sse2())
+    {
+      i = fold_2bit_sse2(line, single_length, outbuf);
+      line += i;
+      outbuf += 2 * i;
+    }
+#endif
+  memset(outbuf, 0, (single_length - i) * 2);
+  for (; i < single_length; i++)
     {
       unsigned char l0 = line[0];
       unsigned char l1 = line[single_length];
@@ -78,9 +453,17 @@ stp_fold_3bit(const unsigned char *line,
                 int single_length,
                 unsigned char *outbuf)
 {
-  int i;
-  memset(outbuf, 0, single_length * 3);
-  for (i = 0; i < single_length; i++)
+  int i = 0;
+#ifdef STPI_BIT_OPS_SSE2
+  if (stpi_cpu_has_sse2())
+    {
+      i = fold_3bit_sse2(line, single_length, outbuf);
+      line += i;
+      outbuf += 3 * i;
+    }
+#endif
+  memset(outbuf, 0, (single_length - i) * 3);
+  for (; i < single_length; i++)
     {
       unsigned char l0 = line[0];
       unsigned char l1 = line[single_length];
@@ -224,9 +607,17 @@ stp_fold_4bit(const unsigned char *line,
                 int single_length,
                 unsigned char *outbuf)
 {
-  int i;
-  memset(outbuf, 0, single_length * 4);
-  for (i = 0; i < single_length; i++)
+  int i = 0;
+#ifdef STPI_BIT_OPS_SSE2
+  if (stpi_cpu_has_sse2())
+    {
+      i = fold_4bit_sse2(line, single_length, outbuf);
+      line += i;
+      outbuf += 4 * i;
+    }
+#endif
+  memset(outbuf, 0, (single_length - i) * 4);
+  for (; i < single_length; i++)
     {
       unsigned char l0 = line[0];
       unsigned char l1 = line[single_length];
@@ -284,9 +675,17 @@ stp_fold_8bit(const unsigned char *line,
                 int single_length,
                 unsigned char *outbuf)
 {
-  int i;
-  memset(outbuf, 0, single_length * 8);
-  for (i = 0; i < single_length; i++)
+  int i = 0;
+#ifdef STPI_BIT_OPS_SSE2
+  if (stpi_cpu_has_sse2())
+    {
+      i = fold_8bit_sse2(line, single_length, outbuf);
+      line += i;
+      outbuf += 8 * i;
+    }
+#endif
+  memset(outbuf, 0, (single_length - i) * 8);
+  for (; i < single_length; i++)
     {
       unsigned char l0 = line[0];
       unsigned char l1 = line[single_length];
@@ -487,6 +886,14 @@ stpi_unpack_2_1(int length,
 
   if (length <= 0)
     return;
+#ifdef STPI_BIT_OPS_SSE2
+  if (stpi_cpu_has_sse2())
+    {
+      int done = unpack_2_1_sse2(length, in, outs);
+      in += done;
+      length -= done;
+    }
+#endif
   for (bit = 128, temp0 = 0, temp1 = 0;
        length > 0;
        length --)
@@ -568,6 +975,14 @@ stpi_unpack_4_1(int length,
 
   if (length <= 0)
     return;
+#ifdef STPI_BIT_OPS_SSE2
+  if (stpi_cpu_has_sse2())
+    {
+      int done = unpack_4_1_sse2(length, in, outs);
+      in += done;
+      length -= done;
+    }
+#endif
   for (bit = 128, temp0 = 0, temp1 = 0, temp2 = 0, temp3 = 0;
        length > 0;
        length --)
@@ -688,6 +1103,14 @@ stpi_unpack_8_1(int length,
 
   if (length <= 0)
     return;
+#ifdef STPI_BIT_OPS_SSE2
+  if (stpi_cpu_has_sse2())
+    {
+      int done = unpack_8_1_sse2(length, in, outs);
+      in += done;
+      length -= done;
+    }
+#endif
 
   for (bit = 128, temp0 = 0, temp1 = 0, temp2 = 0,
        temp3 = 0, temp4 = 0, temp5 = 0, temp6 = 0, temp7 = 0;
@@ -1182,6 +1605,62 @@ stp_pack_uncompressed(stp_vars_t *v,
     return 1;
 }
 
+/*
+ * Length of the literal (non-repeated) stretch at the start of line: the
+ * offset of the first byte that begins a run of three, or length - 2 if
+ * there is none.  If nz is non-NULL, the first and last nonzero bytes of
+ * the literal are recorded in it, as offsets relative to base.
+ */
+static int
+pack_tiff_literal(const unsigned char *line, int length, int base, int *nz)
+{
+  int i = 0;
+  if (length <= 2)
+    return 0;
+#ifdef STPI_BIT_OPS_SSE2
+  if (stpi_cpu_has_sse2())
+    {
+      int found;
+      i = pack_tiff_literal_sse2(line, length, base, nz, &found);
+      if (found)
+	return i;
+    }
+#endif
+  for (; i < length - 2; i++)
+    {
+      if (line[i] == line[i + 1] && line[i + 1] == line[i + 2])
+	return i;
+      if (nz && line[i])
+	{
+	  if (nz[0] < 0)
+	    nz[0] = base + i;
+	  nz[1] = base + i;
+	}
+    }
+  return length - 2;
+}
+
+/*
+ * Length of the run of line[0] at the start of line.
+ */
+static int
+pack_tiff_run(const unsigned char *line, int length)
+{
+  unsigned char repeat = line[0];
+  int i = 1;
+#ifdef STPI_BIT_OPS_SSE2
+  if (stpi_cpu_has_sse2())
+    {
+      i = pack_tiff_run_sse2(line, length);
+      if (i < length && line[i] != repeat)
+	return i;
+    }
+#endif
+  while (i < length && line[i] == repeat)
+    i++;
+  return i;
+}
+
 int
 stp_pack_tiff(stp_vars_t *v,
 	      const unsigned char *line,
@@ -1197,10 +1676,12 @@ stp_pack_tiff(stp_vars_t *v,
   int tcount;			/* Temporary count < 128 */
   register const unsigned char *xline = line;
   register int xlength = length;
-  find_first_and_last(line, length, first, last);
+  int nonzero[2] = { -1, -1 };	/* First and last nonzero bytes */
+  int *nz = (first && last) ? nonzero : NULL;
 
   /*
    * Compress using TIFF "packbits" run-length encoding...
+   * The first and last nonzero bytes are found in the same pass.
    */
 
   (*comp_ptr) = comp_buf;
@@ -1211,24 +1692,15 @@ stp_pack_tiff(stp_vars_t *v,
        * Get a run of non-repeated chars...
        */
 
-      start  = xline;
-      xline   += 2;
-      xlength -= 2;
-
-      while (xlength > 0 && (xline[-2] != xline[-1] || xline[-1] != xline[0]))
-	{
-	  xline ++;
-	  xlength --;
-	}
-
-      xline   -= 2;
-      xlength += 2;
+      start   = xline;
+      count   = pack_tiff_literal(xline, xlength, xline - line, nz);
+      xline   += count;
+      xlength -= count;
 
       /*
        * Output the non-repeated sequences (max 128 at a time).
        */
 
-      count = xline - start;
       while (count > 0)
 	{
 	  tcount = count > 128 ? 128 : count;
@@ -1248,28 +1720,21 @@ stp_pack_tiff(stp_vars_t *v,
        * Find the repeated sequences...
        */
 
-      start  = xline;
-      repeat = xline[0];
-
-      xline ++;
-      xlength --;
-
-      if (xlength > 0)
+      repeat  = xline[0];
+      count   = pack_tiff_run(xline, xlength);
+      if (nz && repeat)
 	{
-	  int ylength = xlength;
-	  while (ylength && *xline == repeat)
-	    {
-	      xline ++;
-	      ylength --;
-	    }
-	  xlength = ylength;
+	  if (nz[0] < 0)
+	    nz[0] = xline - line;
+	  nz[1] = xline - line + count - 1;
 	}
+      xline   += count;
+      xlength -= count;
 
       /*
        * Output the repeated sequences (max 128 at a time).
        */
 
-      count = xline - start;
       while (count > 0)
 	{
 	  tcount = count > 128 ? 128 : count;
@@ -1281,6 +1746,11 @@ stp_pack_tiff(stp_vars_t *v,
 	  count    -= tcount;
 	}
     }
+  if (nz)
+    {
+      *first = nonzero[0] < 0 ? length : nonzero[0];
+      *last = nonzero[0] < 0 ? 0 : nonzero[1];
+    }
   if (first && last && *first > *last)
     return 0;
   else
@@ -63,17 +63,11 @@ buffered_image_get_appname(stp_image_t *image)
 
 
 static stp_image_status_t
-buffered_image_get_row(stp_image_t* image,unsigned char *data, size_t byte_limit, int row)
+buffered_image_fill(stp_image_t* image, size_t byte_limit)
 {
 	struct buffered_image_priv *priv = image->rep;
-	int width = buffered_image_width(image);
 	int height = buffered_image_height(image);
-	/* FIXME this will break with padding bytes */
-	int bytes_per_pixel = byte_limit / width;
-	int inc = bytes_per_pixel;
-	unsigned char* src;
 	int i;
-	/* fill buffer */
 	if(!priv->buf){
 		priv->buf = stp_zalloc((sizeof(unsigned short*) + 1) * height);
 		if(!priv->buf){
@@ -85,6 +79,23 @@ buffered_image_get_row(stp_image_t* image,unsigned char *data, size_t byte_limit
 				return STP_IMAGE_STATUS_ABORT;
 		}
 	}
+	return STP_IMAGE_STATUS_OK;
+}
+
+static stp_image_status_t
+buffered_image_get_row(stp_image_t* image,unsigned char *data, size_t byte_limit, int row)
+{
+	struct buffered_image_priv *priv = image->rep;
+	int width = buffered_image_width(image);
+	int height = buffered_image_height(image);
+	/* FIXME this will break with padding bytes */
+	int bytes_per_pixel = byte_limit / width;
+	int inc = bytes_per_pixel;
+	unsigned char* src;
+	int i;
+	/* fill buffer */
+	if(STP_IMAGE_STATUS_OK != buffered_image_fill(image, byte_limit))
+		return STP_IMAGE_STATUS_ABORT;
 	if(priv->flags & BUFFER_FLAG_FLIP_Y)
 		row = height - row - 1;
 
@@ -104,6 +115,30 @@ buffered_image_get_row(stp_image_t* image,unsigned char *data, size_t byte_limit
 	return STP_IMAGE_STATUS_OK;
 }
 
+/* Rows that are not mirrored can be used straight from the buffer */
+static stp_image_status_t
+buffered_image_get_row_ptr(stp_image_t* image, const unsigned char **data, size_t byte_limit, int row)
+{
+	struct buffered_image_priv *priv = image->rep;
+	int height = buffered_image_height(image);
+	if(priv->flags & BUFFER_FLAG_FLIP_X)
+		return STP_IMAGE_STATUS_OK;
+	if(STP_IMAGE_STATUS_OK != buffered_image_fill(image, byte_limit))
+		return STP_IMAGE_STATUS_ABORT;
+	if(priv->flags & BUFFER_FLAG_FLIP_Y)
+		row = height - row - 1;
+	*data = priv->buf[row];
+	return STP_IMAGE_STATUS_OK;
+}
+
+stp_image_row_ptr_func_t
+stpi_buffered_image_row_ptr_func(const stp_image_t *image)
+{
+	if(image->get_row == buffered_image_get_row)
+		return buffered_image_get_row_ptr;
+	return NULL;
+}
+
 static void
 buffered_image_conclude(stp_image_t * image)
 {
@@ -43,6 +43,14 @@
 #define FMAX(a, b) ((a) > (b) ? (a) : (b))
 #define FMIN(a, b) ((a) < (b) ? (a) : (b))
 
+#if defined(HAVE_EMMINTRIN_H) && defined(__GNUC__) && \
+  (defined(__i386__) || defined(__x86_64__))
+#define STPI_CHANNEL_SSE2
+#include <emmintrin.h>
+
+#define SSE2_FUNC __attribute__((__target__("sse2")))
+#endif
+
 typedef struct
 {
   double value;
@@ -667,61 +675,8 @@ stp_channel_initialize(stp_vars_t *v, stp_image_t *image,
     }
 }
 
-static void
-clear_channel(unsigned short *data, unsigned width, unsigned depth)
-{
-  int i;
-  width *= depth;
-  for (i = 0; i < width; i += depth)
-    data[i] = 0;
-}
-
-static int
-scale_channel(unsigned short *data, unsigned width, unsigned depth,
-	      unsigned short density)
-{
-  int i;
-  int retval = 0;
-  unsigned short previous_data = 0;
-  unsigned short previous_value = 0;
-  width *= depth;
-  for (i = 0; i < width; i += depth)
-    {
-      if (data[i] == previous_data)
-	data[i] = previous_value;
-      else if (data[i] == (unsigned short) 65535)
-	{
-	  data[i] = density;
-	  retval = 1;
-	}
-      else if (data[i] > 0)
-	{
-	  unsigned short tval = (32767u + data[i] * density) / 65535u;
-	  previous_data = data[i];
-	  if (tval)
-	    retval = 1;
-	  previous_value = (unsigned short) tval;
-	  data[i] = (unsigned short) tval;
-	}
-    }
-  return retval;
-}
-
-static int
-scan_channel(unsigned short *data, unsigned width, unsigned depth)
-{
-  int i;
-  width *= depth;
-  for (i = 0; i < width; i += depth)
-    {
-      if (data[i])
-	return 1;
-    }
-  return 0;
-}
-
 static inline unsigned
-ink_sum(const unsigned short *data, int total_channels)
+ink_sum(const unsigned short *data, unsigned total_channels)
 {
   int j;
   unsigned total_ink = 0;
@@ -730,35 +685,6 @@ ink_sum(const unsigned short *data, int total_channels)
   return total_ink;
 }
 
-static int
-limit_ink(const stp_vars_t *v)
-{
-  int i;
-  int retval = 0;
-  stpi_channel_group_t *cg = get_channel_group(v);
-  unsigned short *ptr;
-  if (!cg || cg->ink_limit == 0 || cg->ink_limit >= cg->max_density)
-    return 0;
-  ptr = cg->output_data;
-  for (i = 0; i < cg->width; i++)
-    {
-      int total_ink = ink_sum(ptr, cg->total_channels);
-      if (total_ink > cg->ink_limit) /* Need to limit ink? */
-	{
-	  int j;
-	  /*
-	   * FIXME we probably should first try to convert light ink to dark
-	   */
-	  double ratio = (double) cg->ink_limit / (double) total_ink;
-	  for (j = 0; j < cg->total_channels; j++)
-	    ptr[j] *= ratio;
-	  retval = 1;
-	}
-      ptr += cg->total_channels;
-   }
-  return retval;
-}
-
 static inline int
 short_eq(const unsigned short *i1, const unsigned short *i2, size_t count)
 {
@@ -785,34 +711,6 @@ short_copy(unsigned short *out, const unsigned short *in, size_t count)
 #endif
 }
 
-static void
-copy_channels(const stp_vars_t *v)
-{
-  stpi_channel_group_t *cg = get_channel_group(v);
-  int i, j, k;
-  const unsigned short *input;
-  unsigned short *output;
-  if (!cg)
-    return;
-  input = cg->input_data;
-  output = cg->output_data;
-  for (i = 0; i < cg->width; i++)
-    {
-      for (j = 0; j < cg->channel_count; j++)
-	{
-	  stpi_channel_t *ch = &(cg->c[j]);
-	  for (k = 0; k < ch->subchannel_count; k++)
-	    {
-	      if (cg->gloss_channel != j)
-		{
-		  *output = *input++;
-		}
-	      output++;
-	    }
-	}	  
-    }
-}
-
 static inline double
 compute_hue(int c, int m, int y, int max)
 {
@@ -842,319 +740,496 @@ interpolate_value(const double *vec, double val)
   return lval;
 }
 
-static void
-generate_special_channels(const stp_vars_t *v)
+/*
+ * The conversion from the color module's output to the printer's
+ * channels is done in one pass over the row, one pixel at a time:
+ *
+ *   special channels or gloss copy -> GCR -> split or scale ->
+ *   ink limit -> gloss
+ *
+ * Each stage below handles a single pixel.  The splitting and special
+ * channel stages are expensive enough to be worth remembering the
+ * previous pixel's result; those results are kept in separate buffers,
+ * since by the time the next pixel is processed the row buffers hold
+ * the output of the later stages.
+ */
+
+static inline void
+special_pixel(const stpi_channel_group_t *cg, const unsigned short *input,
+	      unsigned short *output)
 {
-  stpi_channel_group_t *cg = get_channel_group(v);
-  int i, j;
-  const unsigned short *input_cache = NULL;
-  const unsigned short *output_cache = NULL;
-  const unsigned short *input;
-  unsigned short *output;
-  int offset;
-  int outbytes;
-  if (!cg)
-    return;
-  input = cg->input_data;
-  output = cg->multi_tmp;
-  offset = (cg->black_channel >= 0 ? 0 : -1);
-  outbytes = cg->aux_output_channels * sizeof(unsigned short);
-  for (i = 0; i < cg->width;
-       input += cg->input_channels, output += cg->aux_output_channels, i++)
+  int j;
+  int offset = (cg->black_channel >= 0 ? 0 : -1);
+  int c = input[STP_ECOLOR_C + offset];
+  int m = input[STP_ECOLOR_M + offset];
+  int y = input[STP_ECOLOR_Y + offset];
+  int min = FMIN(c, FMIN(m, y));
+  int max = FMAX(c, FMAX(m, y));
+  if (max > min)	/* Otherwise it's gray, and we don't care */
     {
-      if (input_cache && short_eq(input_cache, input, cg->input_channels))
+      double hue;
+      /*
+       * We're only interested in converting color components
+       * to special inks.  We want to compute the hue and
+       * luminosity to determine what we want to convert.
+       * Since we're eliminating all grayscale component, the
+       * computations become simpler.
+       */
+      c -= min;
+      m -= min;
+      y -= min;
+      max -= min;
+      if (offset == 0)
+	output[STP_ECOLOR_K] = input[STP_ECOLOR_K];
+      hue = compute_hue(c, m, y, max);
+      for (j = 1; j < cg->aux_output_channels - offset; j++)
 	{
-	  memcpy(output, output_cache, outbytes);
-	}
-      else
-	{
-	  int c = input[STP_ECOLOR_C + offset];
-	  int m = input[STP_ECOLOR_M + offset];
-	  int y = input[STP_ECOLOR_Y + offset];
-	  int min = FMIN(c, FMIN(m, y));
-	  int max = FMAX(c, FMAX(m, y));
-	  if (max > min)	/* Otherwise it's gray, and we don't care */
-	    {
-	      double hue;
-	      /*
-	       * We're only interested in converting color components
-	       * to special inks.  We want to compute the hue and
-	       * luminosity to determine what we want to convert.
-	       * Since we're eliminating all grayscale component, the
-	       * computations become simpler.
-	       */
-	      c -= min;
-	      m -= min;
-	      y -= min;
-	      max -= min;
-	      if (offset == 0)
-		output[STP_ECOLOR_K] = input[STP_ECOLOR_K];
-	      hue = compute_hue(c, m, y, max);
-	      for (j = 1; j < cg->aux_output_channels - offset; j++)
-		{
-		  stpi_channel_t *ch = &(cg->c[j]);
-		  if (ch->hue_map)
-		    output[j + offset] =
-		      max * interpolate_value(ch->hue_map,
-					      hue * ch->h_count / 6.0);
-		  else
-		    output[j + offset] = 0;
-		}
-	      output[STP_ECOLOR_C + offset] += min;
-	      output[STP_ECOLOR_M + offset] += min;
-	      output[STP_ECOLOR_Y + offset] += min;
-	    }
+	  stpi_channel_t *ch = &(cg->c[j]);
+	  if (ch->hue_map)
+	    output[j + offset] =
+	      max * interpolate_value(ch->hue_map, hue * ch->h_count / 6.0);
 	  else
-	    {
-	      for (j = 0; j < 4 + offset; j++)
-		output[j] = input[j];
-	      for (j = 4 + offset; j < cg->aux_output_channels; j++)
-		output[j] = 0;
-	    }
+	    output[j + offset] = 0;
 	}
-      input_cache = input;
-      output_cache = output;
+      output[STP_ECOLOR_C + offset] += min;
+      output[STP_ECOLOR_M + offset] += min;
+      output[STP_ECOLOR_Y + offset] += min;
+    }
+  else
+    {
+      for (j = 0; j < 4 + offset; j++)
+	output[j] = input[j];
+      for (j = 4 + offset; j < cg->aux_output_channels; j++)
+	output[j] = 0;
     }
 }
 
-static void
-split_channels(const stp_vars_t *v, unsigned *zero_mask)
+static inline void
+copy_pixel(const stpi_channel_group_t *cg, const unsigned short *input,
+	   unsigned short *output)
 {
-  stpi_channel_group_t *cg = get_channel_group(v);
-  int i, j, k;
-  int nz[STP_CHANNEL_LIMIT];
-  int outbytes;
-  const unsigned short *input_cache = NULL;
-  const unsigned short *output_cache = NULL;
-  const unsigned short *input;
-  unsigned short *output;
-  if (!cg)
-    return;
-  outbytes = cg->total_channels * sizeof(unsigned short);
-  input = cg->split_input;
-  output = cg->output_data;
-  for (i = 0; i < cg->total_channels; i++)
-    nz[i] = 0;
-  for (i = 0; i < cg->width; i++)
+  int j, k;
+  for (j = 0; j < cg->channel_count; j++)
     {
-      int zero_ptr = 0;
-      if (input_cache && short_eq(input_cache, input, cg->aux_output_channels))
+      const stpi_channel_t *ch = &(cg->c[j]);
+      for (k = 0; k < ch->subchannel_count; k++)
 	{
-	  memcpy(output, output_cache, outbytes);
-	  input += cg->aux_output_channels;
-	  output += cg->total_channels;
+	  if (cg->gloss_channel != j)
+	    *output = *input++;
+	  output++;
 	}
-      else
+    }
+}
+
+static inline void
+gcr_pixel(const stpi_channel_group_t *cg, const unsigned short *gcr_lookup,
+	  unsigned short *output)
+{
+  unsigned k = output[0];
+  if (k > 0)
+    {
+      int kk = gcr_lookup[k];
+      int ck;
+      if (kk > k)
+	kk = k;
+      ck = k - kk;
+      output[0] = kk;
+      output[1] += ck * cg->cyan_balance;
+      output[2] += ck * cg->magenta_balance;
+      output[3] += ck * cg->yellow_balance;
+    }
+}
+
+static inline void
+split_pixel(const stpi_channel_group_t *cg, const unsigned short *input,
+	    unsigned short *output, int *nz)
+{
+  int j, k;
+  int zero_ptr = 0;
+  unsigned black_value = 0;
+  unsigned virtual_black = 65535;
+  if (cg->black_channel >= 0)
+    black_value = input[cg->black_channel];
+  for (j = 0; j < cg->aux_output_channels; j++)
+    {
+      if (input[j] < virtual_black && j != cg->black_channel)
+	virtual_black = input[j];
+    }
+  black_value += virtual_black / 4;
+  for (j = 0; j < cg->channel_count; j++)
+    {
+      const stpi_channel_t *c = &(cg->c[j]);
+      int s_count = c->subchannel_count;
+      if (s_count >= 1)
 	{
-	  unsigned black_value = 0;
-	  unsigned virtual_black = 65535;
-	  input_cache = input;
-	  output_cache = output;
-	  if (cg->black_channel >= 0)
-	    black_value = input[cg->black_channel];
-	  for (j = 0; j < cg->aux_output_channels; j++)
+	  unsigned i_val = *input++;
+	  if (i_val == 0)
+	    {
+	      for (k = 0; k < s_count; k++)
+		*(output++) = 0;
+	    }
+	  else if (s_count == 1)
 	    {
-	      if (input[j] < virtual_black && j != cg->black_channel)
-		virtual_black = input[j];
+	      if (c->sc[0].s_density < 65535)
+		i_val = i_val * c->sc[0].s_density / 65535;
+	      nz[zero_ptr++] |= *(output++) = i_val;
 	    }
-	  black_value += virtual_black / 4;
-	  for (j = 0; j < cg->channel_count; j++)
+	  else
 	    {
-	      stpi_channel_t *c = &(cg->c[j]);
-	      int s_count = c->subchannel_count;
-	      if (s_count >= 1)
+	      unsigned l_val = i_val;
+	      unsigned offset;
+	      if (i_val > 0 && black_value && j != cg->black_channel)
 		{
-		  unsigned i_val = *input++;
-		  if (i_val == 0)
-		    {
-		      for (k = 0; k < s_count; k++)
-			*(output++) = 0;
-		    }
-		  else if (s_count == 1)
+		  l_val += black_value;
+		  if (l_val > 65535)
+		    l_val = 65535;
+		}
+	      offset = l_val * s_count;
+	      for (k = 0; k < s_count; k++)
+		{
+		  unsigned o_val;
+		  if (c->sc[k].s_density > 0)
 		    {
-		      if (c->sc[0].s_density < 65535)
-			i_val = i_val * c->sc[0].s_density / 65535;
-		      nz[zero_ptr++] |= *(output++) = i_val;
+		      o_val = c->lut[offset + k];
+		      if (i_val != l_val)
+			o_val = o_val * i_val / l_val;
+		      if (c->sc[k].s_density < 65535)
+			o_val = o_val * c->sc[k].s_density / 65535;
 		    }
 		  else
-		    {
-		      unsigned l_val = i_val;
-		      unsigned offset;
-		      if (i_val > 0 && black_value && j != cg->black_channel)
-			{
-			  l_val += black_value;
-			  if (l_val > 65535)
-			    l_val = 65535;
-			}
-		      offset = l_val * s_count;
-		      for (k = 0; k < s_count; k++)
-			{
-			  unsigned o_val;
-			  if (c->sc[k].s_density > 0)
-			    {
-			      o_val = c->lut[offset + k];
-			      if (i_val != l_val)
-				o_val = o_val * i_val / l_val;
-			      if (c->sc[k].s_density < 65535)
-				o_val = o_val * c->sc[k].s_density / 65535;
-			    }
-			  else
-			    o_val = 0;
-			  *output++ = o_val;
-			  nz[zero_ptr++] |= o_val;
-			}
-		    }
+		    o_val = 0;
+		  *output++ = o_val;
+		  nz[zero_ptr++] |= o_val;
 		}
 	    }
 	}
     }
-  if (zero_mask)
+}
+
+/*
+ * density[] holds the density of each physical channel, or -1 for
+ * channels (gloss) that are not scaled.
+ */
+static inline void
+scale_pixel(const int *density, unsigned short *output, int *nz,
+	    unsigned total_channels)
+{
+  int i;
+  for (i = 0; i < total_channels; i++)
     {
-      *zero_mask = 0;
-      for (i = 0; i < cg->total_channels; i++)
-	if (!nz[i])
-	  *zero_mask |= 1 << i;
+      unsigned val = output[i];
+      if (density[i] < 0)
+	continue;
+      if (density[i] == 0)
+	val = 0;
+      else if (density[i] != 65535 && val > 0)
+	{
+	  if (val == 65535)
+	    val = density[i];
+	  else
+	    val = (32767u + val * density[i]) / 65535u;
+	}
+      output[i] = val;
+      nz[i] |= val;
     }
 }
 
-static void
-scale_channels(const stp_vars_t *v, unsigned *zero_mask)
+/*
+ * The ink limiting ratio ink_limit / total_ink, which is less than 1,
+ * as a 0.16 fixed point number.  total_ink is less than 2^22 (64
+ * channels of 16 bits), so this is done as two 8 bit steps of long
+ * division.  Rounding down means that limited values are at most one
+ * less than the exact result, and the total never exceeds the limit.
+ */
+static inline unsigned
+limit_ratio(unsigned ink_limit, unsigned total_ink)
 {
-  stpi_channel_group_t *cg = get_channel_group(v);
-  int i, j;
-  int physical_channel = 0;
-  if (!cg)
-    return;
-  if (zero_mask)
-    *zero_mask = 0;
-  for (i = 0; i < cg->channel_count; i++)
+  unsigned high = (ink_limit << 8) / total_ink;
+  unsigned rem = (ink_limit << 8) % total_ink;
+  return (high << 8) + (rem << 8) / total_ink;
+}
+
+static inline int
+limit_ink_pixel(unsigned short *output, unsigned ink_limit,
+		unsigned total_channels)
+{
+  unsigned total_ink = ink_sum(output, total_channels);
+  if (total_ink > ink_limit) /* Need to limit ink? */
     {
-      stpi_channel_t *ch = &(cg->c[i]);
-      if (ch->subchannel_count > 0)
-	for (j = 0; j < ch->subchannel_count; j++)
-	  {
-	    if (cg->gloss_channel != i)
-	      {
-		stpi_subchannel_t *sch = &(ch->sc[j]);
-		unsigned density = sch->s_density;
-		unsigned short *output = cg->output_data + physical_channel;
-		if (density == 0)
-		  {
-		    clear_channel(output, cg->width, cg->total_channels);
-		    if (zero_mask)
-		      *zero_mask |= 1 << physical_channel;
-		  }
-		else if (density != 65535)
-		  {
-		    if (scale_channel(output, cg->width, cg->total_channels,
-				      density) == 0)
-		      if (zero_mask)
-			*zero_mask |= 1 << physical_channel;
-		  }
-		else if (zero_mask)
-		  {
-		    if (scan_channel(output, cg->width, cg->total_channels)==0)
-		      *zero_mask |= 1 << physical_channel;
-		  }
-	      }
-	    physical_channel++;
-	  }
+      int j;
+      /*
+       * FIXME we probably should first try to convert light ink to dark
+       */
+      unsigned ratio = limit_ratio(ink_limit, total_ink);
+      for (j = 0; j < total_channels; j++)
+	output[j] = (output[j] * ratio) >> 16;
+      return 1;
     }
+  return 0;
 }
 
-static void
-generate_gloss(const stp_vars_t *v, unsigned *zero_mask)
+#ifdef STPI_CHANNEL_SSE2
+/*
+ * SSE2 versions of the scaling and ink limiting stages, for pixels of
+ * up to 8 channels (one register).  Scaling gives exactly the same
+ * result as scale_pixel, and ink limiting the same as limit_ink_pixel.
+ */
+static inline SSE2_FUNC __m128i
+load_pixel_sse2(const unsigned short *data, unsigned total_channels)
 {
-  stpi_channel_group_t *cg = get_channel_group(v);
-  unsigned short *output;
-  unsigned gloss_mask;
-  int i, j, k;
-  if (!cg || cg->gloss_channel == -1 || cg->gloss_limit <= 0)
-    return;
-  output = cg->output_data;
-  gloss_mask = ~(1 << cg->gloss_physical_channel);
-  for (i = 0; i < cg->width; i++)
+  unsigned short tmp[8];
+  if (total_channels == 8)
+    return _mm_loadu_si128((const __m128i *) data);
+  memset(tmp, 0, sizeof(tmp));
+  memcpy(tmp, data, total_channels * sizeof(unsigned short));
+  return _mm_loadu_si128((const __m128i *) tmp);
+}
+
+static inline SSE2_FUNC void
+store_pixel_sse2(unsigned short *data, __m128i val, unsigned total_channels)
+{
+  unsigned short tmp[8];
+  if (total_channels == 8)
     {
-      int physical_channel = 0;
-      unsigned channel_sum = 0;
-      output[cg->gloss_physical_channel] = 0;
-      for (j = 0; j < cg->channel_count; j++)
-	{
-	  stpi_channel_t *ch = &(cg->c[j]);
-	  for (k = 0; k < ch->subchannel_count; k++)
-	    {
-	      if (cg->gloss_channel != j)
-		{
-		  channel_sum += (unsigned) output[physical_channel];
-		  if (channel_sum >= cg->gloss_limit)
-		    goto next;
-		}
-	      physical_channel++;
-	    }
-	}
-      if (channel_sum < cg->gloss_limit)
-	{
-	  unsigned gloss_required = cg->gloss_limit - channel_sum;
-	  if (gloss_required > 65535)
-	    gloss_required = 65535;
-	  output[cg->gloss_physical_channel] = gloss_required;
-	  if (zero_mask)
-	    *zero_mask &= gloss_mask;
-	}
-    next:
-      output += cg->total_channels;
+      _mm_storeu_si128((__m128i *) data, val);
+      return;
     }
+  _mm_storeu_si128((__m128i *) tmp, val);
+  memcpy(data, tmp, total_channels * sizeof(unsigned short));
 }
 
-static void
-do_gcr(const stp_vars_t *v)
+/*
+ * (32767 + val * density) / 65535 for four 32 bit products.  Division
+ * by 65535 is (x + (x >> 16) + 1) >> 16 for x < 65535 * 65536.
+ */
+static inline SSE2_FUNC __m128i
+scale_products_sse2(__m128i x)
+{
+  x = _mm_add_epi32(x, _mm_set1_epi32(32767));
+  x = _mm_add_epi32(_mm_add_epi32(x, _mm_srli_epi32(x, 16)),
+		    _mm_set1_epi32(1));
+  x = _mm_srli_epi32(x, 16);
+  /* Sign extend so that the saturating pack keeps the low 16 bits */
+  return _mm_srai_epi32(_mm_slli_epi32(x, 16), 16);
+}
+
+/*
+ * density holds the density of each channel and keep is all ones for
+ * channels that are not scaled.
+ */
+static inline SSE2_FUNC void
+scale_pixel_sse2(const unsigned short *density, const unsigned short *keep,
+		 unsigned short *output, unsigned short *nz,
+		 unsigned total_channels)
+{
+  __m128i val = load_pixel_sse2(output, total_channels);
+  __m128i d = _mm_loadu_si128((const __m128i *) density);
+  __m128i k = _mm_loadu_si128((const __m128i *) keep);
+  __m128i lo = _mm_mullo_epi16(val, d);
+  __m128i hi = _mm_mulhi_epu16(val, d);
+  __m128i res = _mm_packs_epi32
+    (scale_products_sse2(_mm_unpacklo_epi16(lo, hi)),
+     scale_products_sse2(_mm_unpackhi_epi16(lo, hi)));
+  res = _mm_or_si128(_mm_and_si128(k, val), _mm_andnot_si128(k, res));
+  store_pixel_sse2(output, res, total_channels);
+  _mm_storeu_si128((__m128i *) nz,
+		   _mm_or_si128(_mm_loadu_si128((const __m128i *) nz), res));
+}
+
+static inline SSE2_FUNC int
+limit_ink_pixel_sse2(unsigned short *output, unsigned ink_limit,
+		     unsigned total_channels)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i val = load_pixel_sse2(output, total_channels);
+  __m128i sum = _mm_add_epi32(_mm_unpacklo_epi16(val, zero),
+			      _mm_unpackhi_epi16(val, zero));
+  unsigned total_ink;
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  total_ink = _mm_cvtsi128_si32(sum);
+  if (total_ink > ink_limit)
+    {
+      __m128i ratio =
+	_mm_set1_epi16((short) limit_ratio(ink_limit, total_ink));
+      store_pixel_sse2(output, _mm_mulhi_epu16(val, ratio), total_channels);
+      return 1;
+    }
+  return 0;
+}
+#endif
+
+static inline int
+gloss_pixel(const stpi_channel_group_t *cg, const int *density,
+	    unsigned short *output, unsigned total_channels)
 {
-  stpi_channel_group_t *cg = get_channel_group(v);
-  const unsigned short *gcr_lookup;
-  unsigned short *output;
-  size_t count;
   int i;
+  unsigned channel_sum = 0;
+  output[cg->gloss_physical_channel] = 0;
+  for (i = 0; i < total_channels; i++)
+    if (density[i] >= 0)
+      {
+	channel_sum += (unsigned) output[i];
+	if (channel_sum >= cg->gloss_limit)
+	  return 0;
+      }
+  if (channel_sum < cg->gloss_limit)
+    {
+      unsigned gloss_required = cg->gloss_limit - channel_sum;
+      if (gloss_required > 65535)
+	gloss_required = 65535;
+      output[cg->gloss_physical_channel] = gloss_required;
+      return 1;
+    }
+  return 0;
+}
 
-  if (!cg)
-    return;
+/*
+ * Convert one row.  This is inlined into stp_channel_convert with
+ * constant channel counts for the common cases so that the per-pixel
+ * loops over the channels can be unrolled.
+ */
+static inline void
+convert_row(const stp_vars_t *v, stpi_channel_group_t *cg,
+	    unsigned *zero_mask, unsigned total_channels)
+{
+  int special = input_has_special_channels(v);
+  int split = input_needs_splitting(v);
+  int copy = !special && output_has_gloss(v) && !split;
+  int limit = cg->ink_limit > 0 && cg->ink_limit < cg->max_density;
+  int gloss = cg->gloss_channel != -1 && cg->gloss_limit > 0;
+  int gloss_seen = 0;
+  const unsigned short *gcr_lookup = NULL;
+  const unsigned short *input = cg->input_data;
+  unsigned short *mid = cg->gcr_data;
+  unsigned short *output = cg->output_data;
+  const unsigned short *input_cache = NULL;
+  const unsigned short *split_cache = NULL;
+  unsigned short special_out[STP_CHANNEL_LIMIT];
+  unsigned short split_out[STP_CHANNEL_LIMIT];
+  int density[STP_CHANNEL_LIMIT];
+  int nz[STP_CHANNEL_LIMIT];
+  int i, j, k;
+  int physical_channel = 0;
+#ifdef STPI_CHANNEL_SSE2
+  unsigned short density16[8];
+  unsigned short keep16[8];
+  unsigned short nz16[8];
+  int sse2 = total_channels <= 8 && stpi_cpu_has_sse2();
+#endif
+
+  for (i = 0; i < cg->channel_count; i++)
+    for (j = 0; j < cg->c[i].subchannel_count; j++)
+      density[physical_channel++] =
+	(cg->gloss_channel == i ? -1 : cg->c[i].sc[j].s_density);
+  for (i = 0; i < total_channels; i++)
+    nz[i] = 0;
+#ifdef STPI_CHANNEL_SSE2
+  for (i = 0; i < 8; i++)
+    {
+      density16[i] = (i < total_channels && density[i] > 0) ? density[i] : 0;
+      keep16[i] = (i < total_channels && density[i] < 0) ? 0xffff : 0;
+      nz16[i] = 0;
+    }
+#endif
+  if (output_needs_gcr(v))
+    {
+      size_t count;
+      stp_curve_resample(cg->gcr_curve, 65536);
+      gcr_lookup = stp_curve_get_ushort_data(cg->gcr_curve, &count);
+    }
 
-  output = cg->gcr_data;
-  stp_curve_resample(cg->gcr_curve, 65536);
-  gcr_lookup = stp_curve_get_ushort_data(cg->gcr_curve, &count);
   for (i = 0; i < cg->width; i++)
     {
-      unsigned k = output[0];
-      if (k > 0)
+      if (special)
 	{
-	  int kk = gcr_lookup[k];
-	  int ck;
-	  if (kk > k)
-	    kk = k;
-	  ck = k - kk;
-	  output[0] = kk;
-	  output[1] += ck * cg->cyan_balance;
-	  output[2] += ck * cg->magenta_balance;
-	  output[3] += ck * cg->yellow_balance;
+	  if (input_cache &&
+	      short_eq(input_cache, input, cg->input_channels))
+	    short_copy(mid, special_out, cg->aux_output_channels);
+	  else
+	    {
+	      special_pixel(cg, input, mid);
+	      short_copy(special_out, mid, cg->aux_output_channels);
+	    }
+	  input_cache = input;
+	}
+      else if (copy)
+	copy_pixel(cg, input, output);
+      if (gcr_lookup)
+	gcr_pixel(cg, gcr_lookup, mid);
+      if (split)
+	{
+	  if (split_cache &&
+	      short_eq(split_cache, mid, cg->aux_output_channels))
+	    short_copy(output, split_out, total_channels);
+	  else
+	    {
+	      split_pixel(cg, mid, output, nz);
+	      short_copy(split_out, output, total_channels);
+	      split_cache = mid;
+	    }
 	}
-      output += cg->gcr_channels;
+#ifdef STPI_CHANNEL_SSE2
+      else if (sse2)
+	scale_pixel_sse2(density16, keep16, output, nz16, total_channels);
+#endif
+      else
+	scale_pixel(density, output, nz, total_channels);
+      if (limit)
+	{
+#ifdef STPI_CHANNEL_SSE2
+	  if (sse2)
+	    (void) limit_ink_pixel_sse2(output, cg->ink_limit,
+					total_channels);
+	  else
+#endif
+	    (void) limit_ink_pixel(output, cg->ink_limit, total_channels);
+	}
+      if (gloss)
+	gloss_seen |= gloss_pixel(cg, density, output, total_channels);
+      input += cg->input_channels;
+      mid += cg->gcr_channels;
+      output += total_channels;
+    }
+
+#ifdef STPI_CHANNEL_SSE2
+  if (sse2)
+    for (k = 0; k < total_channels; k++)
+      nz[k] |= nz16[k];
+#endif
+  if (zero_mask)
+    {
+      *zero_mask = 0;
+      for (k = 0; k < total_channels; k++)
+	if (!nz[k] && (split || density[k] >= 0))
+	  *zero_mask |= 1 << k;
+      if (gloss_seen)
+	*zero_mask &= ~(1 << cg->gloss_physical_channel);
     }
 }
 
 void
 stp_channel_convert(const stp_vars_t *v, unsigned *zero_mask)
 {
-  if (input_has_special_channels(v))
-    generate_special_channels(v);
-  else if (output_has_gloss(v) && !input_needs_splitting(v))
-    copy_channels(v);
-  if (output_needs_gcr(v))
-    do_gcr(v);
-  if (input_needs_splitting(v))
-    split_channels(v, zero_mask);
-  else
-    scale_channels(v, zero_mask);
-  (void) limit_ink(v);
-  (void) generate_gloss(v, zero_mask);
+  stpi_channel_group_t *cg = get_channel_group(v);
+  switch (cg->total_channels)
+    {
+    case 4:
+      convert_row(v, cg, zero_mask, 4);
+      break;
+    case 6:
+      convert_row(v, cg, zero_mask, 6);
+      break;
+    case 7:
+      convert_row(v, cg, zero_mask, 7);
+      break;
+    case 8:
+      convert_row(v, cg, zero_mask, 8);
+      break;
+    default:
+      convert_row(v, cg, zero_mask, cg->total_channels);
+      break;
+    }
 }
 
 unsigned short *
@@ -1174,3 +1249,12 @@ stp_channel_get_output(const stp_vars_t *v)
     return NULL;
   return cg->output_data;
 }
+
+size_t
+stpi_channel_get_output_size(const stp_vars_t *v)
+{
+  stpi_channel_group_t *cg = get_channel_group(v);
+  if (!cg)
+    return 0;
+  return sizeof(unsigned short) * cg->total_channels * cg->width;
+}
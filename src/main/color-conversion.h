@@ -92,11 +92,22 @@ typedef struct
   const char *rgb_curve_name;
 } channel_param_t;
 
+typedef struct lut lut_t;
+
 /* Color conversion function */
-typedef unsigned (*stp_convert_t)(const stp_vars_t *vars,
+typedef unsigned (*stp_convert_t)(lut_t *lut,
 				  const unsigned char *in,
 				  unsigned short *out);
 
+/*
+ * Choose the conversion function for a job.  The selector also sets
+ * lut->prepared.prepare to the function that resamples the curves the
+ * conversion function uses.
+ */
+typedef stp_convert_t (*stp_convert_select_t)(lut_t *lut);
+
+typedef void (*stp_convert_prepare_t)(lut_t *lut, int bits);
+
 #define CMASK_NONE   (0)
 #define CMASK_RGB    (CMASK_R | CMASK_G | CMASK_B)
 #define CMASK_CMY    (CMASK_C | CMASK_M | CMASK_Y)
@@ -125,7 +136,7 @@ typedef struct
   unsigned channels;
   int channel_count;
   color_correction_enum_t default_correction;
-  stp_convert_t conversion_function;
+  stp_convert_select_t select_conversion;
 } color_description_t;
 
 typedef struct
@@ -134,11 +145,61 @@ typedef struct
   size_t bits;
 } channel_depth_t;
 
+/*
+ * Everything the conversion functions need that doesn't change over the
+ * course of a job, resolved once by stpi_color_prepare_conversion() so
+ * that no parameter or curve lookups are needed per row.
+ */
+typedef struct
+{
+  stp_convert_t convert;	/* Conversion function for this job */
+  stp_convert_prepare_t prepare; /* Prepares the curves convert uses, */
+  int prepare_bits;		/* for input of this many bits */
+  const char *from_name;	/* Names of the conversion, for debugging */
+  const char *to_name;
+  double saturation;
+  double isat;			/* 1 / saturation if saturation > 1 */
+  double hsl_saturation;	/* Saturation applied in HSL space */
+  double hsl_isat;
+  int compute_saturation;
+  int split_saturation;
+  int do_user_adjustment;	/* Brightness is not 1 */
+  int bright_color_adjustment;
+  int hue_only_color_adjustment;
+  /* Curve data, filled in by prepare */
+  const unsigned short *red;
+  const unsigned short *green;
+  const unsigned short *blue;
+  const unsigned short *composite;
+  const unsigned short *brightness;
+  const unsigned short *contrast;
+  const unsigned short *user;
+  const unsigned short *maps[STP_CHANNEL_LIMIT];
+} prepared_conversion_t;
+
+/*
+ * Results of converting one input row, kept so that a later identical
+ * row can skip the conversion.
+ */
+#define ROW_CACHE_SIZE 4
+
 typedef struct
+{
+  int valid;
+  unsigned hash;
+  unsigned zero_mask;
+  unsigned char *in;		/* Input row */
+  unsigned short *channel_in;	/* Channel input, if not the output */
+  unsigned short *channel_out;	/* Channel output */
+} row_cache_entry_t;
+
+struct lut
 {
   unsigned steps;
   int channel_depth;
   int image_width;
+  int convert_width;		/* Pixels per conversion function call */
+  int band_rows;		/* Rows the temporary buffers can hold */
   int in_channels;
   int out_channels;
   int channels_are_initialized;
@@ -157,7 +218,6 @@ typedef struct
   double contrast;
   double brightness;
   int linear_contrast_adjustment;
-  int printed_colorfunc;
   int simple_gamma_correction;
   stp_cached_curve_t hue_map;
   stp_cached_curve_t lum_map;
@@ -165,20 +225,20 @@ typedef struct
   unsigned short *gray_tmp;	/* Color -> Gray */
   unsigned short *cmy_tmp;	/* CMY -> CMYK */
   unsigned char *in_data;
-} lut_t;
-
-extern unsigned stpi_color_convert_to_gray(const stp_vars_t *v,
-					   const unsigned char *,
-					   unsigned short *);
-extern unsigned stpi_color_convert_to_color(const stp_vars_t *v,
-					    const unsigned char *,
-					    unsigned short *);
-extern unsigned stpi_color_convert_to_kcmy(const stp_vars_t *v,
-					   const unsigned char *,
-					   unsigned short *);
-extern unsigned stpi_color_convert_raw(const stp_vars_t *v,
-				       const unsigned char *,
-				       unsigned short *);
+  unsigned char *band_in;	/* Input rows for stp_color_get_rows */
+  unsigned short *band_out;	/* Converted rows for stp_color_get_rows */
+  int rgb_grid_size;		/* Points per axis of RGB table; 0 = none */
+  unsigned short *rgb_table;	/* Precomputed RGB -> RGB table */
+  prepared_conversion_t prepared;
+  row_cache_entry_t row_cache[ROW_CACHE_SIZE];
+  int row_cache_next;		/* Entry to replace next */
+};
+
+extern stp_convert_t stpi_color_select_to_gray(lut_t *lut);
+extern stp_convert_t stpi_color_select_to_color(lut_t *lut);
+extern stp_convert_t stpi_color_select_to_kcmy(lut_t *lut);
+extern stp_convert_t stpi_color_select_raw(lut_t *lut);
+extern void stpi_color_prepare_conversion(const stp_vars_t *v, lut_t *lut);
 
 #ifdef __cplusplus
   }
@@ -365,12 +365,80 @@ short_copy(unsigned short *out, const unsigned short *in, size_t count)
 #endif
 }
 
+/*
+ * The curves are resampled to the size each conversion function needs
+ * when the job is set up; they don't change after that.  The selector
+ * for each conversion function records which of these it needs, and
+ * with how many bits of input.
+ */
+static const unsigned short *
+prepare_curve(stp_cached_curve_t *cache, size_t count)
+{
+  stp_curve_resample(stp_curve_cache_get_curve(cache), count);
+  return stp_curve_cache_get_ushort_data(cache);
+}
+
+static void
+prepare_rgb_curves(lut_t *lut, size_t count)
+{
+  prepared_conversion_t *p = &(lut->prepared);
+  p->red = prepare_curve(&(lut->channel_curves[CHANNEL_C]), count);
+  p->green = prepare_curve(&(lut->channel_curves[CHANNEL_M]), count);
+  p->blue = prepare_curve(&(lut->channel_curves[CHANNEL_Y]), count);
+}
+
+static void
+prepare_color_curves(lut_t *lut, int bits)
+{
+  prepared_conversion_t *p = &(lut->prepared);
+  prepare_rgb_curves(lut, 1 << bits);
+  p->brightness = prepare_curve(&(lut->brightness_correction), 65536);
+  p->contrast = prepare_curve(&(lut->contrast_correction), 1 << bits);
+  (void) stp_curve_cache_get_double_data(&(lut->hue_map));
+  (void) stp_curve_cache_get_double_data(&(lut->lum_map));
+  (void) stp_curve_cache_get_double_data(&(lut->sat_map));
+}
+
+static void
+prepare_fast_color_curves(lut_t *lut, int bits)
+{
+  prepared_conversion_t *p = &(lut->prepared);
+  prepare_rgb_curves(lut, 65536);
+  p->brightness = prepare_curve(&(lut->brightness_correction), 65536);
+  p->contrast = prepare_curve(&(lut->contrast_correction), 1 << bits);
+}
+
+static void
+prepare_gray_color_curves(lut_t *lut, int bits)
+{
+  prepared_conversion_t *p = &(lut->prepared);
+  prepare_rgb_curves(lut, 65536);
+  p->user = prepare_curve(&(lut->user_color_correction), 1 << bits);
+}
+
+static void
+prepare_gray_curves(lut_t *lut, int bits)
+{
+  prepared_conversion_t *p = &(lut->prepared);
+  p->composite = prepare_curve(&(lut->channel_curves[CHANNEL_K]), 65536);
+  p->user = prepare_curve(&(lut->user_color_correction), 1 << bits);
+}
+
+static void
+prepare_channel_curves(lut_t *lut, int bits)
+{
+  prepared_conversion_t *p = &(lut->prepared);
+  int i;
+  for (i = 0; i < lut->out_channels; i++)
+    p->maps[i] = prepare_curve(&(lut->channel_curves[i]), 65536);
+  p->user = prepare_curve(&(lut->user_color_correction), 1 << bits);
+}
+
 static unsigned
-raw_cmy_to_kcmy(const stp_vars_t *vars, const unsigned short *in,
+raw_cmy_to_kcmy(lut_t *lut, const unsigned short *in,
 		unsigned short *out)
 {
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));
-  int width = lut->image_width;
+  int width = lut->convert_width;
 
   int i;
   int j;
@@ -414,37 +482,200 @@ raw_cmy_to_kcmy(const stp_vars_t *vars, const unsigned short *in,
   return retval;
 }
 
-#define GENERIC_COLOR_FUNC(fromname, toname)				\
-static unsigned								\
-fromname##_to_##toname(const stp_vars_t *vars, const unsigned char *in,	\
-		       unsigned short *out)				\
+#define GENERIC_COLOR_FUNC_WITH_CURVES(fromname, toname, prepare_func, bits) \
+static stp_convert_t							\
+fromname##_to_##toname(lut_t *lut)					\
 {									\
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	\
-  if (!lut->printed_colorfunc)						\
-    {									\
-      lut->printed_colorfunc = 1;					\
-      stp_dprintf(STP_DBG_COLORFUNC, vars,				\
-		   "Colorfunc is %s_%d_to_%s, %s, %s, %d, %d\n",	\
-		   #fromname, lut->channel_depth, #toname,		\
-		   lut->input_color_description->name,			\
-		   lut->output_color_description->name,			\
-		   lut->steps, lut->invert_output);			\
-    }									\
+  lut->prepared.from_name = #fromname;					\
+  lut->prepared.to_name = #toname;					\
+  lut->prepared.prepare = prepare_func;					\
+  lut->prepared.prepare_bits = bits;					\
   if (lut->channel_depth == 8)						\
-    return fromname##_8_to_##toname(vars, in, out);			\
+    return fromname##_8_to_##toname;					\
   else									\
-    return fromname##_16_to_##toname(vars, in, out);			\
+    return fromname##_16_to_##toname;					\
+}
+
+#define GENERIC_COLOR_FUNC(fromname, toname)				\
+  GENERIC_COLOR_FUNC_WITH_CURVES(fromname, toname, NULL, 0)
+
+/*
+ * Precomputed RGB table.  Rather than performing the full contrast,
+ * brightness, saturation and HSL correction on every pixel, we can
+ * evaluate it on a regular grid of points once and interpolate between
+ * them (tetrahedrally, so that neutral colors stay neutral).  The output
+ * channel curves are folded into the table too.
+ */
+
+static inline unsigned
+rgb_grid_value(int point, int grid, unsigned maxval)
+{
+  return (point * maxval + (grid - 1) / 2) / (grid - 1);
+}
+
+static void
+build_rgb_table(lut_t *lut, int bits)
+{
+  const prepared_conversion_t *p = &(lut->prepared);
+  int grid = lut->rgb_grid_size;
+  unsigned maxval = (1 << bits) - 1;
+  unsigned scale = 65535u / maxval;
+  double ssat = p->hsl_saturation;
+  double isat = p->hsl_isat;
+  unsigned short *entry;
+  int r, g, b;
+
+  if (!lut->rgb_table)
+    lut->rgb_table =
+      stp_malloc(sizeof(unsigned short) * 3 * grid * grid * grid);
+  entry = lut->rgb_table;
+  for (r = 0; r < grid; r++)
+    for (g = 0; g < grid; g++)
+      for (b = 0; b < grid; b++)
+	{
+	  entry[0] = rgb_grid_value(r, grid, maxval) * scale;
+	  entry[1] = rgb_grid_value(g, grid, maxval) * scale;
+	  entry[2] = rgb_grid_value(b, grid, maxval) * scale;
+	  lookup_rgb(lut, entry, p->contrast, p->contrast, p->contrast,
+		     1 << bits);
+	  if (p->compute_saturation)
+	    update_saturation_from_rgb(entry, p->brightness, ssat, isat,
+				       p->do_user_adjustment);
+	  adjust_hsl(entry, lut, ssat, isat, p->split_saturation,
+		     p->hue_only_color_adjustment, p->bright_color_adjustment);
+	  lookup_rgb(lut, entry, p->red, p->green, p->blue, 1 << bits);
+	  entry += 3;
+	}
+}
+
+static inline void
+locate_rgb_grid_point(unsigned val, unsigned maxval, int grid,
+		      int *point, int *frac)
+{
+  unsigned pos = val * (grid - 1);
+  unsigned base = pos / maxval;
+  if (base >= grid - 1)
+    {
+      *point = grid - 2;
+      *frac = 32768;
+    }
+  else
+    {
+      *point = base;
+      *frac = ((pos - base * maxval) << 15) / maxval;
+    }
+}
+
+static inline void
+interpolate_rgb_table(const unsigned short *table, int grid, unsigned maxval,
+		      unsigned r, unsigned g, unsigned b, unsigned short *out)
+{
+  int dr = grid * grid * 3;
+  int dg = grid * 3;
+  int db = 3;
+  int ir, ig, ib;
+  int fr, fg, fb;
+  int o1, o2, f1, f2, f3;
+  int i;
+  const unsigned short *base;
+  locate_rgb_grid_point(r, maxval, grid, &ir, &fr);
+  locate_rgb_grid_point(g, maxval, grid, &ig, &fg);
+  locate_rgb_grid_point(b, maxval, grid, &ib, &fb);
+  base = table + ir * dr + ig * dg + ib * db;
+
+  /*
+   * Pick the tetrahedron containing the point; its vertices are the
+   * base corner, one or two steps along the axes in decreasing order of
+   * fractional position, and the opposite corner.
+   */
+  if (fr >= fg)
+    {
+      if (fg >= fb)
+	{ o1 = dr;  o2 = dr + dg; f1 = fr; f2 = fg; f3 = fb; }
+      else if (fr >= fb)
+	{ o1 = dr;  o2 = dr + db; f1 = fr; f2 = fb; f3 = fg; }
+      else
+	{ o1 = db;  o2 = dr + db; f1 = fb; f2 = fr; f3 = fg; }
+    }
+  else
+    {
+      if (fb >= fg)
+	{ o1 = db;  o2 = dg + db; f1 = fb; f2 = fg; f3 = fr; }
+      else if (fr >= fb)
+	{ o1 = dg;  o2 = dr + dg; f1 = fg; f2 = fr; f3 = fb; }
+      else
+	{ o1 = dg;  o2 = dg + db; f1 = fg; f2 = fb; f3 = fr; }
+    }
+  for (i = 0; i < 3; i++)
+    {
+      int v0 = base[i];
+      int v1 = base[o1 + i];
+      int v2 = base[o2 + i];
+      int v3 = base[dr + dg + db + i];
+      out[i] = ((v0 << 15) + f1 * (v1 - v0) + f2 * (v2 - v1) +
+		f3 * (v3 - v2) + 16384) >> 15;
+    }
+}
+
+#define COLOR_TO_COLOR_TABLE_FUNC(T, bits)				     \
+static unsigned								     \
+color_##bits##_to_color_table(lut_t *lut,				     \
+			      const unsigned char *in,			     \
+			      unsigned short *out)			     \
+{									     \
+  int i;								     \
+  int i0 = -1;								     \
+  int i1 = -1;								     \
+  int i2 = -1;								     \
+  unsigned short o0 = 0;						     \
+  unsigned short o1 = 0;						     \
+  unsigned short o2 = 0;						     \
+  unsigned short nz0 = 0;						     \
+  unsigned short nz1 = 0;						     \
+  unsigned short nz2 = 0;						     \
+  const T *s_in = (const T *) in;					     \
+  int grid = lut->rgb_grid_size;					     \
+  const unsigned short *table = lut->rgb_table;			     \
+  for (i = 0; i < lut->convert_width; i++)				     \
+    {									     \
+      if (i0 == s_in[0] && i1 == s_in[1] && i2 == s_in[2])		     \
+	{								     \
+	  out[0] = o0;							     \
+	  out[1] = o1;							     \
+	  out[2] = o2;							     \
+	}								     \
+      else								     \
+	{								     \
+	  i0 = s_in[0];							     \
+	  i1 = s_in[1];							     \
+	  i2 = s_in[2];							     \
+	  interpolate_rgb_table(table, grid, (1u << bits) - 1,		     \
+				i0, i1, i2, out);			     \
+	  o0 = out[0];							     \
+	  o1 = out[1];							     \
+	  o2 = out[2];							     \
+	  nz0 |= o0;							     \
+	  nz1 |= o1;							     \
+	  nz2 |= o2;							     \
+	}								     \
+      s_in += 3;							     \
+      out += 3;								     \
+    }									     \
+  return (nz0 ? 0 : 1) +  (nz1 ? 0 : 2) +  (nz2 ? 0 : 4);		     \
 }
 
+COLOR_TO_COLOR_TABLE_FUNC(unsigned char, 8)
+COLOR_TO_COLOR_TABLE_FUNC(unsigned short, 16)
+
 #define COLOR_TO_COLOR_FUNC(T, bits)					     \
 static unsigned								     \
-color_##bits##_to_color(const stp_vars_t *vars, const unsigned char *in,     \
+color_##bits##_to_color(lut_t *lut, const unsigned char *in,		     \
 			unsigned short *out)				     \
 {									     \
+  const prepared_conversion_t *p = &(lut->prepared);			     \
   int i;								     \
-  double isat = 1.0;							     \
-  double ssat = stp_get_float_parameter(vars, "Saturation");		     \
-  double sbright = stp_get_float_parameter(vars, "Brightness");		     \
+  double ssat = p->hsl_saturation;					     \
+  double isat = p->hsl_isat;						     \
   int i0 = -1;								     \
   int i1 = -1;								     \
   int i2 = -1;								     \
@@ -460,46 +691,20 @@ color_##bits##_to_color(const stp_vars_t *vars, const unsigned char *in,     \
   const unsigned short *brightness;					     \
   const unsigned short *contrast;					     \
   const T *s_in = (const T *) in;					     \
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	     \
-  int compute_saturation = ssat <= .99999 || ssat >= 1.00001;		     \
-  int split_saturation = ssat > 1.4;					     \
-  int bright_color_adjustment = 0;					     \
-  int hue_only_color_adjustment = 0;					     \
-  int do_user_adjustment = 0;						     \
-  if (lut->color_correction->correction == COLOR_CORRECTION_BRIGHT)	     \
-    bright_color_adjustment = 1;					     \
-  if (lut->color_correction->correction == COLOR_CORRECTION_HUE)	     \
-    hue_only_color_adjustment = 1;					     \
-  if (sbright != 1)							     \
-    do_user_adjustment = 1;						     \
-  compute_saturation |= do_user_adjustment;				     \
+  int compute_saturation = p->compute_saturation;			     \
+  int split_saturation = p->split_saturation;				     \
+  int bright_color_adjustment = p->bright_color_adjustment;		     \
+  int hue_only_color_adjustment = p->hue_only_color_adjustment;		     \
+  int do_user_adjustment = p->do_user_adjustment;			     \
+  if (lut->rgb_grid_size)						     \
+    return color_##bits##_to_color_table(lut, in, out);			     \
 									     \
-  for (i = CHANNEL_C; i <= CHANNEL_Y; i++)				     \
-    stp_curve_resample(stp_curve_cache_get_curve(&(lut->channel_curves[i])), \
-		       1 << bits);					     \
-  stp_curve_resample							     \
-    (stp_curve_cache_get_curve(&(lut->brightness_correction)), 65536);	     \
-  stp_curve_resample							     \
-    (stp_curve_cache_get_curve(&(lut->contrast_correction)), 1 << bits);     \
-  red =									     \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_C]));	     \
-  green =								     \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_M]));	     \
-  blue =								     \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_Y]));	     \
-  brightness=								     \
-    stp_curve_cache_get_ushort_data(&(lut->brightness_correction));	     \
-  contrast =								     \
-    stp_curve_cache_get_ushort_data(&(lut->contrast_correction));	     \
-  (void) stp_curve_cache_get_double_data(&(lut->hue_map));		     \
-  (void) stp_curve_cache_get_double_data(&(lut->lum_map));		     \
-  (void) stp_curve_cache_get_double_data(&(lut->sat_map));		     \
-									     \
-  if (split_saturation)							     \
-    ssat = sqrt(ssat);							     \
-  if (ssat > 1)								     \
-    isat = 1.0 / ssat;							     \
-  for (i = 0; i < lut->image_width; i++)				     \
+  red = p->red;								     \
+  green = p->green;							     \
+  blue = p->blue;							     \
+  brightness = p->brightness;						     \
+  contrast = p->contrast;						     \
+  for (i = 0; i < lut->convert_width; i++)				     \
     {									     \
       if (i0 == s_in[0] && i1 == s_in[1] && i2 == s_in[2])		     \
 	{								     \
@@ -537,7 +742,8 @@ color_##bits##_to_color(const stp_vars_t *vars, const unsigned char *in,     \
 
 COLOR_TO_COLOR_FUNC(unsigned char, 8)
 COLOR_TO_COLOR_FUNC(unsigned short, 16)
-GENERIC_COLOR_FUNC(color, color)
+GENERIC_COLOR_FUNC_WITH_CURVES(color, color, prepare_color_curves,
+			       lut->channel_depth)
 
 /*
  * 'rgb_to_rgb()' - Convert rgb image data to RGB.
@@ -545,9 +751,10 @@ GENERIC_COLOR_FUNC(color, color)
 
 #define FAST_COLOR_TO_COLOR_FUNC(T, bits)				      \
 static unsigned								      \
-color_##bits##_to_color_fast(const stp_vars_t *vars, const unsigned char *in, \
+color_##bits##_to_color_fast(lut_t *lut, const unsigned char *in,	      \
 			     unsigned short *out)			      \
 {									      \
+  prepared_conversion_t *p = &(lut->prepared);				      \
   int i;								      \
   int i0 = -1;								      \
   int i1 = -1;								      \
@@ -559,41 +766,21 @@ color_##bits##_to_color_fast(const stp_vars_t *vars, const unsigned char *in, \
   int nz1 = 0;								      \
   int nz2 = 0;								      \
   const T *s_in = (const T *) in;					      \
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	      \
   const unsigned short *red;						      \
   const unsigned short *green;						      \
   const unsigned short *blue;						      \
   const unsigned short *brightness;					      \
   const unsigned short *contrast;					      \
-  double isat = 1.0;							      \
-  double saturation = stp_get_float_parameter(vars, "Saturation");	      \
-  double sbright = stp_get_float_parameter(vars, "Brightness");		      \
-  int compute_saturation = saturation <= .99999 || saturation >= 1.00001;     \
-  int do_user_adjustment = 0;						      \
-  if (sbright != 1)							      \
-    do_user_adjustment = 1;						      \
-  compute_saturation |= do_user_adjustment;				      \
-									      \
-  for (i = CHANNEL_C; i <= CHANNEL_Y; i++)				      \
-    stp_curve_resample(lut->channel_curves[i].curve, 65536);		      \
-  stp_curve_resample							      \
-    (stp_curve_cache_get_curve(&(lut->brightness_correction)), 65536);	      \
-  stp_curve_resample							      \
-    (stp_curve_cache_get_curve(&(lut->contrast_correction)), 1 << bits);      \
-  red =									      \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_C]));	      \
-  green =								      \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_M]));	      \
-  blue =								      \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_Y]));	      \
-  brightness=								      \
-    stp_curve_cache_get_ushort_data(&(lut->brightness_correction));	      \
-  contrast =								      \
-    stp_curve_cache_get_ushort_data(&(lut->contrast_correction));	      \
+  double isat = p->isat;						      \
+  double saturation = p->saturation;					      \
+  int compute_saturation = p->compute_saturation;			      \
 									      \
-  if (saturation > 1)							      \
-    isat = 1.0 / saturation;						      \
-  for (i = 0; i < lut->image_width; i++)				      \
+  red = p->red;								      \
+  green = p->green;							      \
+  blue = p->blue;							      \
+  brightness = p->brightness;						      \
+  contrast = p->contrast;						      \
+  for (i = 0; i < lut->convert_width; i++)				      \
     {									      \
       if (i0 == s_in[0] && i1 == s_in[1] && i2 == s_in[2])		      \
 	{								      \
@@ -629,23 +816,23 @@ color_##bits##_to_color_fast(const stp_vars_t *vars, const unsigned char *in, \
 
 FAST_COLOR_TO_COLOR_FUNC(unsigned char, 8)
 FAST_COLOR_TO_COLOR_FUNC(unsigned short, 16)
-GENERIC_COLOR_FUNC(color, color_fast)
+GENERIC_COLOR_FUNC_WITH_CURVES(color, color_fast, prepare_fast_color_curves,
+			       lut->channel_depth)
 
 #define RAW_COLOR_TO_COLOR_FUNC(T, bits)				    \
 static unsigned								    \
-color_##bits##_to_color_raw(const stp_vars_t *vars, const unsigned char *in,\
+color_##bits##_to_color_raw(lut_t *lut, const unsigned char *in,	    \
 			    unsigned short *out)			    \
 {									    \
   int i;								    \
   int j;								    \
   int nz = 0;								    \
   const T *s_in = (const T *) in;					    \
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
   unsigned mask = 0;							    \
   if (lut->invert_output)						    \
     mask = 0xffff;							    \
 									    \
-  for (i = 0; i < lut->image_width; i++)				    \
+  for (i = 0; i < lut->convert_width; i++)				    \
     {									    \
       unsigned bit = 1;							    \
       for (j = 0; j < 3; j++, bit += bit)				    \
@@ -670,9 +857,10 @@ GENERIC_COLOR_FUNC(color, color_raw)
 
 #define GRAY_TO_COLOR_FUNC(T, bits)					    \
 static unsigned								    \
-gray_##bits##_to_color(const stp_vars_t *vars, const unsigned char *in,	    \
+gray_##bits##_to_color(lut_t *lut, const unsigned char *in,		    \
 		   unsigned short *out)					    \
 {									    \
+  prepared_conversion_t *p = &(lut->prepared);				    \
   int i;								    \
   int i0 = -1;								    \
   int o0 = 0;								    \
@@ -682,26 +870,16 @@ gray_##bits##_to_color(const stp_vars_t *vars, const unsigned char *in,	    \
   int nz1 = 0;								    \
   int nz2 = 0;								    \
   const T *s_in = (const T *) in;					    \
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
   const unsigned short *red;						    \
   const unsigned short *green;						    \
   const unsigned short *blue;						    \
   const unsigned short *user;						    \
 									    \
-  for (i = CHANNEL_C; i <= CHANNEL_Y; i++)				    \
-    stp_curve_resample(lut->channel_curves[i].curve, 65536);		    \
-  stp_curve_resample							    \
-    (stp_curve_cache_get_curve(&(lut->user_color_correction)), 1 << bits);  \
-  red =									    \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_C]));	    \
-  green =								    \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_M]));	    \
-  blue =								    \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_Y]));	    \
-  user =								    \
-    stp_curve_cache_get_ushort_data(&(lut->user_color_correction));	    \
-									    \
-  for (i = 0; i < lut->image_width; i++)				    \
+  red = p->red;								    \
+  green = p->green;							    \
+  blue = p->blue;							    \
+  user = p->user;							    \
+  for (i = 0; i < lut->convert_width; i++)				    \
     {									    \
       if (i0 == s_in[0])						    \
 	{								    \
@@ -730,22 +908,22 @@ gray_##bits##_to_color(const stp_vars_t *vars, const unsigned char *in,	    \
 
 GRAY_TO_COLOR_FUNC(unsigned char, 8)
 GRAY_TO_COLOR_FUNC(unsigned short, 16)
-GENERIC_COLOR_FUNC(gray, color)
+GENERIC_COLOR_FUNC_WITH_CURVES(gray, color, prepare_gray_color_curves,
+			       lut->channel_depth)
 
 #define GRAY_TO_COLOR_RAW_FUNC(T, bits)					   \
 static unsigned								   \
-gray_##bits##_to_color_raw(const stp_vars_t *vars, const unsigned char *in,\
+gray_##bits##_to_color_raw(lut_t *lut, const unsigned char *in,		   \
 			   unsigned short *out)				   \
 {									   \
   int i;								   \
   int nz = 7;								   \
   const T *s_in = (const T *) in;					   \
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	   \
   unsigned mask = 0;							   \
   if (lut->invert_output)						   \
     mask = 0xffff;							   \
 									   \
-  for (i = 0; i < lut->image_width; i++)				   \
+  for (i = 0; i < lut->convert_width; i++)				   \
     {									   \
       unsigned outval = (s_in[0] * (65535 / (1 << bits))) ^ mask;	   \
       out[0] = outval;							   \
@@ -765,24 +943,25 @@ GENERIC_COLOR_FUNC(gray, color_raw)
 
 #define COLOR_TO_KCMY_FUNC(name, name2, name3, name4, bits)		    \
 static unsigned								    \
-name##_##bits##_to_##name2(const stp_vars_t *vars, const unsigned char *in, \
+name##_##bits##_to_##name2(lut_t *lut, const unsigned char *in,		    \
 			   unsigned short *out)				    \
 {									    \
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
   size_t real_steps = lut->steps;					    \
   unsigned status;							    \
   if (!lut->cmy_tmp)							    \
-    lut->cmy_tmp = stp_malloc(4 * 2 * lut->image_width);		    \
-  name##_##bits##_to_##name3(vars, in, lut->cmy_tmp);			    \
+    lut->cmy_tmp = stp_malloc(4 * 2 * lut->image_width *		    \
+			      lut->band_rows);				    \
+  name##_##bits##_to_##name3(lut, in, lut->cmy_tmp);			    \
   lut->steps = 65536;							    \
-  status = name4##_cmy_to_kcmy(vars, lut->cmy_tmp, out);		    \
+  status = name4##_cmy_to_kcmy(lut, lut->cmy_tmp, out);			    \
   lut->steps = real_steps;						    \
   return status;							    \
 }
 
 COLOR_TO_KCMY_FUNC(gray, kcmy, color, raw, 8)
 COLOR_TO_KCMY_FUNC(gray, kcmy, color, raw, 16)
-GENERIC_COLOR_FUNC(gray, kcmy)
+GENERIC_COLOR_FUNC_WITH_CURVES(gray, kcmy, prepare_gray_color_curves,
+			       lut->channel_depth)
 
 COLOR_TO_KCMY_FUNC(gray, kcmy_raw, color_raw, raw, 8)
 COLOR_TO_KCMY_FUNC(gray, kcmy_raw, color_raw, raw, 16)
@@ -790,11 +969,13 @@ GENERIC_COLOR_FUNC(gray, kcmy_raw)
 
 COLOR_TO_KCMY_FUNC(color, kcmy, color, raw, 8)
 COLOR_TO_KCMY_FUNC(color, kcmy, color, raw, 16)
-GENERIC_COLOR_FUNC(color, kcmy)
+GENERIC_COLOR_FUNC_WITH_CURVES(color, kcmy, prepare_color_curves,
+			       lut->channel_depth)
 
 COLOR_TO_KCMY_FUNC(color, kcmy_fast, color_fast, raw, 8)
 COLOR_TO_KCMY_FUNC(color, kcmy_fast, color_fast, raw, 16)
-GENERIC_COLOR_FUNC(color, kcmy_fast)
+GENERIC_COLOR_FUNC_WITH_CURVES(color, kcmy_fast, prepare_fast_color_curves,
+			       lut->channel_depth)
 
 COLOR_TO_KCMY_FUNC(color, kcmy_raw, color_raw, raw, 8)
 COLOR_TO_KCMY_FUNC(color, kcmy_raw, color_raw, raw, 16)
@@ -803,7 +984,7 @@ GENERIC_COLOR_FUNC(color, kcmy_raw)
 
 #define COLOR_TO_KCMY_THRESHOLD_FUNC(T, name)				\
 static unsigned								\
-name##_to_kcmy_threshold(const stp_vars_t *vars,			\
+name##_to_kcmy_threshold(lut_t *lut,					\
 			const unsigned char *in,			\
 			unsigned short *out)				\
 {									\
@@ -811,8 +992,7 @@ name##_to_kcmy_threshold(const stp_vars_t *vars,			\
   int z = 15;								\
   const T *s_in = (const T *) in;					\
   unsigned high_bit = ((1 << ((sizeof(T) * 8) - 1)));			\
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	\
-  int width = lut->image_width;						\
+  int width = lut->convert_width;					\
   unsigned mask = 0;							\
   memset(out, 0, width * 4 * sizeof(unsigned short));			\
   if (lut->invert_output)						\
@@ -860,7 +1040,7 @@ GENERIC_COLOR_FUNC(color, kcmy_threshold)
 
 #define CMYK_TO_KCMY_THRESHOLD_FUNC(T, name)				\
 static unsigned								\
-name##_to_kcmy_threshold(const stp_vars_t *vars,			\
+name##_to_kcmy_threshold(lut_t *lut,					\
 			const unsigned char *in,			\
 			unsigned short *out)				\
 {									\
@@ -869,8 +1049,7 @@ name##_to_kcmy_threshold(const stp_vars_t *vars,			\
   const T *s_in = (const T *) in;					\
   unsigned desired_high_bit = 0;					\
   unsigned high_bit = 1 << ((sizeof(T) * 8) - 1);			\
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	\
-  int width = lut->image_width;						\
+  int width = lut->convert_width;					\
   memset(out, 0, width * 4 * sizeof(unsigned short));			\
   if (!lut->invert_output)						\
     desired_high_bit = high_bit;					\
@@ -907,7 +1086,7 @@ GENERIC_COLOR_FUNC(cmyk, kcmy_threshold)
 
 #define KCMY_TO_KCMY_THRESHOLD_FUNC(T, name)				\
 static unsigned								\
-name##_to_kcmy_threshold(const stp_vars_t *vars,			\
+name##_to_kcmy_threshold(lut_t *lut,					\
 			 const unsigned char *in,			\
 			 unsigned short *out)				\
 {									\
@@ -918,8 +1097,7 @@ name##_to_kcmy_threshold(const stp_vars_t *vars,			\
   const T *s_in = (const T *) in;					\
   unsigned desired_high_bit = 0;					\
   unsigned high_bit = 1 << ((sizeof(T) * 8) - 1);			\
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	\
-  int width = lut->image_width;						\
+  int width = lut->convert_width;					\
   memset(out, 0, width * 4 * sizeof(unsigned short));			\
   if (!lut->invert_output)						\
     desired_high_bit = high_bit;					\
@@ -947,7 +1125,7 @@ GENERIC_COLOR_FUNC(kcmy, kcmy_threshold)
 
 #define GRAY_TO_COLOR_THRESHOLD_FUNC(T, name, bits, channels)		\
 static unsigned								\
-gray_##bits##_to_##name##_threshold(const stp_vars_t *vars,		\
+gray_##bits##_to_##name##_threshold(lut_t *lut,				\
 				    const unsigned char *in,		\
 				    unsigned short *out)		\
 {									\
@@ -956,8 +1134,7 @@ gray_##bits##_to_##name##_threshold(const stp_vars_t *vars,		\
   int desired_high_bit = 0;						\
   unsigned high_bit = 1 << ((sizeof(T) * 8) - 1);			\
   const T *s_in = (const T *) in;					\
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	\
-  int width = lut->image_width;						\
+  int width = lut->convert_width;					\
   memset(out, 0, width * channels * sizeof(unsigned short));		\
   if (!lut->invert_output)						\
     desired_high_bit = high_bit;					\
@@ -986,7 +1163,7 @@ GENERIC_COLOR_FUNC(gray, kcmy_threshold)
 
 #define COLOR_TO_COLOR_THRESHOLD_FUNC(T, name)				\
 static unsigned								\
-name##_to_color_threshold(const stp_vars_t *vars,			\
+name##_to_color_threshold(lut_t *lut,					\
 		       const unsigned char *in,				\
 		       unsigned short *out)				\
 {									\
@@ -995,8 +1172,7 @@ name##_to_color_threshold(const stp_vars_t *vars,			\
   int desired_high_bit = 0;						\
   unsigned high_bit = ((1 << ((sizeof(T) * 8) - 1)) * 4);		\
   const T *s_in = (const T *) in;					\
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	\
-  int width = lut->image_width;						\
+  int width = lut->convert_width;					\
   memset(out, 0, width * 3 * sizeof(unsigned short));			\
   if (!lut->invert_output)						\
     desired_high_bit = high_bit;					\
@@ -1028,7 +1204,7 @@ GENERIC_COLOR_FUNC(color, color_threshold)
 
 #define COLOR_TO_GRAY_THRESHOLD_FUNC(T, name, channels, max_channels)	\
 static unsigned								\
-name##_to_gray_threshold(const stp_vars_t *vars,			\
+name##_to_gray_threshold(lut_t *lut,					\
 			const unsigned char *in,			\
 			unsigned short *out)				\
 {									\
@@ -1037,8 +1213,7 @@ name##_to_gray_threshold(const stp_vars_t *vars,			\
   int desired_high_bit = 0;						\
   unsigned high_bit = ((1 << ((sizeof(T) * 8) - 1)));			\
   const T *s_in = (const T *) in;					\
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	\
-  int width = lut->image_width;						\
+  int width = lut->convert_width;					\
   memset(out, 0, width * sizeof(unsigned short));			\
   if (!lut->invert_output)						\
     desired_high_bit = high_bit;					\
@@ -1078,20 +1253,20 @@ GENERIC_COLOR_FUNC(gray, gray_threshold)
 
 #define CMYK_TO_COLOR_FUNC(namein, name2, T, bits, offset)		      \
 static unsigned								      \
-namein##_##bits##_to_##name2(const stp_vars_t *vars, const unsigned char *in, \
+namein##_##bits##_to_##name2(lut_t *lut, const unsigned char *in,	      \
 			   unsigned short *out)				      \
 {									      \
   int i;								      \
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	      \
   unsigned status;							      \
   size_t real_steps = lut->steps;					      \
   const T *s_in = (const T *) in;					      \
   unsigned short *tmp;							      \
-  int width = lut->image_width;						      \
+  int width = lut->convert_width;					      \
   unsigned mask = 0;							      \
 									      \
   if (!lut->cmy_tmp)							      \
-    lut->cmy_tmp = stp_malloc(3 * 2 * lut->image_width);		      \
+    lut->cmy_tmp = stp_malloc(3 * 2 * lut->image_width *		      \
+			      lut->band_rows);				      \
   tmp = lut->cmy_tmp;							      \
   memset(lut->cmy_tmp, 0, width * 3 * sizeof(unsigned short));		      \
   if (lut->invert_output)						      \
@@ -1117,17 +1292,17 @@ namein##_##bits##_to_##name2(const stp_vars_t *vars, const unsigned char *in, \
     }									      \
   lut->steps = 65536;							      \
   status =								      \
-    color_16_to_##name2(vars, (const unsigned char *) lut->cmy_tmp, out);     \
+    color_16_to_##name2(lut, (const unsigned char *) lut->cmy_tmp, out);      \
   lut->steps = real_steps;						      \
   return status;							      \
 }
 
 CMYK_TO_COLOR_FUNC(cmyk, color, unsigned char, 8, 0)
 CMYK_TO_COLOR_FUNC(cmyk, color, unsigned short, 16, 0)
-GENERIC_COLOR_FUNC(cmyk, color)
+GENERIC_COLOR_FUNC_WITH_CURVES(cmyk, color, prepare_color_curves, 16)
 CMYK_TO_COLOR_FUNC(kcmy, color, unsigned char, 8, 1)
 CMYK_TO_COLOR_FUNC(kcmy, color, unsigned short, 16, 1)
-GENERIC_COLOR_FUNC(kcmy, color)
+GENERIC_COLOR_FUNC_WITH_CURVES(kcmy, color, prepare_color_curves, 16)
 CMYK_TO_COLOR_FUNC(cmyk, color_threshold, unsigned char, 8, 0)
 CMYK_TO_COLOR_FUNC(cmyk, color_threshold, unsigned short, 16, 0)
 GENERIC_COLOR_FUNC(cmyk, color_threshold)
@@ -1136,10 +1311,10 @@ CMYK_TO_COLOR_FUNC(kcmy, color_threshold, unsigned short, 16, 1)
 GENERIC_COLOR_FUNC(kcmy, color_threshold)
 CMYK_TO_COLOR_FUNC(cmyk, color_fast, unsigned char, 8, 0)
 CMYK_TO_COLOR_FUNC(cmyk, color_fast, unsigned short, 16, 0)
-GENERIC_COLOR_FUNC(cmyk, color_fast)
+GENERIC_COLOR_FUNC_WITH_CURVES(cmyk, color_fast, prepare_fast_color_curves, 16)
 CMYK_TO_COLOR_FUNC(kcmy, color_fast, unsigned char, 8, 1)
 CMYK_TO_COLOR_FUNC(kcmy, color_fast, unsigned short, 16, 1)
-GENERIC_COLOR_FUNC(kcmy, color_fast)
+GENERIC_COLOR_FUNC_WITH_CURVES(kcmy, color_fast, prepare_fast_color_curves, 16)
 CMYK_TO_COLOR_FUNC(cmyk, color_raw, unsigned char, 8, 0)
 CMYK_TO_COLOR_FUNC(cmyk, color_raw, unsigned short, 16, 0)
 GENERIC_COLOR_FUNC(cmyk, color_raw)
@@ -1149,7 +1324,7 @@ GENERIC_COLOR_FUNC(kcmy, color_raw)
 
 #define CMYK_TO_KCMY_FUNC(T, size)					    \
 static unsigned								    \
-cmyk_##size##_to_kcmy(const stp_vars_t *vars,				    \
+cmyk_##size##_to_kcmy(lut_t *lut,					    \
 		      const unsigned char *in,				    \
 		      unsigned short *out)				    \
 {									    \
@@ -1158,21 +1333,15 @@ cmyk_##size##_to_kcmy(const stp_vars_t *vars,				    \
   int j;								    \
   int nz[4];								    \
   const T *s_in = (const T *) in;					    \
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
   const unsigned short *user;						    \
-  const unsigned short *maps[4];					    \
+  const unsigned short *const *maps;					    \
 									    \
-  for (i = 0; i < 4; i++)						    \
-    {									    \
-      stp_curve_resample(lut->channel_curves[i].curve, 65536);		    \
-      maps[i] = stp_curve_cache_get_ushort_data(&(lut->channel_curves[i])); \
-    }									    \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << size);	    \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));    \
+  maps = lut->prepared.maps;						    \
+  user = lut->prepared.user;						    \
 									    \
   memset(nz, 0, sizeof(nz));						    \
 									    \
-  for (i = 0; i < lut->image_width; i++, out += 4)			    \
+  for (i = 0; i < lut->convert_width; i++, out += 4)			    \
     {									    \
       for (j = 0; j < 4; j++)						    \
 	{								    \
@@ -1190,11 +1359,12 @@ cmyk_##size##_to_kcmy(const stp_vars_t *vars,				    \
 
 CMYK_TO_KCMY_FUNC(unsigned char, 8)
 CMYK_TO_KCMY_FUNC(unsigned short, 16)
-GENERIC_COLOR_FUNC(cmyk, kcmy)
+GENERIC_COLOR_FUNC_WITH_CURVES(cmyk, kcmy, prepare_channel_curves,
+			       lut->channel_depth)
 
 #define KCMY_TO_KCMY_FUNC(T, size)					    \
 static unsigned								    \
-kcmy_##size##_to_kcmy(const stp_vars_t *vars,				    \
+kcmy_##size##_to_kcmy(lut_t *lut,					    \
 		      const unsigned char *in,				    \
 		      unsigned short *out)				    \
 {									    \
@@ -1203,21 +1373,15 @@ kcmy_##size##_to_kcmy(const stp_vars_t *vars,				    \
   int j;								    \
   int nz[4];								    \
   const T *s_in = (const T *) in;					    \
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
   const unsigned short *user;						    \
-  const unsigned short *maps[4];					    \
+  const unsigned short *const *maps;					    \
 									    \
-  for (i = 0; i < 4; i++)						    \
-    {									    \
-      stp_curve_resample(lut->channel_curves[i].curve, 65536);		    \
-      maps[i] = stp_curve_cache_get_ushort_data(&(lut->channel_curves[i])); \
-    }									    \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << size);	    \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));    \
+  maps = lut->prepared.maps;						    \
+  user = lut->prepared.user;						    \
 									    \
   memset(nz, 0, sizeof(nz));						    \
 									    \
-  for (i = 0; i < lut->image_width; i++, out += 4)			    \
+  for (i = 0; i < lut->convert_width; i++, out += 4)			    \
     {									    \
       for (j = 0; j < 4; j++)						    \
 	{								    \
@@ -1234,12 +1398,13 @@ kcmy_##size##_to_kcmy(const stp_vars_t *vars,				    \
 
 KCMY_TO_KCMY_FUNC(unsigned char, 8)
 KCMY_TO_KCMY_FUNC(unsigned short, 16)
-GENERIC_COLOR_FUNC(kcmy, kcmy)
+GENERIC_COLOR_FUNC_WITH_CURVES(kcmy, kcmy, prepare_channel_curves,
+			       lut->channel_depth)
 
 
 #define GRAY_TO_GRAY_FUNC(T, bits)					   \
 static unsigned								   \
-gray_##bits##_to_gray(const stp_vars_t *vars,				   \
+gray_##bits##_to_gray(lut_t *lut,					   \
 		      const unsigned char *in,				   \
 		      unsigned short *out)				   \
 {									   \
@@ -1248,21 +1413,16 @@ gray_##bits##_to_gray(const stp_vars_t *vars,				   \
   int o0 = 0;								   \
   int nz = 0;								   \
   const T *s_in = (const T *) in;					   \
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	   \
-  int width = lut->image_width;						   \
+  int width = lut->convert_width;					   \
   const unsigned short *composite;					   \
   const unsigned short *user;						   \
 									   \
-  stp_curve_resample							   \
-    (stp_curve_cache_get_curve(&(lut->channel_curves[CHANNEL_K])), 65536); \
-  composite =								   \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_K]));	   \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << bits);	   \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));   \
+  composite = lut->prepared.composite;					   \
+  user = lut->prepared.user;						   \
 									   \
   memset(out, 0, width * sizeof(unsigned short));			   \
 									   \
-  for (i = 0; i < lut->image_width; i++)				   \
+  for (i = 0; i < lut->convert_width; i++)				   \
     {									   \
       if (i0 != s_in[0])						   \
 	{								   \
@@ -1279,11 +1439,12 @@ gray_##bits##_to_gray(const stp_vars_t *vars,				   \
 
 GRAY_TO_GRAY_FUNC(unsigned char, 8)
 GRAY_TO_GRAY_FUNC(unsigned short, 16)
-GENERIC_COLOR_FUNC(gray, gray)
+GENERIC_COLOR_FUNC_WITH_CURVES(gray, gray, prepare_gray_curves,
+			       lut->channel_depth)
 
 #define COLOR_TO_GRAY_FUNC(T, bits)					      \
 static unsigned								      \
-color_##bits##_to_gray(const stp_vars_t *vars,				      \
+color_##bits##_to_gray(lut_t *lut,					      \
 		       const unsigned char *in,				      \
 		       unsigned short *out)				      \
 {									      \
@@ -1294,19 +1455,14 @@ color_##bits##_to_gray(const stp_vars_t *vars,				      \
   int o0 = 0;								      \
   int nz = 0;								      \
   const T *s_in = (const T *) in;					      \
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	      \
   int l_red = LUM_RED;							      \
   int l_green = LUM_GREEN;						      \
   int l_blue = LUM_BLUE;						      \
   const unsigned short *composite;					      \
   const unsigned short *user;						      \
 									      \
-  stp_curve_resample							      \
-    (stp_curve_cache_get_curve(&(lut->channel_curves[CHANNEL_K])), 65536);    \
-  composite =								      \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_K]));	      \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << bits);	      \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));      \
+  composite = lut->prepared.composite;					      \
+  user = lut->prepared.user;						      \
 									      \
   if (lut->input_color_description->color_model == COLOR_BLACK)		      \
     {									      \
@@ -1315,7 +1471,7 @@ color_##bits##_to_gray(const stp_vars_t *vars,				      \
       l_blue = (100 - l_blue) / 2;					      \
     }									      \
 									      \
-  for (i = 0; i < lut->image_width; i++)				      \
+  for (i = 0; i < lut->convert_width; i++)				      \
     {									      \
       if (i0 != s_in[0] || i1 != s_in[1] || i2 != s_in[2])		      \
 	{								      \
@@ -1335,12 +1491,13 @@ color_##bits##_to_gray(const stp_vars_t *vars,				      \
 
 COLOR_TO_GRAY_FUNC(unsigned char, 8)
 COLOR_TO_GRAY_FUNC(unsigned short, 16)
-GENERIC_COLOR_FUNC(color, gray)
+GENERIC_COLOR_FUNC_WITH_CURVES(color, gray, prepare_gray_curves,
+			       lut->channel_depth)
 
 
 #define CMYK_TO_GRAY_FUNC(T, bits)					    \
 static unsigned								    \
-cmyk_##bits##_to_gray(const stp_vars_t *vars,				    \
+cmyk_##bits##_to_gray(lut_t *lut,					    \
 		      const unsigned char *in,				    \
 		      unsigned short *out)				    \
 {									    \
@@ -1352,7 +1509,6 @@ cmyk_##bits##_to_gray(const stp_vars_t *vars,				    \
   int o0 = 0;								    \
   int nz = 0;								    \
   const T *s_in = (const T *) in;					    \
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
   int l_red = LUM_RED;							    \
   int l_green = LUM_GREEN;						    \
   int l_blue = LUM_BLUE;						    \
@@ -1360,12 +1516,8 @@ cmyk_##bits##_to_gray(const stp_vars_t *vars,				    \
   const unsigned short *composite;					    \
   const unsigned short *user;						    \
 									    \
-  stp_curve_resample							    \
-    (stp_curve_cache_get_curve(&(lut->channel_curves[CHANNEL_K])), 65536);  \
-  composite =								    \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_K]));	    \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << bits);	    \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));    \
+  composite = lut->prepared.composite;					    \
+  user = lut->prepared.user;						    \
 									    \
   if (lut->input_color_description->color_model == COLOR_BLACK)		    \
     {									    \
@@ -1375,7 +1527,7 @@ cmyk_##bits##_to_gray(const stp_vars_t *vars,				    \
       l_white = (100 - l_white) / 3;					    \
     }									    \
 									    \
-  for (i = 0; i < lut->image_width; i++)				    \
+  for (i = 0; i < lut->convert_width; i++)				    \
     {									    \
       if (i0 != s_in[0] || i1 != s_in[1] || i2 != s_in[2] || i3 != s_in[3]) \
 	{								    \
@@ -1396,11 +1548,12 @@ cmyk_##bits##_to_gray(const stp_vars_t *vars,				    \
 
 CMYK_TO_GRAY_FUNC(unsigned char, 8)
 CMYK_TO_GRAY_FUNC(unsigned short, 16)
-GENERIC_COLOR_FUNC(cmyk, gray)
+GENERIC_COLOR_FUNC_WITH_CURVES(cmyk, gray, prepare_gray_curves,
+			       lut->channel_depth)
 
 #define KCMY_TO_GRAY_FUNC(T, bits)					    \
 static unsigned								    \
-kcmy_##bits##_to_gray(const stp_vars_t *vars,				    \
+kcmy_##bits##_to_gray(lut_t *lut,					    \
 		      const unsigned char *in,				    \
 		      unsigned short *out)				    \
 {									    \
@@ -1412,7 +1565,6 @@ kcmy_##bits##_to_gray(const stp_vars_t *vars,				    \
   int o0 = 0;								    \
   int nz = 0;								    \
   const T *s_in = (const T *) in;					    \
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
   int l_red = LUM_RED;							    \
   int l_green = LUM_GREEN;						    \
   int l_blue = LUM_BLUE;						    \
@@ -1420,12 +1572,8 @@ kcmy_##bits##_to_gray(const stp_vars_t *vars,				    \
   const unsigned short *composite;					    \
   const unsigned short *user;						    \
 									    \
-  stp_curve_resample							    \
-    (stp_curve_cache_get_curve(&(lut->channel_curves[CHANNEL_K])), 65536);  \
-  composite =								    \
-    stp_curve_cache_get_ushort_data(&(lut->channel_curves[CHANNEL_K]));	    \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << bits);	    \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));    \
+  composite = lut->prepared.composite;					    \
+  user = lut->prepared.user;						    \
 									    \
   if (lut->input_color_description->color_model == COLOR_BLACK)		    \
     {									    \
@@ -1435,7 +1583,7 @@ kcmy_##bits##_to_gray(const stp_vars_t *vars,				    \
       l_white = (100 - l_white) / 3;					    \
     }									    \
 									    \
-  for (i = 0; i < lut->image_width; i++)				    \
+  for (i = 0; i < lut->convert_width; i++)				    \
     {									    \
       if (i0 != s_in[0] || i1 != s_in[1] || i2 != s_in[2] || i3 != s_in[3]) \
 	{								    \
@@ -1456,26 +1604,26 @@ kcmy_##bits##_to_gray(const stp_vars_t *vars,				    \
 
 KCMY_TO_GRAY_FUNC(unsigned char, 8)
 KCMY_TO_GRAY_FUNC(unsigned short, 16)
-GENERIC_COLOR_FUNC(kcmy, gray)
+GENERIC_COLOR_FUNC_WITH_CURVES(kcmy, gray, prepare_gray_curves,
+			       lut->channel_depth)
 
 #define GRAY_TO_GRAY_RAW_FUNC(T, bits)					\
 static unsigned								\
-gray_##bits##_to_gray_raw(const stp_vars_t *vars,			\
+gray_##bits##_to_gray_raw(lut_t *lut,					\
 			  const unsigned char *in,			\
 			  unsigned short *out)				\
 {									\
   int i;								\
   int nz = 0;								\
   const T *s_in = (const T *) in;					\
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	\
-  int width = lut->image_width;						\
+  int width = lut->convert_width;					\
   unsigned mask = 0;							\
   if (lut->invert_output)						\
     mask = 0xffff;							\
 									\
   memset(out, 0, width * sizeof(unsigned short));			\
 									\
-  for (i = 0; i < lut->image_width; i++)				\
+  for (i = 0; i < lut->convert_width; i++)				\
     {									\
       out[0] = (s_in[0] * (65535 / ((1 << bits) - 1))) ^ mask;		\
       nz |= out[0];							\
@@ -1491,7 +1639,7 @@ GENERIC_COLOR_FUNC(gray, gray_raw)
 
 #define COLOR_TO_GRAY_RAW_FUNC(T, bits, invertable, name2)		\
 static unsigned								\
-color_##bits##_to_gray_##name2(const stp_vars_t *vars,			\
+color_##bits##_to_gray_##name2(lut_t *lut,				\
 			       const unsigned char *in,			\
 			       unsigned short *out)			\
 {									\
@@ -1502,7 +1650,6 @@ color_##bits##_to_gray_##name2(const stp_vars_t *vars,			\
   int o0 = 0;								\
   int nz = 0;								\
   const T *s_in = (const T *) in;					\
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	\
   int l_red = LUM_RED;							\
   int l_green = LUM_GREEN;						\
   int l_blue = LUM_BLUE;						\
@@ -1517,7 +1664,7 @@ color_##bits##_to_gray_##name2(const stp_vars_t *vars,			\
       l_blue = (100 - l_blue) / 2;					\
     }									\
 									\
-  for (i = 0; i < lut->image_width; i++)				\
+  for (i = 0; i < lut->convert_width; i++)				\
     {									\
       if (i0 != s_in[0] || i1 != s_in[1] || i2 != s_in[2])		\
 	{								\
@@ -1546,7 +1693,7 @@ COLOR_TO_GRAY_RAW_FUNC(unsigned short, 16, 0, noninvert)
 
 #define CMYK_TO_GRAY_RAW_FUNC(T, bits, invertable, name2)		    \
 static unsigned								    \
-cmyk_##bits##_to_gray_##name2(const stp_vars_t *vars,			    \
+cmyk_##bits##_to_gray_##name2(lut_t *lut,				    \
 			      const unsigned char *in,			    \
 			      unsigned short *out)			    \
 {									    \
@@ -1558,7 +1705,6 @@ cmyk_##bits##_to_gray_##name2(const stp_vars_t *vars,			    \
   int o0 = 0;								    \
   int nz = 0;								    \
   const T *s_in = (const T *) in;					    \
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
   int l_red = LUM_RED;							    \
   int l_green = LUM_GREEN;						    \
   int l_blue = LUM_BLUE;						    \
@@ -1575,7 +1721,7 @@ cmyk_##bits##_to_gray_##name2(const stp_vars_t *vars,			    \
       l_white = (100 - l_white) / 3;					    \
     }									    \
 									    \
-  for (i = 0; i < lut->image_width; i++)				    \
+  for (i = 0; i < lut->convert_width; i++)				    \
     {									    \
       if (i0 != s_in[0] || i1 != s_in[1] || i2 != s_in[2] || i3 != s_in[3]) \
 	{								    \
@@ -1605,7 +1751,7 @@ CMYK_TO_GRAY_RAW_FUNC(unsigned short, 16, 0, noninvert)
 
 #define KCMY_TO_GRAY_RAW_FUNC(T, bits, invertable, name2)		    \
 static unsigned								    \
-kcmy_##bits##_to_gray_##name2(const stp_vars_t *vars,			    \
+kcmy_##bits##_to_gray_##name2(lut_t *lut,				    \
 			      const unsigned char *in,			    \
 			      unsigned short *out)			    \
 {									    \
@@ -1617,7 +1763,6 @@ kcmy_##bits##_to_gray_##name2(const stp_vars_t *vars,			    \
   int o0 = 0;								    \
   int nz = 0;								    \
   const T *s_in = (const T *) in;					    \
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
   int l_red = LUM_RED;							    \
   int l_green = LUM_GREEN;						    \
   int l_blue = LUM_BLUE;						    \
@@ -1634,7 +1779,7 @@ kcmy_##bits##_to_gray_##name2(const stp_vars_t *vars,			    \
       l_white = (100 - l_white) / 3;					    \
     }									    \
 									    \
-  for (i = 0; i < lut->image_width; i++)				    \
+  for (i = 0; i < lut->convert_width; i++)				    \
     {									    \
       if (i0 != s_in[0] || i1 != s_in[1] || i2 != s_in[2] || i3 != s_in[3]) \
 	{								    \
@@ -1664,7 +1809,7 @@ KCMY_TO_GRAY_RAW_FUNC(unsigned short, 16, 0, noninvert)
 
 #define CMYK_TO_KCMY_RAW_FUNC(T, bits)					\
 static unsigned								\
-cmyk_##bits##_to_kcmy_raw(const stp_vars_t *vars,			\
+cmyk_##bits##_to_kcmy_raw(lut_t *lut,					\
 			  const unsigned char *in,			\
 			  unsigned short *out)				\
 {									\
@@ -1673,10 +1818,9 @@ cmyk_##bits##_to_kcmy_raw(const stp_vars_t *vars,			\
   int nz[4];								\
   unsigned retval = 0;							\
   const T *s_in = (const T *) in;					\
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	\
 									\
   memset(nz, 0, sizeof(nz));						\
-  for (i = 0; i < lut->image_width; i++)				\
+  for (i = 0; i < lut->convert_width; i++)				\
     {									\
       out[0] = s_in[3] * (65535 / ((1 << bits) - 1));			\
       out[1] = s_in[0] * (65535 / ((1 << bits) - 1));			\
@@ -1699,7 +1843,7 @@ GENERIC_COLOR_FUNC(cmyk, kcmy_raw)
 
 #define KCMY_TO_KCMY_RAW_FUNC(T, bits)					\
 static unsigned								\
-kcmy_##bits##_to_kcmy_raw(const stp_vars_t *vars,			\
+kcmy_##bits##_to_kcmy_raw(lut_t *lut,					\
 			  const unsigned char *in,			\
 			  unsigned short *out)				\
 {									\
@@ -1708,10 +1852,9 @@ kcmy_##bits##_to_kcmy_raw(const stp_vars_t *vars,			\
   int nz[4];								\
   unsigned retval = 0;							\
   const T *s_in = (const T *) in;					\
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	\
 									\
   memset(nz, 0, sizeof(nz));						\
-  for (i = 0; i < lut->image_width; i++)				\
+  for (i = 0; i < lut->convert_width; i++)				\
     {									\
       for (j = 0; j < 4; j++)						\
 	{								\
@@ -1733,59 +1876,53 @@ GENERIC_COLOR_FUNC(kcmy, kcmy_raw)
 
 #define DESATURATED_FUNC(name, name2, bits)				   \
 static unsigned								   \
-name##_##bits##_to_##name2##_desaturated(const stp_vars_t *vars,	   \
+name##_##bits##_to_##name2##_desaturated(lut_t *lut,			   \
 				         const unsigned char *in,	   \
 				         unsigned short *out)		   \
 {									   \
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	   \
   size_t real_steps = lut->steps;					   \
   unsigned status;							   \
   if (!lut->gray_tmp)							   \
-    lut->gray_tmp = stp_malloc(2 * lut->image_width);			   \
-  name##_##bits##_to_gray_noninvert(vars, in, lut->gray_tmp);		   \
+    lut->gray_tmp = stp_malloc(2 * lut->image_width *			   \
+			       lut->band_rows);				   \
+  name##_##bits##_to_gray_noninvert(lut, in, lut->gray_tmp);		   \
   lut->steps = 65536;							   \
-  status = gray_16_to_##name2(vars, (unsigned char *) lut->gray_tmp, out); \
+  status = gray_16_to_##name2(lut, (unsigned char *) lut->gray_tmp, out);  \
   lut->steps = real_steps;						   \
   return status;							   \
 }
 
 DESATURATED_FUNC(color, color, 8)
 DESATURATED_FUNC(color, color, 16)
-GENERIC_COLOR_FUNC(color, color_desaturated)
+GENERIC_COLOR_FUNC_WITH_CURVES(color, color_desaturated, prepare_gray_color_curves, 16)
 DESATURATED_FUNC(color, kcmy, 8)
 DESATURATED_FUNC(color, kcmy, 16)
-GENERIC_COLOR_FUNC(color, kcmy_desaturated)
+GENERIC_COLOR_FUNC_WITH_CURVES(color, kcmy_desaturated, prepare_gray_color_curves, 16)
 
 DESATURATED_FUNC(cmyk, color, 8)
 DESATURATED_FUNC(cmyk, color, 16)
-GENERIC_COLOR_FUNC(cmyk, color_desaturated)
+GENERIC_COLOR_FUNC_WITH_CURVES(cmyk, color_desaturated, prepare_gray_color_curves, 16)
 DESATURATED_FUNC(cmyk, kcmy, 8)
 DESATURATED_FUNC(cmyk, kcmy, 16)
-GENERIC_COLOR_FUNC(cmyk, kcmy_desaturated)
+GENERIC_COLOR_FUNC_WITH_CURVES(cmyk, kcmy_desaturated, prepare_gray_color_curves, 16)
 
 DESATURATED_FUNC(kcmy, color, 8)
 DESATURATED_FUNC(kcmy, color, 16)
-GENERIC_COLOR_FUNC(kcmy, color_desaturated)
+GENERIC_COLOR_FUNC_WITH_CURVES(kcmy, color_desaturated, prepare_gray_color_curves, 16)
 DESATURATED_FUNC(kcmy, kcmy, 8)
 DESATURATED_FUNC(kcmy, kcmy, 16)
-GENERIC_COLOR_FUNC(kcmy, kcmy_desaturated)
+GENERIC_COLOR_FUNC_WITH_CURVES(kcmy, kcmy_desaturated, prepare_gray_color_curves, 16)
 
 #define CMYK_DISPATCH(name)						\
-static unsigned								\
-CMYK_to_##name(const stp_vars_t *vars, const unsigned char *in,		\
-	       unsigned short *out)					\
+static stp_convert_t							\
+CMYK_to_##name(lut_t *lut)						\
 {									\
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	\
   if (lut->input_color_description->color_id == COLOR_ID_CMYK)		\
-    return cmyk_to_##name(vars, in, out);				\
+    return cmyk_to_##name(lut);						\
   else if (lut->input_color_description->color_id == COLOR_ID_KCMY)	\
-    return kcmy_to_##name(vars, in, out);				\
+    return kcmy_to_##name(lut);						\
   else									\
-    {									\
-      stp_eprintf(vars, "Bad dispatch to CMYK_to_%s: %d\n", #name,	\
-		  lut->input_color_description->color_id);		\
-      return 0;								\
-    }									\
+    return NULL;							\
 }
 
 CMYK_DISPATCH(color)
@@ -1803,19 +1940,18 @@ CMYK_DISPATCH(gray_threshold)
 
 #define RAW_TO_RAW_THRESHOLD_FUNC(T, name)				\
 static unsigned								\
-name##_to_raw_threshold(const stp_vars_t *vars,				\
+name##_to_raw_threshold(lut_t *lut,					\
 			const unsigned char *in,			\
 			unsigned short *out)				\
 {									\
   int i;								\
   int j;								\
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	\
   unsigned nz[STP_CHANNEL_LIMIT];					\
   unsigned z = (1 << lut->out_channels) - 1;				\
   const T *s_in = (const T *) in;					\
   unsigned desired_high_bit = 0;					\
   unsigned high_bit = 1 << ((sizeof(T) * 8) - 1);			\
-  int width = lut->image_width;						\
+  int width = lut->convert_width;					\
   memset(out, 0, width * lut->out_channels * sizeof(unsigned short));	\
   if (!lut->invert_output)						\
     desired_high_bit = high_bit;					\
@@ -1843,7 +1979,7 @@ GENERIC_COLOR_FUNC(raw, raw_threshold)
 
 #define RAW_TO_RAW_FUNC(T, size)					    \
 static unsigned								    \
-raw_##size##_to_raw(const stp_vars_t *vars,				    \
+raw_##size##_to_raw(lut_t *lut,						    \
 		    const unsigned char *in,				    \
 		    unsigned short *out)				    \
 {									    \
@@ -1852,21 +1988,15 @@ raw_##size##_to_raw(const stp_vars_t *vars,				    \
   int j;								    \
   int nz[STP_CHANNEL_LIMIT];						    \
   const T *s_in = (const T *) in;					    \
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	    \
-  const unsigned short *maps[STP_CHANNEL_LIMIT];			    \
+  const unsigned short *const *maps;					    \
   const unsigned short *user;						    \
 									    \
-  for (i = 0; i < lut->out_channels; i++)				    \
-    {									    \
-      stp_curve_resample(lut->channel_curves[i].curve, 65536);		    \
-      maps[i] = stp_curve_cache_get_ushort_data(&(lut->channel_curves[i])); \
-    }									    \
-  stp_curve_resample(lut->user_color_correction.curve, 1 << size);	    \
-  user = stp_curve_cache_get_ushort_data(&(lut->user_color_correction));    \
+  maps = lut->prepared.maps;						    \
+  user = lut->prepared.user;						    \
 									    \
   memset(nz, 0, sizeof(nz));						    \
 									    \
-  for (i = 0; i < lut->image_width; i++, out += lut->out_channels)	    \
+  for (i = 0; i < lut->convert_width; i++, out += lut->out_channels)	    \
     {									    \
       for (j = 0; j < lut->out_channels; j++)				    \
 	{								    \
@@ -1883,12 +2013,13 @@ raw_##size##_to_raw(const stp_vars_t *vars,				    \
 
 RAW_TO_RAW_FUNC(unsigned char, 8)
 RAW_TO_RAW_FUNC(unsigned short, 16)
-GENERIC_COLOR_FUNC(raw, raw)
+GENERIC_COLOR_FUNC_WITH_CURVES(raw, raw, prepare_channel_curves,
+			       lut->channel_depth)
 
 
 #define RAW_TO_RAW_RAW_FUNC(T, bits)					\
 static unsigned								\
-raw_##bits##_to_raw_raw(const stp_vars_t *vars,				\
+raw_##bits##_to_raw_raw(lut_t *lut,					\
 		        const unsigned char *in,			\
 		        unsigned short *out)				\
 {									\
@@ -1897,11 +2028,10 @@ raw_##bits##_to_raw_raw(const stp_vars_t *vars,				\
   int nz[STP_CHANNEL_LIMIT];						\
   unsigned retval = 0;							\
   const T *s_in = (const T *) in;					\
-  lut_t *lut = (lut_t *)(stp_get_component_data(vars, "Color"));	\
   int colors = lut->in_channels;					\
 									\
   memset(nz, 0, sizeof(nz));						\
-  for (i = 0; i < lut->image_width; i++)				\
+  for (i = 0; i < lut->convert_width; i++)				\
     {									\
       for (j = 0; j < colors; j++)					\
 	{								\
@@ -1923,67 +2053,58 @@ GENERIC_COLOR_FUNC(raw, raw_raw)
 
 
 #define CONVERSION_FUNCTION_WITH_FAST(from, to, from2)		\
-static unsigned							\
-generic_##from##_to_##to(const stp_vars_t *v,			\
-			 const unsigned char *in,		\
-			 unsigned short *out)			\
+static stp_convert_t						\
+generic_##from##_to_##to(lut_t *lut)				\
 {								\
-  lut_t *lut = (lut_t *)(stp_get_component_data(v, "Color"));	\
   switch (lut->color_correction->correction)			\
     {								\
     case COLOR_CORRECTION_UNCORRECTED:				\
-      return from2##_to_##to##_fast(v, in, out);		\
+      return from2##_to_##to##_fast(lut);			\
     case COLOR_CORRECTION_ACCURATE:				\
     case COLOR_CORRECTION_BRIGHT:				\
     case COLOR_CORRECTION_HUE:					\
-      return from2##_to_##to(v, in, out);			\
+      return from2##_to_##to(lut);				\
     case COLOR_CORRECTION_DESATURATED:				\
-      return from2##_to_##to##_desaturated(v, in, out);		\
+      return from2##_to_##to##_desaturated(lut);		\
     case COLOR_CORRECTION_THRESHOLD:				\
     case COLOR_CORRECTION_PREDITHERED:				\
-      return from2##_to_##to##_threshold(v, in, out);		\
+      return from2##_to_##to##_threshold(lut);			\
     case COLOR_CORRECTION_DENSITY:				\
     case COLOR_CORRECTION_RAW:					\
-      return from2##_to_##to##_raw(v, in, out);			\
+      return from2##_to_##to##_raw(lut);			\
     default:							\
-      return (unsigned) -1;					\
+      return NULL;						\
     }								\
 }
 
 #define CONVERSION_FUNCTION_WITHOUT_FAST(from, to, from2)	\
-static unsigned							\
-generic_##from##_to_##to(const stp_vars_t *v,			\
-			 const unsigned char *in,		\
-			 unsigned short *out)			\
+static stp_convert_t						\
+generic_##from##_to_##to(lut_t *lut)				\
 {								\
-  lut_t *lut = (lut_t *)(stp_get_component_data(v, "Color"));	\
   switch (lut->color_correction->correction)			\
     {								\
     case COLOR_CORRECTION_UNCORRECTED:				\
     case COLOR_CORRECTION_ACCURATE:				\
     case COLOR_CORRECTION_BRIGHT:				\
     case COLOR_CORRECTION_HUE:					\
-      return from2##_to_##to(v, in, out);			\
+      return from2##_to_##to(lut);				\
     case COLOR_CORRECTION_DESATURATED:				\
-      return from2##_to_##to##_desaturated(v, in, out);		\
+      return from2##_to_##to##_desaturated(lut);		\
     case COLOR_CORRECTION_THRESHOLD:				\
     case COLOR_CORRECTION_PREDITHERED:				\
-      return from2##_to_##to##_threshold(v, in, out);		\
+      return from2##_to_##to##_threshold(lut);			\
     case COLOR_CORRECTION_DENSITY:				\
     case COLOR_CORRECTION_RAW:					\
-      return from2##_to_##to##_raw(v, in, out);			\
+      return from2##_to_##to##_raw(lut);			\
     default:							\
-      return (unsigned) -1;					\
+      return NULL;						\
     }								\
 }
 
 #define CONVERSION_FUNCTION_WITHOUT_DESATURATED(from, to, from2)	\
-static unsigned								\
-generic_##from##_to_##to(const stp_vars_t *v,				\
-			 const unsigned char *in,			\
-			 unsigned short *out)				\
+static stp_convert_t							\
+generic_##from##_to_##to(lut_t *lut)					\
 {									\
-  lut_t *lut = (lut_t *)(stp_get_component_data(v, "Color"));		\
   switch (lut->color_correction->correction)				\
     {									\
     case COLOR_CORRECTION_UNCORRECTED:					\
@@ -1991,15 +2112,15 @@ generic_##from##_to_##to(const stp_vars_t *v,				\
     case COLOR_CORRECTION_BRIGHT:					\
     case COLOR_CORRECTION_HUE:						\
     case COLOR_CORRECTION_DESATURATED:					\
-      return from2##_to_##to(v, in, out);				\
+      return from2##_to_##to(lut);					\
     case COLOR_CORRECTION_THRESHOLD:					\
     case COLOR_CORRECTION_PREDITHERED:					\
-      return from2##_to_##to##_threshold(v, in, out);			\
+      return from2##_to_##to##_threshold(lut);				\
     case COLOR_CORRECTION_DENSITY:					\
     case COLOR_CORRECTION_RAW:						\
-      return from2##_to_##to##_raw(v, in, out);				\
+      return from2##_to_##to##_raw(lut);				\
     default:								\
-      return (unsigned) -1;						\
+      return NULL;							\
     }									\
 }
 
@@ -2013,94 +2134,137 @@ CONVERSION_FUNCTION_WITHOUT_DESATURATED(gray, gray, gray)
 CONVERSION_FUNCTION_WITHOUT_DESATURATED(gray, color, gray)
 CONVERSION_FUNCTION_WITHOUT_DESATURATED(gray, kcmy, gray)
 
-unsigned
-stpi_color_convert_to_gray(const stp_vars_t *v,
-			   const unsigned char *in,
-			   unsigned short *out)
+stp_convert_t
+stpi_color_select_to_gray(lut_t *lut)
 {
-  lut_t *lut = (lut_t *)(stp_get_component_data(v, "Color"));
   switch (lut->input_color_description->color_id)
     {
     case COLOR_ID_GRAY:
     case COLOR_ID_WHITE:
-      return generic_gray_to_gray(v, in, out);
+      return generic_gray_to_gray(lut);
     case COLOR_ID_RGB:
     case COLOR_ID_CMY:
-      return generic_color_to_gray(v, in, out);
+      return generic_color_to_gray(lut);
     case COLOR_ID_CMYK:
     case COLOR_ID_KCMY:
-      return generic_cmyk_to_gray(v, in, out);
+      return generic_cmyk_to_gray(lut);
     default:
-      return (unsigned) -1;
+      return NULL;
     }
 }
 
-unsigned
-stpi_color_convert_to_color(const stp_vars_t *v,
-			    const unsigned char *in,
-			    unsigned short *out)
+stp_convert_t
+stpi_color_select_to_color(lut_t *lut)
 {
-  lut_t *lut = (lut_t *)(stp_get_component_data(v, "Color"));
   switch (lut->input_color_description->color_id)
     {
     case COLOR_ID_GRAY:
     case COLOR_ID_WHITE:
-      return generic_gray_to_color(v, in, out);
+      return generic_gray_to_color(lut);
     case COLOR_ID_RGB:
     case COLOR_ID_CMY:
-      return generic_color_to_color(v, in, out);
+      return generic_color_to_color(lut);
     case COLOR_ID_CMYK:
     case COLOR_ID_KCMY:
-      return generic_cmyk_to_color(v, in, out);
+      return generic_cmyk_to_color(lut);
     default:
-      return (unsigned) -1;
+      return NULL;
     }
 }
 
-unsigned
-stpi_color_convert_to_kcmy(const stp_vars_t *v,
-			   const unsigned char *in,
-			   unsigned short *out)
+stp_convert_t
+stpi_color_select_to_kcmy(lut_t *lut)
 {
-  lut_t *lut = (lut_t *)(stp_get_component_data(v, "Color"));
   switch (lut->input_color_description->color_id)
     {
     case COLOR_ID_GRAY:
     case COLOR_ID_WHITE:
-      return generic_gray_to_kcmy(v, in, out);
+      return generic_gray_to_kcmy(lut);
     case COLOR_ID_RGB:
     case COLOR_ID_CMY:
-      return generic_color_to_kcmy(v, in, out);
+      return generic_color_to_kcmy(lut);
     case COLOR_ID_CMYK:
     case COLOR_ID_KCMY:
-      return generic_cmyk_to_kcmy(v, in, out);
+      return generic_cmyk_to_kcmy(lut);
     default:
-      return (unsigned) -1;
+      return NULL;
     }
 }
 
-unsigned
-stpi_color_convert_raw(const stp_vars_t *v,
-		       const unsigned char *in,
-		       unsigned short *out)
+stp_convert_t
+stpi_color_select_raw(lut_t *lut)
 {
-  lut_t *lut = (lut_t *)(stp_get_component_data(v, "Color"));
   switch (lut->color_correction->correction)
     {
     case COLOR_CORRECTION_THRESHOLD:
     case COLOR_CORRECTION_PREDITHERED:
-      return raw_to_raw_threshold(v, in, out);
+      return raw_to_raw_threshold(lut);
     case COLOR_CORRECTION_UNCORRECTED:
     case COLOR_CORRECTION_BRIGHT:
     case COLOR_CORRECTION_HUE:
     case COLOR_CORRECTION_ACCURATE:
     case COLOR_CORRECTION_DESATURATED:
-      return raw_to_raw(v, in, out);
+      return raw_to_raw(lut);
     case COLOR_CORRECTION_RAW:
     case COLOR_CORRECTION_DEFAULT:
     case COLOR_CORRECTION_DENSITY:
-      return raw_to_raw_raw(v, in, out);
+      return raw_to_raw_raw(lut);
     default:
-      return (unsigned) -1;
+      return NULL;
+    }
+}
+
+static unsigned
+no_conversion(lut_t *lut, const unsigned char *in, unsigned short *out)
+{
+  return (unsigned) -1;
+}
+
+void
+stpi_color_prepare_conversion(const stp_vars_t *v, lut_t *lut)
+{
+  prepared_conversion_t *p = &(lut->prepared);
+
+  memset(p, 0, sizeof(prepared_conversion_t));
+  p->saturation = stp_get_float_parameter(v, "Saturation");
+  p->compute_saturation =
+    p->saturation <= .99999 || p->saturation >= 1.00001;
+  p->isat = p->saturation > 1 ? 1.0 / p->saturation : 1.0;
+  p->split_saturation = p->saturation > 1.4;
+  p->hsl_saturation = p->saturation;
+  if (p->split_saturation)
+    p->hsl_saturation = sqrt(p->saturation);
+  p->hsl_isat = p->hsl_saturation > 1 ? 1.0 / p->hsl_saturation : 1.0;
+  if (stp_get_float_parameter(v, "Brightness") != 1)
+    p->do_user_adjustment = 1;
+  p->compute_saturation |= p->do_user_adjustment;
+  if (lut->color_correction->correction == COLOR_CORRECTION_BRIGHT)
+    p->bright_color_adjustment = 1;
+  if (lut->color_correction->correction == COLOR_CORRECTION_HUE)
+    p->hue_only_color_adjustment = 1;
+
+  p->convert = (lut->output_color_description->select_conversion)(lut);
+  if (!p->convert)
+    {
+      stp_eprintf(v, "No color conversion from %s to %s\n",
+		  lut->input_color_description->name,
+		  lut->output_color_description->name);
+      p->convert = no_conversion;
+      return;
     }
+  stp_dprintf(STP_DBG_COLORFUNC, v,
+	      "Colorfunc is %s_%d_to_%s, %s, %s, %d, %d\n",
+	      p->from_name, lut->channel_depth, p->to_name,
+	      lut->input_color_description->name,
+	      lut->output_color_description->name,
+	      lut->steps, lut->invert_output);
+
+  if (p->prepare)
+    (p->prepare)(lut, p->prepare_bits);
+  if (lut->rgb_grid_size && p->prepare == prepare_color_curves &&
+      !lut->rgb_table)
+    build_rgb_table(lut, p->prepare_bits);
+  if (lut->rgb_table)
+    stp_dprintf(STP_DBG_LUT, v, "Built %d point RGB table, %d bits\n",
+		lut->rgb_grid_size, lut->channel_depth);
 }
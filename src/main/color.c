@@ -40,6 +40,13 @@ static const char* stpi_color_long_namefunc(const void *item);
 
 static stp_list_t *color_list = NULL;
 
+/*
+ * Set by the traditional color module, which converts several rows
+ * at once.
+ */
+static const stp_colorfuncs_t *traditional_colorfuncs = NULL;
+static stpi_color_get_rows_func_t traditional_get_rows = NULL;
+
 
 static int
 stpi_init_color_list(void)
@@ -193,6 +200,41 @@ stp_color_get_row(stp_vars_t *v,
   return colorfuncs->get_row(v, image, row, zero_mask);
 }
 
+void
+stpi_color_set_traditional_get_rows(const stp_colorfuncs_t *colorfuncs,
+				    stpi_color_get_rows_func_t get_rows)
+{
+  traditional_colorfuncs = get_rows ? colorfuncs : NULL;
+  traditional_get_rows = get_rows;
+}
+
+int
+stpi_color_get_rows(stp_vars_t *v,
+		    stp_image_t *image,
+		    int row,
+		    int count,
+		    unsigned short *out,
+		    unsigned *zero_masks)
+{
+  const stp_colorfuncs_t *colorfuncs =
+    stpi_get_colorfuncs(stp_get_color_by_name(stp_get_color_conversion(v)));
+  int i;
+  if (traditional_get_rows && colorfuncs == traditional_colorfuncs)
+    return traditional_get_rows(v, image, row, count, out, zero_masks);
+  for (i = 0; i < count; i++)
+    {
+      size_t out_size;
+      int status = colorfuncs->get_row(v, image, row + i,
+				       zero_masks ? &(zero_masks[i]) : NULL);
+      if (status)
+	return status;
+      out_size = stpi_channel_get_output_size(v);
+      memcpy(out, stp_channel_get_output(v), out_size);
+      out += out_size / sizeof(unsigned short);
+    }
+  return 0;
+}
+
 stp_parameter_list_t
 stp_color_list_parameters(const stp_vars_t *v)
 {
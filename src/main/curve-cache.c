@@ -139,3 +139,82 @@ stp_curve_cache_copy(stp_cached_curve_t *dest, const stp_cached_curve_t *src)
     }
 }
 
+
+/*
+ * Write a cached curve to a stream in a raw, host-specific form for
+ * caching computed curves across processes.  Only sampled curves can
+ * be written this way; piecewise and gamma curves return 0.
+ */
+int
+stpi_curve_cache_write(FILE *fp, stp_cached_curve_t *cache)
+{
+  int header[3];
+  double bounds[2];
+  size_t count;
+  const double *data;
+  stp_curve_t *curve = cache->curve;
+
+  header[0] = curve ? 1 : 0;
+  if (!curve)
+    return fwrite(header, sizeof(int), 1, fp) == 1;
+  if (stp_curve_is_piecewise(curve) || stp_curve_get_gamma(curve) != 0.0)
+    return 0;
+  data = stp_curve_cache_get_double_data(cache);
+  count = stp_curve_cache_get_count(cache);
+  if (!data)
+    return 0;
+  header[1] = stp_curve_get_wrap(curve);
+  header[2] = stp_curve_get_interpolation_type(curve);
+  stp_curve_get_bounds(curve, &bounds[0], &bounds[1]);
+  return (fwrite(header, sizeof(int), 3, fp) == 3 &&
+	  fwrite(bounds, sizeof(double), 2, fp) == 2 &&
+	  fwrite(&count, sizeof(size_t), 1, fp) == 1 &&
+	  fwrite(data, sizeof(double), count, fp) == count);
+}
+
+/*
+ * Read a curve written by stpi_curve_cache_write into an empty cache.
+ */
+int
+stpi_curve_cache_read(FILE *fp, stp_cached_curve_t *cache)
+{
+  int header[3];
+  double bounds[2];
+  size_t count;
+  double *data;
+  stp_curve_t *curve;
+
+  if (fread(header, sizeof(int), 1, fp) != 1)
+    return 0;
+  if (!header[0])
+    {
+      stp_curve_free_curve_cache(cache);
+      return 1;
+    }
+  if (fread(header + 1, sizeof(int), 2, fp) != 2 ||
+      fread(bounds, sizeof(double), 2, fp) != 2 ||
+      fread(&count, sizeof(size_t), 1, fp) != 1 ||
+      count < 2 || count > 1048576)
+    return 0;
+  data = stp_malloc(sizeof(double) * count);
+  if (fread(data, sizeof(double), count, fp) != count)
+    {
+      stp_free(data);
+      return 0;
+    }
+  curve = stp_curve_create(header[1]);
+  if (!curve ||
+      !stp_curve_set_interpolation_type(curve, header[2]) ||
+      !stp_curve_set_bounds(curve, bounds[0], bounds[1]) ||
+      !stp_curve_set_data(curve, count, data))
+    {
+      if (curve)
+	stp_curve_destroy(curve);
+      stp_free(data);
+      return 0;
+    }
+  stp_free(data);
+  stp_curve_free_curve_cache(cache);
+  stp_curve_cache_set_curve(cache, curve);
+  return 1;
+}
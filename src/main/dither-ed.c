@@ -32,6 +32,9 @@
 #include "gutenprint-internal.h"
 #include <gutenprint/gutenprint-intl-internal.h>
 #include <string.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #include "dither-impl.h"
 #include "dither-inlined-functions.h"
 
@@ -130,6 +133,8 @@ print_color(const stpi_dither_t *d, stpi_dither_channel_t *dc, int x, int y,
   unsigned randomizer = dc->randomizer;
   stp_dither_matrix_impl_t *pick_matrix = &(dc->pick);
   stp_dither_matrix_impl_t *dither_matrix = &(dc->dithermat);
+  stpi_dither_matrix_row_t *pick_row = &(dc->pick_row);
+  stpi_dither_matrix_row_t *dither_row = &(dc->dithermat_row);
   unsigned rangepoint = 32768;
   unsigned vmatrix;
   int i;
@@ -249,7 +254,7 @@ print_color(const stpi_dither_t *d, stpi_dither_channel_t *dc, int x, int y,
 	       * First, compute a value between 0 and 65535 that will be
 	       * scaled to produce an offset from the desired threshold.
 	       */
-	      vmatrix = ditherpoint(d, dither_matrix, x);
+	      vmatrix = ditherpoint_row(d, dither_matrix, dither_row, x);
 	      /*
 	       * Now, scale the virtual dot size appropriately.  Note that
 	       * we'll get something evenly distributed between 0 and
@@ -287,7 +292,7 @@ print_color(const stpi_dither_t *d, stpi_dither_channel_t *dc, int x, int y,
 	    subc = upper;
 	  else
 	    {
-	      if (rangepoint >= ditherpoint(d, pick_matrix, x))
+	      if (rangepoint >= ditherpoint_row(d, pick_matrix, pick_row, x))
 		subc = upper;
 	      else
 		subc = lower;
@@ -398,38 +403,40 @@ shared_ed_deinitializer(stpi_dither_t *d,
   STP_SAFE_FREE(ndither);
 }
 
-void
-stpi_dither_ed(stp_vars_t *v,
-	       int row,
-	       const unsigned short *raw,
-	       int duplicate_line,
-	       int zero_mask,
-	       const unsigned char *mask)
+/*
+ * Each channel carries its own error lines and dither state through
+ * the row, so the channels can be dithered independently of each
+ * other.  A row can't be split any other way without changing the
+ * output: every pixel depends on the one before it, and alternate rows
+ * run in opposite directions.
+ */
+typedef struct
 {
-  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
-  int		x,
-    		length;
-  unsigned char	bit;
-  int		i;
-  int		*ndither;
-  int		***error;
+  int row;
+  const unsigned short *raw;
+  const unsigned char *mask;
+  int ***error;
+  int *ndither;
+  int direction;
+  int length;
+  int first_channel;		/* Dither channels first_channel, */
+  int channel_step;		/* first_channel + channel_step, ... */
+} ed_row_t;
 
-  int		terminate;
-  int		direction = row & 1 ? 1 : -1;
+static void
+dither_ed_channels(stpi_dither_t *d, const ed_row_t *er)
+{
+  const unsigned short *raw = er->raw;
+  int direction = er->direction;
+  int ***error = er->error;
+  int *ndither = er->ndither;
+  int row = er->row;
+  int x, i;
+  unsigned char bit;
+  int terminate;
   int xerror, xstep, xmod;
 
-  length = (d->dst_width + 7) / 8;
-  if (d->stpi_dither_type & D_ADAPTIVE_BASE)
-    for (i = 0; i < CHANNEL_COUNT(d); i++)
-      if (CHANNEL(d, i).nlevels > 1)
-	{
-	  stpi_dither_ordered(v, row, raw, duplicate_line, zero_mask, mask);
-	  return;
-	}
-  if (!shared_ed_initializer(d, row, duplicate_line, zero_mask, length,
-			     direction, &error, &ndither))
-    return;
-
+  d->ptr_offset = (direction == 1) ? 0 : er->length - 1;
   x = (direction == 1) ? 0 : d->dst_width - 1;
   bit = 1 << (7 - (x & 7));
   xstep  = CHANNEL_COUNT(d) * (d->src_width / d->dst_width);
@@ -442,7 +449,7 @@ stpi_dither_ed(stp_vars_t *v,
 
   for (; x != terminate; x += direction)
     {
-      for (i = 0; i < CHANNEL_COUNT(d); i++)
+      for (i = er->first_channel; i < CHANNEL_COUNT(d); i += er->channel_step)
 	{
 	  if (CHANNEL(d, i).ptr)
 	    {
@@ -451,8 +458,8 @@ stpi_dither_ed(stp_vars_t *v,
 	      CHANNEL(d, i).b = CHANNEL(d, i).v;
 	      CHANNEL(d, i).v = UPDATE_COLOR(CHANNEL(d, i).v, ndither[i]);
 	      CHANNEL(d, i).v = print_color(d, &(CHANNEL(d, i)), x, row, bit,
-					    length, 0, d->stpi_dither_type,
-					    mask);
+					    er->length, 0, d->stpi_dither_type,
+					    er->mask);
 	      ndither[i] = update_dither(d, i, d->src_width,
 					 direction, error[i][0], error[i][1]);
 	    }
@@ -460,6 +467,216 @@ stpi_dither_ed(stp_vars_t *v,
       ADVANCE_BIDIRECTIONAL(d, bit, raw, direction, CHANNEL_COUNT(d), xerror,
 			    xstep, xmod, error, d->error_rows);
     }
+}
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * Rows narrower than this are not worth handing to other threads.
+ */
+#define ED_THREAD_MIN_WIDTH 1024
+
+struct ed_threads;
+
+typedef struct
+{
+  struct ed_threads *pool;
+  stpi_dither_t d;		/* Private copy for ptr_offset */
+  ed_row_t er;
+  int ***error;			/* Private copy of the error line pointers */
+  pthread_t thread;
+} ed_thread_t;
+
+/*
+ * The worker threads are started when the dither is finalized and
+ * live until it is freed.  For each row the calling thread bumps
+ * generation and waits for pending to drop to zero.
+ */
+typedef struct ed_threads
+{
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  unsigned generation;
+  int pending;
+  int exiting;
+  int nthreads;			/* Channel groups */
+  int started;			/* Groups 1..started-1 have a thread */
+  ed_thread_t *threads;
+} ed_threads_t;
+
+static void *
+dither_ed_worker(void *arg)
+{
+  ed_thread_t *et = (ed_thread_t *) arg;
+  ed_threads_t *pool = et->pool;
+  unsigned generation = 0;
+
+  pthread_mutex_lock(&(pool->lock));
+  while (1)
+    {
+      while (pool->generation == generation && !pool->exiting)
+	pthread_cond_wait(&(pool->start), &(pool->lock));
+      if (pool->exiting)
+	break;
+      generation = pool->generation;
+      pthread_mutex_unlock(&(pool->lock));
+      dither_ed_channels(&(et->d), &(et->er));
+      pthread_mutex_lock(&(pool->lock));
+      if (--pool->pending == 0)
+	pthread_cond_signal(&(pool->done));
+    }
+  pthread_mutex_unlock(&(pool->lock));
+  return NULL;
+}
+
+static void
+free_ed_threads(stpi_dither_t *d)
+{
+  ed_threads_t *pool = (ed_threads_t *) d->aux_data;
+  int i, j;
+
+  pthread_mutex_lock(&(pool->lock));
+  pool->exiting = 1;
+  pthread_cond_broadcast(&(pool->start));
+  pthread_mutex_unlock(&(pool->lock));
+  for (i = 1; i < pool->started; i++)
+    pthread_join(pool->threads[i].thread, NULL);
+  pthread_cond_destroy(&(pool->done));
+  pthread_cond_destroy(&(pool->start));
+  pthread_mutex_destroy(&(pool->lock));
+  for (i = 0; i < pool->nthreads; i++)
+    {
+      for (j = 0; j < CHANNEL_COUNT(d); j++)
+	stp_free(pool->threads[i].error[j]);
+      stp_free(pool->threads[i].error);
+    }
+  stp_free(pool->threads);
+  stp_free(pool);
+  d->aux_data = NULL;
+}
+
+void
+stpi_dither_ed_finalize(stpi_dither_t *d)
+{
+  ed_threads_t *pool;
+  int nthreads = d->threads;
+  int i, j;
+
+  if (nthreads > CHANNEL_COUNT(d))
+    nthreads = CHANNEL_COUNT(d);
+  if (nthreads < 2 || d->dst_width < ED_THREAD_MIN_WIDTH || d->aux_data)
+    return;
+  /* Adaptive hybrid hands these to the ordered dither, which uses aux_data */
+  if (d->stpi_dither_type & D_ADAPTIVE_BASE)
+    for (i = 0; i < CHANNEL_COUNT(d); i++)
+      if (CHANNEL(d, i).nlevels > 1)
+	return;
+  pool = stp_zalloc(sizeof(ed_threads_t));
+  pthread_mutex_init(&(pool->lock), NULL);
+  pthread_cond_init(&(pool->start), NULL);
+  pthread_cond_init(&(pool->done), NULL);
+  pool->nthreads = nthreads;
+  pool->threads = stp_zalloc(sizeof(ed_thread_t) * nthreads);
+  for (i = 0; i < nthreads; i++)
+    {
+      ed_thread_t *et = &(pool->threads[i]);
+      et->pool = pool;
+      et->error = stp_malloc(CHANNEL_COUNT(d) * sizeof(int **));
+      for (j = 0; j < CHANNEL_COUNT(d); j++)
+	et->error[j] = stp_malloc(d->error_rows * sizeof(int *));
+    }
+  for (pool->started = 1; pool->started < nthreads; pool->started++)
+    if (pthread_create(&(pool->threads[pool->started].thread), NULL,
+		       dither_ed_worker, &(pool->threads[pool->started])) != 0)
+      break;
+  d->aux_data = pool;
+  d->aux_freefunc = free_ed_threads;
+}
+
+/*
+ * Dither the channels in interleaved groups, one group in the calling
+ * thread and the others in the worker threads.  Any group whose thread
+ * couldn't be started is done in the calling thread instead.
+ */
+static void
+dither_ed_threaded(stpi_dither_t *d, ed_threads_t *pool, const ed_row_t *er)
+{
+  int i, j;
+
+  for (i = 0; i < pool->nthreads; i++)
+    {
+      ed_thread_t *et = &(pool->threads[i]);
+      et->d = *d;
+      et->er = *er;
+      et->er.first_channel = i;
+      et->er.channel_step = pool->nthreads;
+      for (j = 0; j < CHANNEL_COUNT(d); j++)
+	memcpy(et->error[j], er->error[j], d->error_rows * sizeof(int *));
+      et->er.error = et->error;
+    }
+  pthread_mutex_lock(&(pool->lock));
+  pool->pending = pool->started - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&(pool->start));
+  pthread_mutex_unlock(&(pool->lock));
+  for (i = pool->started; i < pool->nthreads; i++)
+    dither_ed_channels(&(pool->threads[i].d), &(pool->threads[i].er));
+  dither_ed_channels(&(pool->threads[0].d), &(pool->threads[0].er));
+  pthread_mutex_lock(&(pool->lock));
+  while (pool->pending > 0)
+    pthread_cond_wait(&(pool->done), &(pool->lock));
+  pthread_mutex_unlock(&(pool->lock));
+}
+#else
+void
+stpi_dither_ed_finalize(stpi_dither_t *d)
+{
+}
+#endif
+
+void
+stpi_dither_ed(stp_vars_t *v,
+	       int row,
+	       const unsigned short *raw,
+	       int duplicate_line,
+	       int zero_mask,
+	       const unsigned char *mask)
+{
+  stpi_dither_t *d = (stpi_dither_t *) stp_get_component_data(v, "Dither");
+  int		length;
+  int		i;
+  int		*ndither;
+  int		***error;
+  int		direction = row & 1 ? 1 : -1;
+  ed_row_t	er;
+
+  length = (d->dst_width + 7) / 8;
+  if (d->stpi_dither_type & D_ADAPTIVE_BASE)
+    for (i = 0; i < CHANNEL_COUNT(d); i++)
+      if (CHANNEL(d, i).nlevels > 1)
+	{
+	  stpi_dither_ordered(v, row, raw, duplicate_line, zero_mask, mask);
+	  return;
+	}
+  if (!shared_ed_initializer(d, row, duplicate_line, zero_mask, length,
+			     direction, &error, &ndither))
+    return;
+
+  er.row = row;
+  er.raw = raw;
+  er.mask = mask;
+  er.error = error;
+  er.ndither = ndither;
+  er.direction = direction;
+  er.length = length;
+  er.first_channel = 0;
+  er.channel_step = 1;
+#ifdef HAVE_PTHREAD_H
+  if (d->aux_data)
+    dither_ed_threaded(d, (ed_threads_t *) d->aux_data, &er);
+  else
+#endif
+    dither_ed_channels(d, &er);
   shared_ed_deinitializer(d, error, ndither);
   if (direction == -1)
     stpi_dither_reverse_row_ends(d);
@@ -104,6 +104,13 @@ typedef struct dither_segment
   int is_equal;
 } stpi_dither_segment_t;
 
+typedef struct dither_matrix_row
+{
+  unsigned width;		/* Width of row, or 0 if not used */
+  int y_mod;			/* Value of last_y_mod row was filled for */
+  unsigned *v;			/* Current row repeated across the line */
+} stpi_dither_matrix_row_t;
+
 typedef struct dither_channel
 {
   unsigned randomizer;		/* With Floyd-Steinberg dithering, control */
@@ -129,6 +136,8 @@ typedef struct dither_channel
 
   stp_dither_matrix_impl_t pick;
   stp_dither_matrix_impl_t dithermat;
+  stpi_dither_matrix_row_t pick_row;
+  stpi_dither_matrix_row_t dithermat_row;
   int row_ends[2];
   unsigned char *ptr;
   void *aux_data;		/* aux_freefunc for dither should free this */
@@ -163,6 +172,7 @@ typedef struct dither
 
   int finalized;		/* When dither is first called, calculate
 				 * some things */
+  int threads;			/* Threads to use, where supported */
 
   stp_dither_matrix_impl_t dither_matrix;
   stpi_dither_channel_t *channel;
@@ -194,6 +204,12 @@ extern int stpi_dither_translate_channel(stp_vars_t *v, unsigned channel,
 					 unsigned subchannel);
 extern void stpi_dither_channel_destroy(stpi_dither_channel_t *channel);
 extern void stpi_dither_finalize(stp_vars_t *v);
+extern void stpi_dither_ed_finalize(stpi_dither_t *d);
+extern void
+stpi_dither_matrix_set_row_width(const stp_dither_matrix_impl_t *mat,
+				 stpi_dither_matrix_row_t *row, int width);
+extern void stpi_dither_matrix_fill_row(const stp_dither_matrix_impl_t *mat,
+					stpi_dither_matrix_row_t *row);
 extern int *stpi_dither_get_errline(stpi_dither_t *d, int row, int color);
 
 
@@ -100,6 +100,8 @@ stpi_dither_channel_destroy(stpi_dither_channel_t *channel)
   STP_SAFE_FREE(channel->ranges);
   stp_dither_matrix_destroy(&(channel->pick));
   stp_dither_matrix_destroy(&(channel->dithermat));
+  STP_SAFE_FREE(channel->pick_row.v);
+  STP_SAFE_FREE(channel->dithermat_row.v);
 }  
 
 static void
@@ -177,7 +179,13 @@ stpi_dither_finalize(stp_vars_t *v)
 				   x_n * (i % rc), y_n * (i / rc));
 	  stp_dither_matrix_clone(&(d->dither_matrix), &(dc->pick),
 				   x_n * (i % rc), y_n * (i / rc));
+	  stpi_dither_matrix_set_row_width(&(dc->dithermat),
+					   &(dc->dithermat_row), d->dst_width);
+	  stpi_dither_matrix_set_row_width(&(dc->pick), &(dc->pick_row),
+					   d->dst_width);
 	}
+      if (d->ditherfunc == stpi_dither_ed)
+	stpi_dither_ed_finalize(d);
       d->finalized = 1;
     }
 }
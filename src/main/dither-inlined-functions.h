@@ -74,6 +74,19 @@ ditherpoint(const stpi_dither_t *d, stp_dither_matrix_impl_t *mat, int x)
   return mat->matrix[mat->index];
 }
 
+/*
+ * A channel's matrix may have its current row laid out across the line,
+ * filled in by stp_dither_internal when the line is started.
+ */
+static inline unsigned
+ditherpoint_row(const stpi_dither_t *d, stp_dither_matrix_impl_t *mat,
+		const stpi_dither_matrix_row_t *row, int x)
+{
+  if ((unsigned) x < row->width)
+    return row->v[x];
+  return ditherpoint(d, mat, x);
+}
+
 static inline void
 set_row_ends(stpi_dither_channel_t *dc, int x)
 {
@@ -107,6 +107,13 @@ static const stp_parameter_t dither_parameters[] =
     STP_PARAMETER_TYPE_STRING_LIST, STP_PARAMETER_CLASS_OUTPUT,
     STP_PARAMETER_LEVEL_ADVANCED, 1, 1, STP_CHANNEL_NONE, 1, 0
   },
+  {
+    "DitherThreads", N_("Dither Threads"), "Color=No,Category=Screening Adjustment",
+    N_("Number of threads to use for Hybrid Floyd-Steinberg and "
+       "Adaptive Hybrid dithering of wide images"),
+    STP_PARAMETER_TYPE_INT, STP_PARAMETER_CLASS_OUTPUT,
+    STP_PARAMETER_LEVEL_ADVANCED4, 0, 1, STP_CHANNEL_NONE, 1, 0
+  },
 };
 
 static const int dither_parameter_count =
@@ -152,6 +159,13 @@ stp_dither_describe_parameter(const stp_vars_t *v, const char *name,
       description->deflt.str =
 	stp_string_list_param(description->bounds.str, 0)->name;
     }
+  else if (strcmp(name, "DitherThreads") == 0)
+    {
+      stp_fill_parameter_settings(description, &(dither_parameters[2]));
+      description->bounds.integer.upper = 16;
+      description->bounds.integer.lower = 1;
+      description->deflt.integer = 1;
+    }
   else
     return;
 }
@@ -367,6 +381,9 @@ stp_dither_init(stp_vars_t *v, stp_image_t *image, int out_width,
     }
   d->ditherfunc = stpi_set_dither_function(v);
   d->adaptive_limit = .75 * 65535;
+  d->threads = 1;
+  if (stp_check_int_parameter(v, "DitherThreads", STP_PARAMETER_ACTIVE))
+    d->threads = stp_get_int_parameter(v, "DitherThreads");
 
   /*
    * For hybrid EvenTone we want to use the good matrix.  For regular
@@ -393,12 +410,11 @@ stp_dither_init(stp_vars_t *v, stp_image_t *image, int out_width,
     }
   else
     {
-      stp_array_t *array =
-	stp_find_standard_dither_array(d->y_aspect, d->x_aspect);
+      const stp_dither_matrix_generic_t *matrix =
+	stp_find_standard_dither_matrix(d->y_aspect, d->x_aspect);
       int transposed = d->y_aspect < d->x_aspect ? 1 : 0;
-      STPI_ASSERT(array, v);
-      stp_dither_set_matrix_from_dither_array(v, array, transposed);
-      stp_array_destroy(array);
+      STPI_ASSERT(matrix, v);
+      stp_dither_set_matrix(v, matrix, transposed, 0, 0);
     }
 
   d->src_width = in_width;
@@ -478,6 +494,10 @@ stp_dither_internal(stp_vars_t *v, int row, const unsigned short *input,
 
       stp_dither_matrix_set_row(&(CHANNEL(d, i).dithermat), row);
       stp_dither_matrix_set_row(&(CHANNEL(d, i).pick), row);
+      stpi_dither_matrix_fill_row(&(CHANNEL(d, i).dithermat),
+				  &(CHANNEL(d, i).dithermat_row));
+      stpi_dither_matrix_fill_row(&(CHANNEL(d, i).pick),
+				  &(CHANNEL(d, i).pick_row));
     }
   d->ptr_offset = 0;
   (d->ditherfunc)(v, row, input, duplicate_line, zero_mask, mask);
@@ -41,11 +41,23 @@ typedef struct {
   unsigned short *lut;
 } stpi_new_ordered_t;
 
+/*
+ * For each input value, the bits to print at the top and bottom of the
+ * range it falls into, and where in the range it lies.  A pixel gets
+ * upper_bits if rangepoint is at least its dither matrix value.
+ */
+typedef struct {
+  unsigned rangepoint;
+  unsigned short lower_bits;
+  unsigned short upper_bits;
+} stpi_ordered_point_t;
+
 typedef struct {
   unsigned short shift;
   unsigned short mask;
   unsigned short x_mask;
   stpi_new_ordered_t *ord_new;
+  stpi_ordered_point_t *points;
 } stpi_ordered_t;
 
 static int
@@ -61,6 +73,81 @@ compare_channels(const stpi_dither_channel_t *dc1,
   return 1;
 }
 
+static int
+compare_ranges(const stpi_dither_channel_t *dc1,
+	       const stpi_dither_channel_t *dc2)
+{
+  int i;
+  if (dc1->nlevels != dc2->nlevels)
+    return 0;
+  for (i = 0; i < dc1->nlevels; i++)
+    {
+      const stpi_dither_segment_t *dd1 = &(dc1->ranges[i]);
+      const stpi_dither_segment_t *dd2 = &(dc2->ranges[i]);
+      if (dd1->lower->value != dd2->lower->value ||
+	  dd1->upper->value != dd2->upper->value ||
+	  dd1->lower->bits != dd2->lower->bits ||
+	  dd1->upper->bits != dd2->upper->bits ||
+	  dd1->value_span != dd2->value_span)
+	return 0;
+    }
+  return 1;
+}
+
+/*
+ * Lay down all of the bits in the pixel.  bits must be non-zero.
+ */
+static inline void
+set_pixel_bits(unsigned char *tptr, unsigned bits, unsigned char bit,
+	       int length)
+{
+  do
+    {
+      tptr[0] |= bit & -(bits & 1);
+      bits >>= 1;
+      tptr += length;
+    }
+  while (bits);
+}
+
+/*
+ * Precompute, for every input value, the range search and scaling that
+ * print_color_ordered would otherwise do for every pixel.
+ */
+static void
+init_dither_channel_points(stpi_dither_channel_t *dc)
+{
+  stpi_ordered_point_t *points =
+    stp_malloc(sizeof(stpi_ordered_point_t) * 65536);
+  int levels = dc->nlevels - 1;
+  unsigned val;
+  int i;
+  ((stpi_ordered_t *) (dc->aux_data))->points = points;
+  for (val = 0; val < 65536; val++)
+    {
+      stpi_ordered_point_t *point = &(points[val]);
+      point->rangepoint = 0;
+      point->lower_bits = 0;
+      point->upper_bits = 0;
+      for (i = levels; i >= 0; i--)
+	{
+	  const stpi_dither_segment_t *dd = &(dc->ranges[i]);
+	  if (val > dd->lower->value)
+	    {
+	      unsigned rangepoint = val - dd->lower->value;
+	      if (dd->value_span == 0)
+		rangepoint = 65535;
+	      else if (dd->value_span < 65535)
+		rangepoint = rangepoint * 65535 / dd->value_span;
+	      point->rangepoint = rangepoint;
+	      point->lower_bits = dd->lower->bits;
+	      point->upper_bits = dd->upper->bits;
+	      break;
+	    }
+	}
+    }
+}
+
 const static double dp_fraction = 0.5;
 
 static void
@@ -169,40 +256,31 @@ print_color_ordered_new(const stpi_dither_t *d, stpi_dither_channel_t *dc,
 			int val, int x, int y, unsigned char bit, int length)
 {
   int i;
-  int j;
+  int count = 0;
   unsigned bits;
   int levels = dc->nlevels - 1;
-  unsigned dpoint = ditherpoint(d, &(dc->dithermat), x);
+  unsigned dpoint =
+    ditherpoint_row(d, &(dc->dithermat), &(dc->dithermat_row), x);
   const stpi_ordered_t *o = (const stpi_ordered_t *) dc->aux_data;
   const stpi_new_ordered_t *ord = (const stpi_new_ordered_t *) o->ord_new;
-  unsigned short swhere = (unsigned short) val;
-  unsigned short *where = ord ? ord->lut + (val * levels) : &swhere;
+  const unsigned short *where;
+  if (!ord)
+    return;
   /*
-   * Look for the appropriate range into which the input value falls.
+   * The thresholds are cumulative, so they never increase with the
+   * range index, and the range into which the input value falls is
+   * the last one whose threshold is above the dither point.
    */
-  for (i = levels - 1; i >= 0; i--)
+  where = ord->lut + (val * levels);
+  for (i = 0; i < levels; i++)
+    count += dpoint < where[i];
+  if (count == 0)
+    return;
+  bits = dc->ranges[count - 1].upper->bits;
+  if (bits)
     {
-      if (dpoint < where[i])
-	{
-	  stpi_dither_segment_t *dd = &(dc->ranges[i]);
-	  bits = dd->upper->bits;
-	  if (bits)
-	    {
-	      unsigned char *tptr = dc->ptr + d->ptr_offset;
-
-	      /*
-	       * Lay down all of the bits in the pixel.
-	       */
-	      set_row_ends(dc, x);
-	      for (j = 1; j <= bits; j += j, tptr += length)
-		{
-		  if (j & bits)
-		    tptr[0] |= bit;
-		}
-
-	    }
-	  return;
-	}
+      set_row_ends(dc, x);
+      set_pixel_bits(dc->ptr + d->ptr_offset, bits, bit, length);
     }
 }
 
@@ -210,50 +288,18 @@ static inline void
 print_color_ordered(const stpi_dither_t *d, stpi_dither_channel_t *dc, int val,
 		    int x, int y, unsigned char bit, int length)
 {
-  int i;
-  int j;
-  unsigned bits;
-  int levels = dc->nlevels - 1;
+  const stpi_ordered_t *o = (const stpi_ordered_t *) dc->aux_data;
+  const stpi_ordered_point_t *point = &(o->points[val]);
+  unsigned bits = point->upper_bits;
 
-  /*
-   * Look for the appropriate range into which the input value falls.
-   */
-  for (i = levels; i >= 0; i--)
+  if (point->lower_bits != bits &&
+      point->rangepoint <
+      ditherpoint_row(d, &(dc->dithermat), &(dc->dithermat_row), x))
+    bits = point->lower_bits;
+  if (bits)
     {
-      stpi_dither_segment_t *dd = &(dc->ranges[i]);
-
-      if (val > dd->lower->value)
-	{
-	  /*
-	   * Where are we within the range.
-	   */
-
-	  unsigned rangepoint = val - dd->lower->value;
-	  if (dd->value_span < 65535)
-	    rangepoint = rangepoint * 65535 / dd->value_span;
-
-	  if (rangepoint >= ditherpoint(d, &(dc->dithermat), x))
-	    bits = dd->upper->bits;
-	  else
-	    bits = dd->lower->bits;
-
-	  if (bits)
-	    {
-	      unsigned char *tptr = dc->ptr + d->ptr_offset;
-
-	      /*
-	       * Lay down all of the bits in the pixel.
-	       */
-	      set_row_ends(dc, x);
-	      for (j = 1; j <= bits; j += j, tptr += length)
-		{
-		  if (j & bits)
-		    tptr[0] |= bit;
-		}
-
-	    }
-	  return;
-	}
+      set_row_ends(dc, x);
+      set_pixel_bits(dc->ptr + d->ptr_offset, bits, bit, length);
     }
 }
 
@@ -281,6 +327,8 @@ free_dither_ordered(stpi_dither_t *d)
 		stp_free(no->lut);
 	      stp_free(no);
 	    }
+	  if (ord->points && (i == 0 || ord->points != o0->points))
+	    stp_free(ord->points);
 	  stp_free(dc->aux_data);
 	  dc->aux_data = NULL;
 	}
@@ -302,6 +350,10 @@ init_dither_ordered(stpi_dither_t *d, stp_vars_t *v)
       dc->aux_data = stp_malloc(sizeof(stpi_ordered_t));
       s = (stpi_ordered_t *) dc->aux_data;
       s->ord_new = NULL;
+      if (i == 0 || !compare_ranges(&CHANNEL(d, 0), dc))
+	init_dither_channel_points(dc);
+      else
+	s->points = ((stpi_ordered_t *) (CHANNEL(d, 0).aux_data))->points;
       if (d->stpi_dither_type & D_ORDERED_SEGMENTED)
 	{
 	  s->shift = 16 - dc->signif_bits;
@@ -365,8 +417,7 @@ stpi_dither_ordered(stp_vars_t *v,
       if (dc->nlevels != 1 || dc->ranges[0].upper->bits != 1)
 	one_bit_only = 0;
     }
-  if (! one_bit_only && ! d->aux_data &&
-      (d->stpi_dither_type & (D_ORDERED_SEGMENTED | D_ORDERED_NEW)))
+  if (! one_bit_only && ! d->aux_data)
     init_dither_ordered(d, v);
 
   if (one_bit_only)
@@ -378,7 +429,9 @@ stpi_dither_ordered(stp_vars_t *v,
 	      for (i = 0; i < CHANNEL_COUNT(d); i++)
 		{
 		  if (raw[i] &&
-		      raw[i] >= ditherpoint(d, &(CHANNEL(d, i).dithermat), x))
+		      raw[i] >= ditherpoint_row(d, &(CHANNEL(d, i).dithermat),
+						&(CHANNEL(d, i).dithermat_row),
+						x))
 		    {
 		      set_row_ends(&(CHANNEL(d, i)), x);
 		      CHANNEL(d, i).ptr[d->ptr_offset] |= bit;
@@ -406,16 +459,12 @@ stpi_dither_ordered(stp_vars_t *v,
 		  if (bits)
 		    {
 		      if (val &&
-			  val >= ditherpoint(d, &(CHANNEL(d, i).dithermat), x))
+			  val >= ditherpoint_row(d, &(dc->dithermat),
+						 &(dc->dithermat_row), x))
 			{
-			  int j;
-			  unsigned char *tptr = dc->ptr + d->ptr_offset;
 			  set_row_ends(dc, x);
-			  for (j = 1; j <= bits; j += j, tptr += length)
-			    {
-			      if (j & bits)
-				tptr[0] |= bit;
-			    }
+			  set_pixel_bits(dc->ptr + d->ptr_offset, bits, bit,
+					 length);
 			}
 		    }
 		  else if (CHANNEL(d, i).ptr && val)
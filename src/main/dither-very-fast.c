@@ -40,7 +40,8 @@ print_color_very_fast(const stpi_dither_t *d, stpi_dither_channel_t *dc,
 		      unsigned bits, int length)
 {
   int j;
-  if (bits && val >= ditherpoint(d, &(dc->dithermat), x))
+  if (bits &&
+      val >= ditherpoint_row(d, &(dc->dithermat), &(dc->dithermat_row), x))
     {
       unsigned char *tptr = dc->ptr + d->ptr_offset;
 
@@ -103,7 +104,9 @@ stpi_dither_very_fast(stp_vars_t *v,
 	      for (i = 0; i < CHANNEL_COUNT(d); i++)
 		{
 		  if (raw[i] &&
-		      raw[i] >= ditherpoint(d, &(CHANNEL(d, i).dithermat), x))
+		      raw[i] >= ditherpoint_row(d, &(CHANNEL(d, i).dithermat),
+						&(CHANNEL(d, i).dithermat_row),
+						x))
 		    {
 		      set_row_ends(&(CHANNEL(d, i)), x);
 		      CHANNEL(d, i).ptr[d->ptr_offset] |= bit;
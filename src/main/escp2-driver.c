@@ -33,6 +33,9 @@
 #include <gutenprint/gutenprint-intl-internal.h>
 #include "gutenprint-internal.h"
 #include <string.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #include "print-escp2.h"
 
 #ifdef __GNUC__
@@ -644,6 +647,136 @@ stpi_escp2_deinit_printer(stp_vars_t *v)
     }
 }
 
+/*
+ * Printers with split channels have each line compressed as it's sent.
+ * The channels of a pass are independent of each other, so with
+ * CompressionThreads > 1 all of the active channels are compressed up
+ * front, each into its own buffer and in the order the lines will be
+ * sent, and the flush then just copies the buffers out.
+ */
+typedef struct
+{
+  stp_vars_t *v;
+  escp2_privdata_t *pd;
+  const stp_lineactive_t *lineactive;
+  const stp_linebufs_t *bufs;
+  const stp_linecount_t *linecount;
+  int first_channel;		/* Compress channels first_channel, */
+  int channel_step;		/* first_channel + channel_step, ... */
+#ifdef HAVE_PTHREAD_H
+  pthread_t thread;
+#endif
+} split_compress_t;
+
+static void
+compress_split_channels(const split_compress_t *sc)
+{
+  escp2_privdata_t *pd = sc->pd;
+  int count = pd->split_channel_count;
+  int width = pd->split_channel_width;
+  int j, k, l;
+
+  for (j = sc->first_channel; j < pd->channels_in_use; j += sc->channel_step)
+    {
+      unsigned char *comp_ptr = pd->split_comp_bufs[j];
+      if (sc->lineactive->v[j] <= 0)
+	continue;
+      for (k = 0; k < count; k++)
+	{
+	  int lc = ((sc->linecount->v[j] + (count - k - 1)) / count);
+	  int base = (pd->nozzle_start + k) % count;
+	  unsigned char *start = comp_ptr;
+	  for (l = 0; l < lc; l++)
+	    {
+	      unsigned long offset = ((l * count) + base) * width;
+	      stp_pack_tiff(sc->v, sc->bufs->v[j] + offset, width,
+			    comp_ptr, &comp_ptr, NULL, NULL);
+	    }
+	  pd->split_comp_lens[j * count + k] = comp_ptr - start;
+	}
+    }
+}
+
+#ifdef HAVE_PTHREAD_H
+static void *
+compress_split_channels_thread(void *arg)
+{
+  compress_split_channels((const split_compress_t *) arg);
+  return NULL;
+}
+
+/*
+ * Returns 1 if the pass has been compressed ahead of time.
+ */
+static int
+precompress_split_channels(stp_vars_t *v, int passno)
+{
+  escp2_privdata_t *pd = get_privdata(v);
+  const stp_lineactive_t *lineactive = stp_get_lineactive_by_pass(v, passno);
+  const stp_linecount_t *linecount = stp_get_linecount_by_pass(v, passno);
+  size_t line_size =
+    stp_compute_tiff_linewidth(v, pd->split_channel_width);
+  int nthreads = pd->compression_threads;
+  int active = 0;
+  split_compress_t *threads;
+  int started;
+  int i;
+
+  if (nthreads <= 1 || (stp_get_debug_level() & STP_DBG_NO_COMPRESSION))
+    return 0;
+  for (i = 0; i < pd->channels_in_use; i++)
+    if (lineactive->v[i] > 0)
+      active++;
+  if (active <= 1)
+    return 0;
+  if (nthreads > active)
+    nthreads = active;
+
+  if (!pd->split_comp_bufs)
+    {
+      pd->split_comp_bufs =
+	stp_zalloc(sizeof(unsigned char *) * pd->channels_in_use);
+      pd->split_comp_sizes = stp_zalloc(sizeof(size_t) * pd->channels_in_use);
+      pd->split_comp_lens = stp_zalloc(sizeof(size_t) * pd->channels_in_use *
+				       pd->split_channel_count);
+    }
+  for (i = 0; i < pd->channels_in_use; i++)
+    {
+      size_t needed = line_size * linecount->v[i];
+      if (lineactive->v[i] > 0 && needed > pd->split_comp_sizes[i])
+	{
+	  STP_SAFE_FREE(pd->split_comp_bufs[i]);
+	  pd->split_comp_bufs[i] = stp_malloc(needed);
+	  pd->split_comp_sizes[i] = needed;
+	}
+    }
+
+  threads = stp_zalloc(sizeof(split_compress_t) * nthreads);
+  for (i = 0; i < nthreads; i++)
+    {
+      threads[i].v = v;
+      threads[i].pd = pd;
+      threads[i].lineactive = lineactive;
+      threads[i].bufs = stp_get_linebases_by_pass(v, passno);
+      threads[i].linecount = linecount;
+      threads[i].first_channel = i;
+      threads[i].channel_step = nthreads;
+    }
+  for (started = 1; started < nthreads; started++)
+    if (pthread_create(&(threads[started].thread), NULL,
+		       compress_split_channels_thread,
+		       &(threads[started])) != 0)
+      break;
+  for (i = started; i < nthreads; i++)
+    compress_split_channels(&(threads[i]));
+  compress_split_channels(&(threads[0]));
+  for (i = 1; i < started; i++)
+    pthread_join(threads[i].thread, NULL);
+  stp_free(threads);
+  return 1;
+}
+#endif
+
 void
 stpi_escp2_flush_pass(stp_vars_t *v, int passno, int vertical_subpass)
 {
@@ -656,7 +789,12 @@ stpi_escp2_flush_pass(stp_vars_t *v, int passno, int vertical_subpass)
   stp_linecount_t *linecount = stp_get_linecount_by_pass(v, passno);
   int minlines = pd->min_nozzles;
   int nozzle_start = pd->nozzle_start;
+  int precompressed = 0;
 
+#ifdef HAVE_PTHREAD_H
+  if (pd->split_channels)
+    precompressed = precompress_split_channels(v, passno);
+#endif
   for (j = 0; j < pd->channels_in_use; j++)
     {
       if (lineactive->v[j] > 0)
@@ -673,12 +811,15 @@ stpi_escp2_flush_pass(stp_vars_t *v, int passno, int vertical_subpass)
 	  if (pd->split_channels)
 	    {
 	      int sc = pd->split_channel_count;
+	      const unsigned char *comp_data = NULL;
 	      int k, l;
 	      int minlines_lo, nozzle_start_lo;
 	      minlines /= sc;
 	      nozzle_start /= sc;
 	      minlines_lo = pd->min_nozzles - (minlines * sc);
 	      nozzle_start_lo = pd->nozzle_start - (nozzle_start * sc);
+	      if (precompressed)
+		comp_data = pd->split_comp_bufs[j];
 	      for (k = 0; k < sc; k++)
 		{
 		  int ml = minlines + (k < minlines_lo ? 1 : 0);
@@ -700,27 +841,33 @@ stpi_escp2_flush_pass(stp_vars_t *v, int passno, int vertical_subpass)
 					 lc + extralines + ns);
 		      if (ns > 0)
 			send_extra_data(v, ns);
-		      for (l = 0; l < lc; l++)
-			{
-			  int sp = (l * sc) + base;
-			  unsigned long offset = sp * pd->split_channel_width;
-			  if (!(stp_get_debug_level() & STP_DBG_NO_COMPRESSION))
-			    {
-			      unsigned char *comp_ptr;
-			      stp_pack_tiff(v, bufs->v[j] + offset,
-					    pd->split_channel_width,
-					    pd->comp_buf, &comp_ptr, NULL, NULL);
-			      stp_zfwrite((const char *) pd->comp_buf,
-					  comp_ptr - pd->comp_buf, 1, v);
-			    }
-			  else
-			    stp_zfwrite((const char *) bufs->v[j] + offset,
-					pd->split_channel_width, 1, v);
-			}
+		      if (precompressed)
+			stp_zfwrite((const char *) comp_data,
+				    pd->split_comp_lens[j * sc + k], 1, v);
+		      else
+			for (l = 0; l < lc; l++)
+			  {
+			    int sp = (l * sc) + base;
+			    unsigned long offset = sp * pd->split_channel_width;
+			    if (!(stp_get_debug_level() & STP_DBG_NO_COMPRESSION))
+			      {
+				unsigned char *comp_ptr;
+				stp_pack_tiff(v, bufs->v[j] + offset,
+					      pd->split_channel_width,
+					      pd->comp_buf, &comp_ptr, NULL, NULL);
+				stp_zfwrite((const char *) pd->comp_buf,
+					    comp_ptr - pd->comp_buf, 1, v);
+			      }
+			    else
+			      stp_zfwrite((const char *) bufs->v[j] + offset,
+					  pd->split_channel_width, 1, v);
+			  }
 		      if (extralines > 0)
 			send_extra_data(v, extralines);
 		      stp_send_command(v, "\r", "");
 		    }
+		  if (precompressed)
+		    comp_data += pd->split_comp_lens[j * sc + k];
 		}
 	    }
 	  else
@@ -748,6 +895,7 @@ stpi_escp2_flush_pass(stp_vars_t *v, int passno, int vertical_subpass)
       lineoffs->v[j] = 0;
       linecount->v[j] = 0;
     }
+  stp_flush_output(v);
 }
 
 void
@@ -85,7 +85,7 @@ stp_escp2_load_printer_weaves(const stp_vars_t *v, const char *name)
       const char *dn = (const char *) stp_list_item_get_data(item);
       char *ffn = stpi_path_merge(dn, name);
       stp_mxml_node_t *weaves =
-	stp_mxmlLoadFromFile(NULL, ffn, STP_MXML_NO_CALLBACK);
+	stp_xml_load_file(ffn);
       stp_free(ffn);
       if (weaves)
 	{
@@ -200,7 +200,7 @@ stp_escp2_load_resolutions(const stp_vars_t *v, const char *name)
       const char *dn = (const char *) stp_list_item_get_data(item);
       char *ffn = stpi_path_merge(dn, name);
       stp_mxml_node_t *resolutions =
-	stp_mxmlLoadFromFile(NULL, ffn, STP_MXML_NO_CALLBACK);
+	stp_xml_load_file(ffn);
       stp_free(ffn);
       if (resolutions)
 	{
@@ -302,7 +302,7 @@ stp_escp2_load_quality_presets(const stp_vars_t *v, const char *name)
       const char *dn = (const char *) stp_list_item_get_data(item);
       char *ffn = stpi_path_merge(dn, name);
       stp_mxml_node_t *qualities =
-	stp_mxmlLoadFromFile(NULL, ffn, STP_MXML_NO_CALLBACK);
+	stp_xml_load_file(ffn);
       stp_free(ffn);
       if (qualities)
 	{
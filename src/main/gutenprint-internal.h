@@ -42,6 +42,7 @@ extern "C" {
 #endif
 
 #include <gutenprint/gutenprint-module.h>
+#include <gutenprint/curve-cache.h>
 
 /**
  * Utility functions (internal).
@@ -54,9 +55,65 @@ extern void stpi_init_paper(void);
 extern void stpi_init_dither(void);
 extern void stpi_init_printer(void);
 extern void stpi_vars_print_error(const stp_vars_t *v, const char *prefix);
+
+/*
+ * Output written through stp_zfwrite and friends is collected here
+ * and handed to the outfunc in large pieces.
+ */
+typedef struct
+{
+  char *data;			/* Allocated on first use */
+  size_t size;			/* 0 means write straight through */
+  size_t bytes;			/* Bytes pending */
+} stpi_outbuf_t;
+
+extern stpi_outbuf_t *stpi_vars_get_outbuf(const stp_vars_t *v);
+
+extern size_t stpi_channel_get_output_size(const stp_vars_t *v);
+
+/*
+ * Raw, host-specific form of a sampled curve, used by the LUT cache.
+ */
+extern int stpi_curve_cache_write(FILE *fp, stp_cached_curve_t *cache);
+extern int stpi_curve_cache_read(FILE *fp, stp_cached_curve_t *cache);
+
+/*
+ * Acquire and convert count consecutive rows starting at row, copying
+ * the channel output of each row to out in turn.  zero_masks, if not
+ * NULL, receives one mask per row.  This is equivalent to calling
+ * stp_color_get_row for each row, but lets the traditional color
+ * module do its per-call setup once for several rows.  Return value is
+ * status; zero is success.
+ */
+extern int stpi_color_get_rows(stp_vars_t *v, stp_image_t *image,
+			       int row, int count, unsigned short *out,
+			       unsigned *zero_masks);
+
+/*
+ * The traditional color module hooks its multi-row conversion in here,
+ * since stp_colorfuncs_t has no room for it.  Passing NULL removes it.
+ */
+typedef int (*stpi_color_get_rows_func_t)(stp_vars_t *v, stp_image_t *image,
+					  int row, int count,
+					  unsigned short *out,
+					  unsigned *zero_masks);
+extern void
+stpi_color_set_traditional_get_rows(const stp_colorfuncs_t *colorfuncs,
+				    stpi_color_get_rows_func_t get_rows);
+
 #define BUFFER_FLAG_FLIP_X	0x1
 #define BUFFER_FLAG_FLIP_Y	0x2
 extern stp_image_t* stpi_buffer_image(stp_image_t* image, unsigned int flags);
+extern stp_image_row_ptr_func_t
+stpi_buffered_image_row_ptr_func(const stp_image_t *image);
+extern stp_image_status_t
+stpi_image_get_row_ptr(const stp_vars_t *v, stp_image_t *image,
+		       unsigned char *buffer, const unsigned char **data,
+		       size_t byte_limit, int row);
+#if defined(HAVE_EMMINTRIN_H) && defined(__GNUC__) && \
+  (defined(__i386__) || defined(__x86_64__))
+extern int stpi_cpu_has_sse2(void);
+#endif
 
 #define STPI_ASSERT(x,v)						\
 do									\
@@ -60,6 +60,33 @@ stp_image_get_row(stp_image_t *image, unsigned char *data,
   return image->get_row(image, data, byte_limit, row);
 }
 
+/*
+ * Return the row in *data, copying it into buffer only if the image
+ * cannot provide a pointer to its own copy.  The row pointer function
+ * in v belongs to the application's image, so it is not used for an
+ * image that the driver has wrapped with stpi_buffer_image.
+ */
+stp_image_status_t
+stpi_image_get_row_ptr(const stp_vars_t *v, stp_image_t *image,
+		       unsigned char *buffer, const unsigned char **data,
+		       size_t byte_limit, int row)
+{
+  stp_image_row_ptr_func_t get_row_ptr =
+    stpi_buffered_image_row_ptr_func(image);
+  if (!get_row_ptr)
+    get_row_ptr = stp_get_image_row_ptr_func(v);
+  if (get_row_ptr)
+    {
+      stp_image_status_t status;
+      *data = NULL;
+      status = get_row_ptr(image, data, byte_limit, row);
+      if (status != STP_IMAGE_STATUS_OK || *data)
+	return status;
+    }
+  *data = buffer;
+  return image->get_row(image, buffer, byte_limit, row);
+}
+
 const char *
 stp_image_get_appname(stp_image_t *image)
 {
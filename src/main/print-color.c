@@ -38,6 +38,15 @@
 #include <limits.h>
 #endif
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #include "color-conversion.h"
 
 #ifdef __GNUC__
@@ -61,6 +70,23 @@ static const color_correction_t color_corrections[] =
 static const int color_correction_count =
 sizeof(color_corrections) / sizeof(color_correction_t);
 
+typedef struct
+{
+  const char *name;
+  const char *text;
+  int grid_size;
+} lut_mode_t;
+
+static const lut_mode_t lut_modes[] =
+{
+  { "None",    N_("Compute Each Pixel"),             0  },
+  { "Table17", N_("Interpolated Table (17 Points)"), 17 },
+  { "Table33", N_("Interpolated Table (33 Points)"), 33 },
+};
+
+static const int lut_mode_count =
+sizeof(lut_modes) / sizeof(lut_mode_t);
+
 static const channel_param_t channel_params[] =
 {
   { CMASK_K, "BlackGamma",   "BlackCurve",   "WhiteGamma",   "WhiteCurve"   },
@@ -151,19 +177,19 @@ sizeof(raw_channel_params) / sizeof(channel_param_t);
 static const color_description_t color_descriptions[] =
 {
   { N_("Grayscale"),  1, 1, COLOR_ID_GRAY,   COLOR_BLACK,   CMASK_K,      1,
-    COLOR_CORRECTION_UNCORRECTED, &stpi_color_convert_to_gray   },
+    COLOR_CORRECTION_UNCORRECTED, &stpi_color_select_to_gray    },
   { N_("Whitescale"), 1, 1, COLOR_ID_WHITE,  COLOR_WHITE,   CMASK_K,      1,
-    COLOR_CORRECTION_UNCORRECTED, &stpi_color_convert_to_gray   },
+    COLOR_CORRECTION_UNCORRECTED, &stpi_color_select_to_gray    },
   { N_("RGB"),        1, 1, COLOR_ID_RGB,    COLOR_WHITE,   CMASK_CMY,    3,
-    COLOR_CORRECTION_ACCURATE,    &stpi_color_convert_to_color  },
+    COLOR_CORRECTION_ACCURATE,    &stpi_color_select_to_color   },
   { N_("CMY"),        1, 1, COLOR_ID_CMY,    COLOR_BLACK,   CMASK_CMY,    3,
-    COLOR_CORRECTION_ACCURATE,    &stpi_color_convert_to_color  },
+    COLOR_CORRECTION_ACCURATE,    &stpi_color_select_to_color   },
   { N_("CMYK"),       1, 0, COLOR_ID_CMYK,   COLOR_BLACK,   CMASK_CMYK,   4,
-    COLOR_CORRECTION_ACCURATE,    &stpi_color_convert_to_kcmy   },
+    COLOR_CORRECTION_ACCURATE,    &stpi_color_select_to_kcmy    },
   { N_("KCMY"),       1, 1, COLOR_ID_KCMY,   COLOR_BLACK,   CMASK_CMYK,   4,
-    COLOR_CORRECTION_ACCURATE,    &stpi_color_convert_to_kcmy   },
+    COLOR_CORRECTION_ACCURATE,    &stpi_color_select_to_kcmy    },
   { N_("Raw"),        1, 1, COLOR_ID_RAW,    COLOR_UNKNOWN, 0,           -1,
-    COLOR_CORRECTION_RAW,         &stpi_color_convert_raw       },
+    COLOR_CORRECTION_RAW,         &stpi_color_select_raw        },
 };
 
 static const int color_description_count =
@@ -480,6 +506,15 @@ static const float_param_t float_parameters[] =
   RAW_GAMMA_CHANNEL(61),
   RAW_GAMMA_CHANNEL(62),
   RAW_GAMMA_CHANNEL(63),
+  {
+    {
+      "LUTMode", N_("Color Table Mode"), "Color=Yes,Category=Advanced Output Control",
+      N_("Precompute color correction into an interpolated table "
+	 "rather than computing it for each pixel"),
+      STP_PARAMETER_TYPE_STRING_LIST, STP_PARAMETER_CLASS_OUTPUT,
+      STP_PARAMETER_LEVEL_ADVANCED4, 0, 1, -1, 1, 0
+    }, 0.0, 0.0, 0.0, CMASK_CMY | CMASK_RGB, 1, -1
+  },
   {
     {
       "LUTDumpFile", N_("LUT dump file"), N_("Advanced Output Control"),
@@ -730,6 +765,19 @@ get_color_correction(const char *name)
   return NULL;
 }
 
+static const lut_mode_t *
+get_lut_mode(const char *name)
+{
+  int i;
+  if (name)
+    for (i = 0; i < lut_mode_count; i++)
+      {
+	if (strcmp(name, lut_modes[i].name) == 0)
+	  return &(lut_modes[i]);
+      }
+  return NULL;
+}
+
 static const color_correction_t *
 get_color_correction_by_tag(color_correction_enum_t correction)
 {
@@ -753,25 +801,179 @@ initialize_channels(stp_vars_t *v, stp_image_t *image)
   lut->channels_are_initialized = 1;
 }
 
+/*
+ * Identical input rows (blank bands, flat fills, images scaled up by
+ * repeating rows) always convert to the same channel data, so the
+ * results of the last few rows converted are kept, keyed by a hash of
+ * the input row.  A hit restores the channel input as well as the
+ * output, since some drivers rewrite the input in place.
+ */
+static unsigned
+row_hash(const unsigned char *data, size_t size)
+{
+  unsigned hash = 2166136261u;
+  size_t i;
+  for (i = 0; i + sizeof(unsigned) <= size; i += sizeof(unsigned))
+    {
+      unsigned word;
+      memcpy(&word, data + i, sizeof(unsigned));
+      hash = (hash ^ word) * 16777619u;
+    }
+  for (; i < size; i++)
+    hash = (hash ^ data[i]) * 16777619u;
+  return hash;
+}
+
+static void
+free_row_cache(lut_t *lut)
+{
+  int i;
+  for (i = 0; i < ROW_CACHE_SIZE; i++)
+    {
+      row_cache_entry_t *entry = &(lut->row_cache[i]);
+      STP_SAFE_FREE(entry->in);
+      STP_SAFE_FREE(entry->channel_in);
+      STP_SAFE_FREE(entry->channel_out);
+      entry->valid = 0;
+    }
+}
+
 static int
 stpi_color_traditional_get_row(stp_vars_t *v,
 			       stp_image_t *image,
 			       int row,
 			       unsigned *zero_mask)
 {
-  const lut_t *lut = (const lut_t *)(stp_get_component_data(v, "Color"));
+  lut_t *lut = (lut_t *)(stp_get_component_data(v, "Color"));
+  size_t in_size =
+    lut->image_width * lut->in_channels * lut->channel_depth / 8;
+  size_t convert_size =
+    lut->image_width * lut->out_channels * sizeof(unsigned short);
+  size_t out_size;
+  const unsigned char *in;
+  unsigned short *channel_in;
+  unsigned short *channel_out;
+  row_cache_entry_t *entry;
+  unsigned hash;
   unsigned zero;
-  if (stp_image_get_row(image, lut->in_data,
-			lut->image_width * lut->in_channels * lut->channel_depth / 8, row)
+  int i;
+  if (stpi_image_get_row_ptr(v, image, lut->in_data, &in, in_size, row)
       != STP_IMAGE_STATUS_OK)
     return 2;
   if (!lut->channels_are_initialized)
     initialize_channels(v, image);
-  zero = (lut->output_color_description->conversion_function)
-    (v, lut->in_data, stp_channel_get_input(v));
+  if (!lut->prepared.convert)
+    stpi_color_prepare_conversion(v, lut);
+  channel_in = stp_channel_get_input(v);
+  channel_out = stp_channel_get_output(v);
+  out_size = stpi_channel_get_output_size(v);
+
+  hash = row_hash(in, in_size);
+  for (i = 0; i < ROW_CACHE_SIZE; i++)
+    {
+      entry = &(lut->row_cache[i]);
+      if (entry->valid && entry->hash == hash &&
+	  memcmp(entry->in, in, in_size) == 0)
+	{
+	  if (entry->channel_in)
+	    memcpy(channel_in, entry->channel_in, convert_size);
+	  memcpy(channel_out, entry->channel_out, out_size);
+	  if (zero_mask)
+	    *zero_mask = entry->zero_mask;
+	  return 0;
+	}
+    }
+
+  (void) (lut->prepared.convert)(lut, in, channel_in);
+  stp_channel_convert(v, &zero);
   if (zero_mask)
     *zero_mask = zero;
-  stp_channel_convert(v, zero_mask);
+
+  entry = &(lut->row_cache[lut->row_cache_next]);
+  lut->row_cache_next = (lut->row_cache_next + 1) % ROW_CACHE_SIZE;
+  if (!entry->in)
+    {
+      entry->in = stp_malloc(in_size);
+      if (channel_in != channel_out)
+	entry->channel_in = stp_malloc(convert_size);
+      entry->channel_out = stp_malloc(out_size);
+    }
+  memcpy(entry->in, in, in_size);
+  if (entry->channel_in)
+    memcpy(entry->channel_in, channel_in, convert_size);
+  memcpy(entry->channel_out, channel_out, out_size);
+  entry->hash = hash;
+  entry->zero_mask = zero;
+  entry->valid = 1;
+  return 0;
+}
+
+/*
+ * Convert a band of consecutive rows with one call to the conversion
+ * function, so that its setup is done once per band rather than once
+ * per row.  The conversion functions work pixel by pixel, so a band
+ * of rows stored contiguously can be treated as one long row.
+ */
+#define BAND_ROWS 16
+
+static int
+stpi_color_traditional_get_rows(stp_vars_t *v,
+				stp_image_t *image,
+				int row,
+				int count,
+				unsigned short *out,
+				unsigned *zero_masks)
+{
+  lut_t *lut = (lut_t *)(stp_get_component_data(v, "Color"));
+  size_t in_size =
+    lut->image_width * lut->in_channels * lut->channel_depth / 8;
+  size_t convert_size = lut->image_width * lut->out_channels;
+  if (!lut->band_in)
+    {
+      lut->band_in = stp_malloc(in_size * BAND_ROWS);
+      lut->band_out =
+	stp_malloc(convert_size * BAND_ROWS * sizeof(unsigned short));
+      /* The temporary buffers must now hold a whole band */
+      STP_SAFE_FREE(lut->gray_tmp);
+      STP_SAFE_FREE(lut->cmy_tmp);
+      lut->band_rows = BAND_ROWS;
+    }
+  while (count > 0)
+    {
+      int rows = count > BAND_ROWS ? BAND_ROWS : count;
+      size_t out_size;
+      int i;
+      for (i = 0; i < rows; i++)
+	{
+	  unsigned char *buf = lut->band_in + i * in_size;
+	  const unsigned char *in;
+	  if (stpi_image_get_row_ptr(v, image, buf, &in, in_size, row + i)
+	      != STP_IMAGE_STATUS_OK)
+	    return 2;
+	  if (in != buf)
+	    memcpy(buf, in, in_size);
+	}
+      if (!lut->channels_are_initialized)
+	initialize_channels(v, image);
+      if (!lut->prepared.convert)
+	stpi_color_prepare_conversion(v, lut);
+      lut->convert_width = lut->image_width * rows;
+      (void) (lut->prepared.convert)(lut, lut->band_in, lut->band_out);
+      lut->convert_width = lut->image_width;
+      out_size = stpi_channel_get_output_size(v);
+      for (i = 0; i < rows; i++)
+	{
+	  memcpy(stp_channel_get_input(v), lut->band_out + i * convert_size,
+		 convert_size * sizeof(unsigned short));
+	  stp_channel_convert(v, zero_masks ? &(zero_masks[i]) : NULL);
+	  memcpy(out, stp_channel_get_output(v), out_size);
+	  out += out_size / sizeof(unsigned short);
+	}
+      row += rows;
+      count -= rows;
+      if (zero_masks)
+	zero_masks += rows;
+    }
   return 0;
 }
 
@@ -792,6 +994,7 @@ allocate_lut(void)
     {
       ret->gamma_values[i] = 1.0;
     }
+  ret->band_rows = 1;
   ret->print_gamma = 1.0;
   ret->app_gamma = 1.0;
   ret->contrast = 1.0;
@@ -800,27 +1003,14 @@ allocate_lut(void)
   return ret;
 }
 
-static void *
-copy_lut(void *vlut)
+/*
+ * Copy everything that stpi_compute_lut computes.
+ */
+static void
+copy_lut_curves(lut_t *dest, const lut_t *src)
 {
-  const lut_t *src = (const lut_t *)vlut;
   int i;
-  lut_t *dest;
-  if (!src)
-    return NULL;
-  dest = allocate_lut();
-  free_channels(dest);
-
-  dest->steps = src->steps;
-  dest->channel_depth = src->channel_depth;
-  dest->image_width = src->image_width;
-  dest->in_channels = src->in_channels;
-  dest->out_channels = src->out_channels;
-  /* Don't copy channels_are_initialized */
   dest->invert_output = src->invert_output;
-  dest->input_color_description = src->input_color_description;
-  dest->output_color_description = src->output_color_description;
-  dest->color_correction = src->color_correction;
   for (i = 0; i < STP_CHANNEL_LIMIT; i++)
     {
       stp_curve_cache_copy(&(dest->channel_curves[i]), &(src->channel_curves[i]));
@@ -842,6 +1032,32 @@ copy_lut(void *vlut)
   stp_curve_cache_copy(&(dest->hue_map), &(src->hue_map));
   stp_curve_cache_copy(&(dest->lum_map), &(src->lum_map));
   stp_curve_cache_copy(&(dest->sat_map), &(src->sat_map));
+}
+
+static void *
+copy_lut(void *vlut)
+{
+  const lut_t *src = (const lut_t *)vlut;
+  lut_t *dest;
+  if (!src)
+    return NULL;
+  dest = allocate_lut();
+  free_channels(dest);
+
+  dest->steps = src->steps;
+  dest->channel_depth = src->channel_depth;
+  dest->image_width = src->image_width;
+  dest->convert_width = src->image_width;
+  dest->in_channels = src->in_channels;
+  dest->out_channels = src->out_channels;
+  /* Don't copy channels_are_initialized */
+  dest->input_color_description = src->input_color_description;
+  dest->output_color_description = src->output_color_description;
+  dest->color_correction = src->color_correction;
+  dest->rgb_grid_size = src->rgb_grid_size;
+  /* Don't copy rgb_table or prepared; they are rebuilt on demand */
+  /* Don't copy row_cache */
+  copy_lut_curves(dest, src);
   /* Don't copy gray_tmp */
   /* Don't copy cmy_tmp */
   if (src->in_data)
@@ -866,6 +1082,10 @@ free_lut(void *vlut)
   STP_SAFE_FREE(lut->gray_tmp);
   STP_SAFE_FREE(lut->cmy_tmp);
   STP_SAFE_FREE(lut->in_data);
+  STP_SAFE_FREE(lut->band_in);
+  STP_SAFE_FREE(lut->band_out);
+  STP_SAFE_FREE(lut->rgb_table);
+  free_row_cache(lut);
   memset(lut, 0, sizeof(lut_t));
   stp_free(lut);
 }
@@ -1388,6 +1608,18 @@ stpi_dump_lut_to_file(stp_vars_t *v, const char *dump_file)
     }
 }
 
+static int
+lut_uses_gcr_curve(const lut_t *lut)
+{
+  return (((lut->output_color_description->channels & CMASK_CMYK) ==
+	   CMASK_CMYK) &&
+	  (lut->color_correction->correction == COLOR_CORRECTION_DESATURATED ||
+	   lut->input_color_description->color_id == COLOR_ID_GRAY ||
+	   lut->input_color_description->color_id == COLOR_ID_WHITE ||
+	   lut->input_color_description->color_id == COLOR_ID_RGB ||
+	   lut->input_color_description->color_id == COLOR_ID_CMY));
+}
+
 static void
 stpi_compute_lut(stp_vars_t *v)
 {
@@ -1483,17 +1715,437 @@ stpi_compute_lut(stp_vars_t *v)
 	       lut->output_color_description->channels & (1 << i))
 	setup_channel(v, i, &(channel_params[i]));
     }
-  if (((lut->output_color_description->channels & CMASK_CMYK) == CMASK_CMYK) &&
-      (lut->color_correction->correction == COLOR_CORRECTION_DESATURATED ||
-       lut->input_color_description->color_id == COLOR_ID_GRAY ||
-       lut->input_color_description->color_id == COLOR_ID_WHITE ||
-       lut->input_color_description->color_id == COLOR_ID_RGB ||
-       lut->input_color_description->color_id == COLOR_ID_CMY))
+  if (lut_uses_gcr_curve(lut))
     initialize_gcr_curve(v);
   if (stp_check_file_parameter(v, "LUTDumpFile", STP_PARAMETER_ACTIVE))
     stpi_dump_lut_to_file(v, stp_get_file_parameter(v, "LUTDumpFile"));
 }
 
+/*
+ * Computing the LUT means building and resampling a dozen or so curves
+ * to 65536 points, which is the same work for every page and every job
+ * with the same color settings.  Resolved LUTs are therefore cached by
+ * a fingerprint of everything stpi_compute_lut depends on.  The most
+ * recently used ones are kept in memory, and if STP_LUT_CACHE_DIR is
+ * set they are also saved there for later processes.
+ */
+#define LUT_CACHE_SIZE 2
+#define LUT_CACHE_MAGIC "STPLUT01"
+#define LUT_CURVE_SLOTS (6 + STP_CHANNEL_LIMIT)
+
+typedef struct
+{
+  char *fingerprint;
+  lut_t *lut;
+  stp_cached_curve_t gcr_curve;
+} lut_cache_entry_t;
+
+static lut_cache_entry_t lut_cache[LUT_CACHE_SIZE];
+
+/*
+ * The cache is shared by every job in the process.  Looking up an
+ * entry, copying its curves out and inserting a new one are all done
+ * with the lock held, since an insert can free any entry.
+ */
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t lut_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LUT_CACHE_LOCK() pthread_mutex_lock(&lut_cache_lock)
+#define LUT_CACHE_UNLOCK() pthread_mutex_unlock(&lut_cache_lock)
+#else
+#define LUT_CACHE_LOCK() do { } while (0)
+#define LUT_CACHE_UNLOCK() do { } while (0)
+#endif
+
+/*
+ * The fingerprint runs to several kilobytes once curves are included,
+ * so it is built up in one growing buffer rather than with
+ * stp_catprintf, which copies the whole string on every call.
+ */
+typedef struct
+{
+  char *data;
+  size_t bytes;
+  size_t size;
+} lut_string_t;
+
+static void
+lut_string_printf(lut_string_t *s, const char *format, ...)
+{
+  for (;;)
+    {
+      va_list args;
+      size_t room = s->size - s->bytes;
+      int bytes;
+      va_start(args, format);
+      bytes = vsnprintf(s->data + s->bytes, room, format, args);
+      va_end(args);
+      if (bytes >= 0 && (size_t) bytes < room)
+	{
+	  s->bytes += bytes;
+	  return;
+	}
+      if (bytes >= 0 && s->bytes + bytes + 1 > s->size * 2)
+	s->size = s->bytes + bytes + 1;
+      else
+	s->size *= 2;
+      s->data = stp_realloc(s->data, s->size);
+    }
+}
+
+static char *
+lut_fingerprint(const stp_vars_t *v, const lut_t *lut)
+{
+  lut_string_t answer;
+  int i;
+  answer.size = 1024;
+  answer.bytes = 0;
+  answer.data = stp_malloc(answer.size);
+  lut_string_printf(&answer, "%s %u %d %s %s %s", VERSION, lut->steps,
+		    lut->out_channels, lut->input_color_description->name,
+		    lut->output_color_description->name,
+		    lut->color_correction->name);
+  for (i = 0; i < float_parameter_count; i++)
+    {
+      const char *name = float_parameters[i].param.name;
+      switch (float_parameters[i].param.p_type)
+	{
+	case STP_PARAMETER_TYPE_DOUBLE:
+	  lut_string_printf(&answer, " %s:%d", name,
+			    stp_get_float_parameter_active(v, name));
+	  if (stp_check_float_parameter(v, name, STP_PARAMETER_DEFAULTED))
+	    lut_string_printf(&answer, "=%.17g",
+			      stp_get_float_parameter(v, name));
+	  break;
+	case STP_PARAMETER_TYPE_BOOLEAN:
+	  lut_string_printf(&answer, " %s:%d", name,
+			    stp_get_boolean_parameter_active(v, name));
+	  if (stp_check_boolean_parameter(v, name, STP_PARAMETER_DEFAULTED))
+	    lut_string_printf(&answer, "=%d",
+			      stp_get_boolean_parameter(v, name));
+	  break;
+	case STP_PARAMETER_TYPE_INT:
+	  lut_string_printf(&answer, " %s:%d", name,
+			    stp_get_int_parameter_active(v, name));
+	  if (stp_check_int_parameter(v, name, STP_PARAMETER_DEFAULTED))
+	    lut_string_printf(&answer, "=%d", stp_get_int_parameter(v, name));
+	  break;
+	case STP_PARAMETER_TYPE_STRING_LIST:
+	  lut_string_printf(&answer, " %s:%d", name,
+			    stp_get_string_parameter_active(v, name));
+	  if (stp_check_string_parameter(v, name, STP_PARAMETER_DEFAULTED))
+	    lut_string_printf(&answer, "=%s",
+			      stp_get_string_parameter(v, name));
+	  break;
+	default:
+	  break;
+	}
+    }
+  for (i = 0; i < curve_parameter_count; i++)
+    {
+      const char *name = curve_parameters[i].param.name;
+      lut_string_printf(&answer, " %s:%d", name,
+			stp_get_curve_parameter_active(v, name));
+      if (stp_check_curve_parameter(v, name, STP_PARAMETER_DEFAULTED))
+	{
+	  char *curve =
+	    stp_curve_write_string(stp_get_curve_parameter(v, name));
+	  lut_string_printf(&answer, "=%s", curve);
+	  stp_free(curve);
+	}
+    }
+  return answer.data;
+}
+
+static stp_cached_curve_t *
+lut_curve_slot(lut_t *lut, int i)
+{
+  switch (i)
+    {
+    case 0:
+      return &(lut->brightness_correction);
+    case 1:
+      return &(lut->contrast_correction);
+    case 2:
+      return &(lut->user_color_correction);
+    case 3:
+      return &(lut->hue_map);
+    case 4:
+      return &(lut->lum_map);
+    case 5:
+      return &(lut->sat_map);
+    default:
+      return &(lut->channel_curves[i - 6]);
+    }
+}
+
+static void
+lut_cache_free_entry(lut_cache_entry_t *entry)
+{
+  STP_SAFE_FREE(entry->fingerprint);
+  if (entry->lut)
+    free_lut(entry->lut);
+  entry->lut = NULL;
+  stp_curve_free_curve_cache(&(entry->gcr_curve));
+}
+
+/*
+ * Put a new entry at the front of the cache, dropping the oldest one.
+ */
+static lut_cache_entry_t *
+lut_cache_insert(char *fingerprint, lut_t *lut, const stp_curve_t *gcr)
+{
+  int i;
+  lut_cache_free_entry(&(lut_cache[LUT_CACHE_SIZE - 1]));
+  for (i = LUT_CACHE_SIZE - 1; i > 0; i--)
+    lut_cache[i] = lut_cache[i - 1];
+  memset(&(lut_cache[0]), 0, sizeof(lut_cache_entry_t));
+  lut_cache[0].fingerprint = fingerprint;
+  lut_cache[0].lut = lut;
+  if (gcr)
+    stp_curve_cache_set_curve_copy(&(lut_cache[0].gcr_curve), gcr);
+  return &(lut_cache[0]);
+}
+
+static lut_cache_entry_t *
+lut_cache_find(const char *fingerprint)
+{
+  int i;
+  for (i = 0; i < LUT_CACHE_SIZE; i++)
+    if (lut_cache[i].fingerprint &&
+	strcmp(lut_cache[i].fingerprint, fingerprint) == 0)
+      {
+	if (i > 0)
+	  {
+	    lut_cache_entry_t tmp = lut_cache[i];
+	    for (; i > 0; i--)
+	      lut_cache[i] = lut_cache[i - 1];
+	    lut_cache[0] = tmp;
+	  }
+	return &(lut_cache[0]);
+      }
+  return NULL;
+}
+
+/*
+ * The file is named by a hash of the fingerprint, and contains the
+ * fingerprint itself to guard against collisions.  It is in host byte
+ * order; a file written by a different kind of host is ignored.
+ */
+static char *
+lut_cache_file_name(const char *fingerprint)
+{
+  const char *dir = getenv("STP_LUT_CACHE_DIR");
+  unsigned h1 = 2166136261u;
+  unsigned h2 = 5381;
+  const unsigned char *p;
+  char *answer;
+  if (!dir || !*dir)
+    return NULL;
+  for (p = (const unsigned char *) fingerprint; *p; p++)
+    {
+      h1 = (h1 ^ *p) * 16777619u;
+      h2 = h2 * 33 + *p;
+    }
+  stp_asprintf(&answer, "%s/lut-%08x%08x.cache", dir, h1, h2);
+  return answer;
+}
+
+static void
+lut_cache_get_header(int *header)
+{
+  header[0] = 0x01020304;
+  header[1] = sizeof(int);
+  header[2] = sizeof(size_t);
+  header[3] = sizeof(double);
+}
+
+static void
+lut_cache_save(const lut_cache_entry_t *entry)
+{
+  char *file = lut_cache_file_name(entry->fingerprint);
+  char *tmp_file;
+  FILE *fp = NULL;
+  int fd;
+  lut_t *lut = entry->lut;
+  int header[4];
+  int ints[3];
+  double doubles[5];
+  size_t length = strlen(entry->fingerprint);
+  int i;
+  int status;
+
+  if (!file)
+    return;
+  /*
+   * The cache directory may be shared, so the temporary file must not
+   * have a name that someone else can create first.
+   */
+  stp_asprintf(&tmp_file, "%s.XXXXXX", file);
+  fd = mkstemp(tmp_file);
+  if (fd >= 0)
+    {
+      fp = fdopen(fd, "wb");
+      if (!fp)
+	{
+	  (void) close(fd);
+	  (void) remove(tmp_file);
+	}
+    }
+  if (!fp)
+    {
+      stp_deprintf(STP_DBG_LUT, "lut_cache_save: cannot create %s\n",
+		   file);
+      stp_free(tmp_file);
+      stp_free(file);
+      return;
+    }
+  lut_cache_get_header(header);
+  ints[0] = lut->invert_output;
+  ints[1] = lut->simple_gamma_correction;
+  ints[2] = lut->linear_contrast_adjustment;
+  doubles[0] = lut->print_gamma;
+  doubles[1] = lut->app_gamma;
+  doubles[2] = lut->screen_gamma;
+  doubles[3] = lut->contrast;
+  doubles[4] = lut->brightness;
+  status =
+    (fwrite(LUT_CACHE_MAGIC, 8, 1, fp) == 1 &&
+     fwrite(header, sizeof(header), 1, fp) == 1 &&
+     fwrite(&length, sizeof(size_t), 1, fp) == 1 &&
+     fwrite(entry->fingerprint, length, 1, fp) == 1 &&
+     fwrite(ints, sizeof(ints), 1, fp) == 1 &&
+     fwrite(doubles, sizeof(doubles), 1, fp) == 1 &&
+     fwrite(lut->gamma_values, sizeof(lut->gamma_values), 1, fp) == 1);
+  for (i = 0; status && i < LUT_CURVE_SLOTS; i++)
+    status = stpi_curve_cache_write(fp, lut_curve_slot(lut, i));
+  if (status)
+    status = stpi_curve_cache_write(fp, (stp_cached_curve_t *)
+				   &(entry->gcr_curve));
+  if (fclose(fp) != 0)
+    status = 0;
+  if (!status || rename(tmp_file, file) != 0)
+    {
+      stp_deprintf(STP_DBG_LUT, "lut_cache_save: cannot write %s\n", file);
+      (void) remove(tmp_file);
+    }
+  stp_free(tmp_file);
+  stp_free(file);
+}
+
+static lut_cache_entry_t *
+lut_cache_load(char *fingerprint, const lut_t *model)
+{
+  char *file = lut_cache_file_name(fingerprint);
+  FILE *fp;
+  lut_t *lut;
+  stp_cached_curve_t gcr = { NULL, NULL, NULL, 0 };
+  char magic[8];
+  int header[4];
+  int file_header[4];
+  int ints[3];
+  double doubles[5];
+  size_t length;
+  char *file_fingerprint = NULL;
+  lut_cache_entry_t *answer = NULL;
+  int status;
+  int i;
+
+  if (!file)
+    return NULL;
+  fp = fopen(file, "rb");
+  stp_free(file);
+  if (!fp)
+    return NULL;
+  lut = allocate_lut();
+  lut_cache_get_header(header);
+  status =
+    (fread(magic, 8, 1, fp) == 1 &&
+     memcmp(magic, LUT_CACHE_MAGIC, 8) == 0 &&
+     fread(file_header, sizeof(file_header), 1, fp) == 1 &&
+     memcmp(header, file_header, sizeof(header)) == 0 &&
+     fread(&length, sizeof(size_t), 1, fp) == 1 &&
+     length == strlen(fingerprint));
+  if (status)
+    {
+      file_fingerprint = stp_malloc(length);
+      status = (fread(file_fingerprint, length, 1, fp) == 1 &&
+		memcmp(file_fingerprint, fingerprint, length) == 0 &&
+		fread(ints, sizeof(ints), 1, fp) == 1 &&
+		fread(doubles, sizeof(doubles), 1, fp) == 1 &&
+		fread(lut->gamma_values, sizeof(lut->gamma_values), 1,
+		      fp) == 1);
+      stp_free(file_fingerprint);
+    }
+  for (i = 0; status && i < LUT_CURVE_SLOTS; i++)
+    status = stpi_curve_cache_read(fp, lut_curve_slot(lut, i));
+  if (status)
+    status = stpi_curve_cache_read(fp, &gcr);
+  (void) fclose(fp);
+  if (status)
+    {
+      lut->input_color_description = model->input_color_description;
+      lut->output_color_description = model->output_color_description;
+      lut->color_correction = model->color_correction;
+      lut->invert_output = ints[0];
+      lut->simple_gamma_correction = ints[1];
+      lut->linear_contrast_adjustment = ints[2];
+      lut->print_gamma = doubles[0];
+      lut->app_gamma = doubles[1];
+      lut->screen_gamma = doubles[2];
+      lut->contrast = doubles[3];
+      lut->brightness = doubles[4];
+      answer = lut_cache_insert(fingerprint, lut,
+				stp_curve_cache_get_curve(&gcr));
+    }
+  else
+    free_lut(lut);
+  stp_curve_free_curve_cache(&gcr);
+  return answer;
+}
+
+static void
+stpi_compute_lut_cached(stp_vars_t *v)
+{
+  lut_t *lut = (lut_t *)(stp_get_component_data(v, "Color"));
+  char *fingerprint = lut_fingerprint(v, lut);
+  lut_cache_entry_t *entry;
+
+  LUT_CACHE_LOCK();
+  entry = lut_cache_find(fingerprint);
+  if (entry)
+    stp_free(fingerprint);
+  else
+    entry = lut_cache_load(fingerprint, lut);
+  if (entry)
+    {
+      stp_dprintf(STP_DBG_LUT, v, "stpi_compute_lut: using cached LUT\n");
+      copy_lut_curves(lut, entry->lut);
+      if (lut_uses_gcr_curve(lut))
+	stp_channel_set_gcr_curve
+	  (v, stp_curve_cache_get_curve(&(entry->gcr_curve)));
+      LUT_CACHE_UNLOCK();
+      if (stp_check_file_parameter(v, "LUTDumpFile", STP_PARAMETER_ACTIVE))
+	stpi_dump_lut_to_file(v, stp_get_file_parameter(v, "LUTDumpFile"));
+    }
+  else
+    {
+      lut_t *copy;
+      LUT_CACHE_UNLOCK();
+      stpi_compute_lut(v);
+      copy = allocate_lut();
+      copy->input_color_description = lut->input_color_description;
+      copy->output_color_description = lut->output_color_description;
+      copy->color_correction = lut->color_correction;
+      copy_lut_curves(copy, lut);
+      LUT_CACHE_LOCK();
+      entry = lut_cache_insert(fingerprint, copy,
+			       lut_uses_gcr_curve(lut) ?
+			       stp_channel_get_gcr_curve(v) : NULL);
+      lut_cache_save(entry);
+      LUT_CACHE_UNLOCK();
+    }
+}
+
 static int
 stpi_color_traditional_init(stp_vars_t *v,
 			    stp_image_t *image,
@@ -1502,6 +2154,7 @@ stpi_color_traditional_init(stp_vars_t *v,
   lut_t *lut;
   const char *image_type = stp_get_string_parameter(v, "ImageType");
   const char *color_correction = stp_get_string_parameter(v, "ColorCorrection");
+  const lut_mode_t *lut_mode;
   const channel_depth_t *channel_depth =
     get_channel_depth(stp_get_string_parameter(v, "ChannelBitDepth"));
   size_t total_channel_bits;
@@ -1559,13 +2212,18 @@ stpi_color_traditional_init(stp_vars_t *v,
     lut->color_correction =
       (get_color_correction_by_tag
        (lut->output_color_description->default_correction));
+  lut_mode = get_lut_mode(stp_get_string_parameter(v, "LUTMode"));
+  if (lut_mode)
+    lut->rgb_grid_size = lut_mode->grid_size;
 
-  stpi_compute_lut(v);
+  stpi_compute_lut_cached(v);
 
   lut->image_width = stp_image_width(image);
+  lut->convert_width = lut->image_width;
   total_channel_bits = lut->in_channels * lut->channel_depth;
   lut->in_data = stp_malloc(((lut->image_width * total_channel_bits) + 7)/8);
   memset(lut->in_data, 0, ((lut->image_width * total_channel_bits) + 7) / 8);
+  stpi_color_prepare_conversion(v, lut);
   return lut->out_channels;
 }
 
@@ -1719,6 +2377,16 @@ stpi_color_traditional_describe_parameter(const stp_vars_t *v,
 		  description->deflt.str =
 		    stp_string_list_param(description->bounds.str, 0)->name;
 		}
+	      else if (strcmp(name, "LUTMode") == 0)
+		{
+		  description->bounds.str = stp_string_list_create();
+		  for (j = 0; j < lut_mode_count; j++)
+		    stp_string_list_add_string
+		      (description->bounds.str, lut_modes[j].name,
+		       gettext(lut_modes[j].text));
+		  description->deflt.str =
+		    stp_string_list_param(description->bounds.str, 0)->name;
+		}
 	      else if (strcmp(name, "ChannelBitDepth") == 0)
 		{
 		  description->bounds.str = stp_string_list_create();
@@ -1841,6 +2509,8 @@ static stp_color_t stpi_color_traditional_module_data =
 static int
 color_traditional_module_init(void)
 {
+  stpi_color_set_traditional_get_rows(&stpi_color_traditional_colorfuncs,
+				      &stpi_color_traditional_get_rows);
   return stp_color_register(&stpi_color_traditional_module_data);
 }
 
@@ -1848,6 +2518,13 @@ color_traditional_module_init(void)
 static int
 color_traditional_module_exit(void)
 {
+  int i;
+  LUT_CACHE_LOCK();
+  for (i = 0; i < LUT_CACHE_SIZE; i++)
+    lut_cache_free_entry(&(lut_cache[i]));
+  LUT_CACHE_UNLOCK();
+  stpi_color_set_traditional_get_rows(&stpi_color_traditional_colorfuncs,
+				      NULL);
   return stp_color_unregister(&stpi_color_traditional_module_data);
 }
 
@@ -33,6 +33,18 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 #include "dither-impl.h"
 
 #ifdef __GNUC__
@@ -349,6 +361,57 @@ stp_dither_matrix_set_row(stp_dither_matrix_impl_t *mat, int y)
   mat->index = mat->last_x_mod + mat->last_y_mod;
 }
 
+/*
+ * Matrices whose width isn't a power of two need a modulus, or the
+ * position tracking in ditherpoint, for every pixel.  Instead, a
+ * channel can keep such a matrix's current row repeated out to the
+ * width of the line, so that a threshold is a plain indexed load.  The
+ * row is filled in at the start of each line, if the matrix has moved
+ * to a new row.
+ */
+void
+stpi_dither_matrix_set_row_width(const stp_dither_matrix_impl_t *mat,
+				 stpi_dither_matrix_row_t *row, int width)
+{
+  STP_SAFE_FREE(row->v);
+  row->width = 0;
+  if (mat->fast_mask || !mat->matrix || mat->x_size <= 0 || width <= 0)
+    return;
+  row->v = stp_malloc(sizeof(unsigned) * width);
+  row->width = width;
+  row->y_mod = -1;
+}
+
+void
+stpi_dither_matrix_fill_row(const stp_dither_matrix_impl_t *mat,
+			    stpi_dither_matrix_row_t *row)
+{
+  const unsigned *src = mat->matrix + mat->last_y_mod;
+  int start;
+  int width = row->width;
+  int done;
+  if (width == 0 || row->y_mod == mat->last_y_mod)
+    return;
+  start = mat->x_offset % mat->x_size;
+  done = mat->x_size - start;
+  if (done > width)
+    done = width;
+  memcpy(row->v, src + start, done * sizeof(unsigned));
+  if (done < width)
+    {
+      int rest = start < width - done ? start : width - done;
+      memcpy(row->v + done, src, rest * sizeof(unsigned));
+      done += rest;
+    }
+  while (done < width)
+    {
+      int count = done < width - done ? done : width - done;
+      memcpy(row->v + done, row->v, count * sizeof(unsigned));
+      done += count;
+    }
+  row->y_mod = mat->last_y_mod;
+}
+
 static void
 preinit_matrix(stp_vars_t *v)
 {
@@ -453,6 +516,9 @@ typedef struct
   int y;
   const char *filename;
   const stp_array_t *dither_array;
+  stp_dither_matrix_generic_t matrix;	/* data is NULL until loaded */
+  void *map;				/* Mapped binary matrix file */
+  size_t map_size;
 } stp_xml_dither_cache_t;
 
 static stp_xml_dither_cache_t *
@@ -487,26 +553,32 @@ stp_xml_dither_cache_get(int x, int y)
   return NULL;
 }
 
-static void
+static stp_xml_dither_cache_t *
 stp_xml_dither_cache_set(int x, int y, const char *filename)
 {
   stp_xml_dither_cache_t *cacheval;
 
-  STPI_ASSERT(x && y && filename, NULL);
+  STPI_ASSERT(x && y, NULL);
 
   stp_xml_init();
 
   if (dither_matrix_cache == NULL)
     dither_matrix_cache = stp_list_create();
 
-  if (stp_xml_dither_cache_get(x, y))
+  cacheval = stp_xml_dither_cache_get(x, y);
+  if (cacheval)
+    {
       /* Already cached for this x and y aspect */
-    return;
+      if (!cacheval->filename && filename)
+	cacheval->filename = stp_strdup(filename);
+      stp_xml_exit();
+      return cacheval;
+    }
 
-  cacheval = stp_malloc(sizeof(stp_xml_dither_cache_t));
+  cacheval = stp_zalloc(sizeof(stp_xml_dither_cache_t));
   cacheval->x = x;
   cacheval->y = y;
-  cacheval->filename = stp_strdup(filename);
+  cacheval->filename = filename ? stp_strdup(filename) : NULL;
   cacheval->dither_array = NULL;
 
   stp_list_item_create(dither_matrix_cache, NULL, (void *) cacheval);
@@ -515,7 +587,7 @@ stp_xml_dither_cache_set(int x, int y, const char *filename)
 
   stp_xml_exit();
 
-  return;
+  return cacheval;
 }
 
 /*
@@ -539,7 +611,7 @@ stp_xml_process_dither_matrix(stp_mxml_node_t *dm,     /* The dither matrix node
   stp_deprintf(STP_DBG_XML,
 	       "stp_xml_process_dither_matrix: x=%d, y=%d\n", x, y);
 
-  stp_xml_dither_cache_set(x, y, file);
+  (void) stp_xml_dither_cache_set(x, y, file);
   return 1;
 }
 
@@ -653,18 +725,21 @@ stpi_dither_array_create_from_file(const char* file, int x, int y)
   return ret;
 }
 
-static stp_array_t *
-stp_xml_get_dither_array(int x, int y)
+/*
+ * Return the cached dither array for an aspect ratio, parsing the XML
+ * file the first time it is needed.
+ */
+static stp_xml_dither_cache_t *
+stp_xml_get_dither_cache(int x, int y)
 {
   stp_xml_dither_cache_t *cachedval;
-  stp_array_t *ret;
 
   cachedval = stp_xml_dither_cache_get(x, y);
 
   if (cachedval && cachedval->dither_array)
-    return stp_array_create_copy(cachedval->dither_array);
+    return cachedval;
 
-  if (!cachedval)
+  if (!cachedval || !cachedval->filename)
     {
       char buf[1024];
       (void) sprintf(buf, "dither-matrix-%dx%d.xml", x, y);
@@ -676,10 +751,264 @@ stp_xml_get_dither_array(int x, int y)
 	}
     }
 
-  ret = stpi_dither_array_create_from_file(cachedval->filename, x, y);
+  cachedval->dither_array =
+    stpi_dither_array_create_from_file(cachedval->filename, x, y);
+  return cachedval->dither_array ? cachedval : NULL;
+}
+
+static stp_array_t *
+stp_xml_get_dither_array(int x, int y)
+{
+  stp_xml_dither_cache_t *cachedval = stp_xml_get_dither_cache(x, y);
+  if (cachedval)
+    return stp_array_create_copy(cachedval->dither_array);
+  return NULL;
+}
+
+/*
+ * Binary dither matrices.  The XML matrices are 64K decimal numbers
+ * each; the same matrix may also be installed as
+ * dither-matrix-<x>x<y>.bin, which is mapped read-only and shared by
+ * every process using it.  The file is a 32 byte header followed by the
+ * matrix in row order as little-endian 16-bit values:
+ *
+ *   0	"STPDMTRX"
+ *   8	format (1), x-aspect, y-aspect, x-size, y-size, 0
+ *
+ * All header values are little-endian 32-bit numbers.
+ */
+#define DITHER_BINARY_MAGIC "STPDMTRX"
+#define DITHER_BINARY_FORMAT 1
+#define DITHER_BINARY_HEADER_SIZE 32
+
+static unsigned
+get_le32(const unsigned char *p)
+{
+  return (p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned) p[3] << 24));
+}
 
-  cachedval->dither_array = ret;
-  return stp_array_create_copy(ret);
+static void
+put_le32(unsigned char *p, unsigned val)
+{
+  p[0] = val & 0xff;
+  p[1] = (val >> 8) & 0xff;
+  p[2] = (val >> 16) & 0xff;
+  p[3] = (val >> 24) & 0xff;
+}
+
+static int
+host_is_little_endian(void)
+{
+  unsigned short one = 1;
+  return *((const unsigned char *) &one) == 1;
+}
+
+/*
+ * Map (or read) a binary dither matrix into cachedval.  Returns 1 on
+ * success.
+ */
+static int
+dither_matrix_map_binary(stp_xml_dither_cache_t *cachedval, const char *file)
+{
+  struct stat sbuf;
+  unsigned char *data = NULL;
+  size_t size;
+  unsigned x_size, y_size;
+  int mapped = 0;
+  int fd = open(file, O_RDONLY);
+
+  if (fd < 0)
+    return 0;
+  if (fstat(fd, &sbuf) != 0 || sbuf.st_size < DITHER_BINARY_HEADER_SIZE)
+    {
+      close(fd);
+      return 0;
+    }
+  size = sbuf.st_size;
+#ifdef HAVE_SYS_MMAN_H
+  if (host_is_little_endian())
+    {
+      data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+      if (data == (unsigned char *) MAP_FAILED)
+	data = NULL;
+      else
+	mapped = 1;
+    }
+#endif
+  if (!data)
+    {
+      data = stp_malloc(size);
+      if (read(fd, data, size) != (ssize_t) size)
+	{
+	  stp_free(data);
+	  data = NULL;
+	}
+    }
+  close(fd);
+  if (!data)
+    return 0;
+
+  x_size = get_le32(data + 20);
+  y_size = get_le32(data + 24);
+  if (memcmp(data, DITHER_BINARY_MAGIC, 8) != 0 ||
+      get_le32(data + 8) != DITHER_BINARY_FORMAT ||
+      get_le32(data + 12) != cachedval->x ||
+      get_le32(data + 16) != cachedval->y ||
+      x_size == 0 || y_size == 0 || x_size > 65536 || y_size > 65536 ||
+      size != DITHER_BINARY_HEADER_SIZE + (size_t) x_size * y_size * 2)
+    {
+      stp_erprintf("%s: not a %dx%d binary dither matrix\n", file,
+		   cachedval->x, cachedval->y);
+#ifdef HAVE_SYS_MMAN_H
+      if (mapped)
+	(void) munmap(data, size);
+      else
+#endif
+	stp_free(data);
+      return 0;
+    }
+
+  if (!mapped && !host_is_little_endian())
+    {
+      unsigned char *p = data + DITHER_BINARY_HEADER_SIZE;
+      size_t i;
+      for (i = 0; i < (size_t) x_size * y_size; i++, p += 2)
+	{
+	  unsigned char tmp = p[0];
+	  p[0] = p[1];
+	  p[1] = tmp;
+	}
+    }
+
+  cachedval->matrix.x = x_size;
+  cachedval->matrix.y = y_size;
+  cachedval->matrix.bytes = 2;
+  cachedval->matrix.prescaled = 1;
+  cachedval->matrix.data = data + DITHER_BINARY_HEADER_SIZE;
+  cachedval->map = mapped ? data : NULL;
+  cachedval->map_size = mapped ? size : 0;
+  stp_deprintf(STP_DBG_XML, "dither_matrix_map_binary: %s %s\n",
+	       mapped ? "mapped" : "read", file);
+  return 1;
+}
+
+/*
+ * Return the shared matrix for an aspect ratio, from the binary file
+ * if there is one and from the XML file otherwise.
+ */
+static const stp_dither_matrix_generic_t *
+stp_xml_get_dither_matrix(int x, int y)
+{
+  stp_xml_dither_cache_t *cachedval = stp_xml_dither_cache_get(x, y);
+  stp_list_t *dir_list;
+  stp_list_item_t *item;
+  char buf[1024];
+
+  if (cachedval && cachedval->matrix.data)
+    return &(cachedval->matrix);
+
+  cachedval = stp_xml_dither_cache_set(x, y, NULL);
+  (void) sprintf(buf, "dither-matrix-%dx%d.bin", x, y);
+  dir_list = stpi_data_path();
+  for (item = stp_list_get_start(dir_list); item;
+       item = stp_list_item_next(item))
+    {
+      char *file = stpi_path_merge(stp_list_item_get_data(item), buf);
+      int found = dither_matrix_map_binary(cachedval, file);
+      stp_free(file);
+      if (found)
+	break;
+    }
+  stp_list_destroy(dir_list);
+  if (cachedval->matrix.data)
+    return &(cachedval->matrix);
+
+  cachedval = stp_xml_get_dither_cache(x, y);
+  if (cachedval)
+    {
+      size_t count;
+      int x_size, y_size;
+      const stp_sequence_t *seq =
+	stp_array_get_sequence(cachedval->dither_array);
+      stp_array_get_size(cachedval->dither_array, &x_size, &y_size);
+      cachedval->matrix.x = x_size;
+      cachedval->matrix.y = y_size;
+      cachedval->matrix.bytes = 2;
+      cachedval->matrix.prescaled = 1;
+      cachedval->matrix.data = stp_sequence_get_ushort_data(seq, &count);
+      if (cachedval->matrix.data)
+	return &(cachedval->matrix);
+    }
+  return NULL;
+}
+
+/*
+ * Convert a dither matrix XML file to the binary format.
+ */
+int
+stp_dither_matrix_write_binary(const char *xml_file, const char *output)
+{
+  stp_mxml_node_t *doc;
+  stp_mxml_node_t *node;
+  stp_array_t *array = NULL;
+  int x = 0, y = 0;
+  int status = 1;
+
+  doc = stp_mxmlLoadFromFile(NULL, xml_file, STP_MXML_NO_CALLBACK);
+  if (!doc)
+    {
+      stp_erprintf("%s: cannot read: %s\n", xml_file, strerror(errno));
+      return 1;
+    }
+  node = stp_mxmlFindElement(doc, doc, "dither-matrix", NULL, NULL,
+			     STP_MXML_DESCEND);
+  if (node && stp_mxmlElementGetAttr(node, "x-aspect") &&
+      stp_mxmlElementGetAttr(node, "y-aspect"))
+    {
+      x = stp_xmlstrtol(stp_mxmlElementGetAttr(node, "x-aspect"));
+      y = stp_xmlstrtol(stp_mxmlElementGetAttr(node, "y-aspect"));
+      array = xml_doc_get_dither_array(doc, x, y);
+    }
+  stp_mxmlDelete(doc);
+
+  if (array && stp_dither_matrix_validate_array(array))
+    {
+      unsigned char header[DITHER_BINARY_HEADER_SIZE];
+      const unsigned short *vec;
+      size_t count, i;
+      int x_size, y_size;
+      FILE *fp;
+
+      stp_array_get_size(array, &x_size, &y_size);
+      vec = stp_sequence_get_ushort_data(stp_array_get_sequence(array),
+					 &count);
+      memset(header, 0, sizeof(header));
+      memcpy(header, DITHER_BINARY_MAGIC, 8);
+      put_le32(header + 8, DITHER_BINARY_FORMAT);
+      put_le32(header + 12, x);
+      put_le32(header + 16, y);
+      put_le32(header + 20, x_size);
+      put_le32(header + 24, y_size);
+      fp = fopen(output, "wb");
+      if (fp && vec && count == (size_t) x_size * y_size &&
+	  fwrite(header, sizeof(header), 1, fp) == 1)
+	{
+	  status = 0;
+	  for (i = 0; i < count && status == 0; i++)
+	    if (putc(vec[i] & 0xff, fp) == EOF ||
+		putc(vec[i] >> 8, fp) == EOF)
+	      status = 1;
+	}
+      if (fp && fclose(fp) != 0)
+	status = 1;
+      if (status)
+	stp_erprintf("%s: cannot write: %s\n", output, strerror(errno));
+    }
+  else
+    stp_erprintf("%s: not a valid dither matrix\n", xml_file);
+  if (array)
+    stp_array_destroy(array);
+  return status;
 }
 
 void
@@ -714,3 +1043,31 @@ stp_find_standard_dither_array(int x_aspect, int y_aspect)
     return answer;
   return NULL;
 }
+
+/*
+ * As stp_find_standard_dither_array, but the matrix is shared between
+ * all callers and must not be modified.
+ */
+const stp_dither_matrix_generic_t *
+stp_find_standard_dither_matrix(int x_aspect, int y_aspect)
+{
+  const stp_dither_matrix_generic_t *answer;
+  int divisor = gcd(x_aspect, y_aspect);
+
+  x_aspect /= divisor;
+  y_aspect /= divisor;
+
+  if (x_aspect == 3)		/* We don't have x3 matrices */
+    x_aspect += 1;		/* so cheat */
+  if (y_aspect == 3)
+    y_aspect += 1;
+
+  divisor = gcd(x_aspect, y_aspect);
+  x_aspect /= divisor;
+  y_aspect /= divisor;
+
+  answer = stp_xml_get_dither_matrix(x_aspect, y_aspect);
+  if (answer)
+    return answer;
+  return stp_xml_get_dither_matrix(y_aspect, x_aspect);
+}
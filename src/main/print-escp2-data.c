@@ -401,7 +401,7 @@ stp_escp2_load_model(const stp_vars_t *v, int model)
     {
       const char *dn = (const char *) stp_list_item_get_data(item);
       char *fn = stpi_path_merge(dn, buf);
-      stp_mxml_node_t *doc = stp_mxmlLoadFromFile(NULL, fn, STP_MXML_NO_CALLBACK);
+      stp_mxml_node_t *doc = stp_xml_load_file(fn);
       stp_free(fn);
       if (doc)
 	{
@@ -35,6 +35,9 @@
 #include <string.h>
 #include <math.h>
 #include <limits.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #include "print-escp2.h"
 
 #ifdef __GNUC__
@@ -1016,6 +1019,25 @@ static const int_param_t int_parameters[] =
       STP_PARAMETER_LEVEL_ADVANCED3, 0, 1, STP_CHANNEL_NONE, 1, 0
     }, 0, 255, 0
   },
+  {
+    {
+      "PipelineDepth", N_("Pipeline Depth"), "Color=No,Category=Advanced Output Control",
+      N_("Rows buffered between the color, dither and weave threads "
+	 "(0 prints in a single thread).  When this is set, the "
+	 "application's image callbacks are called from a worker thread"),
+      STP_PARAMETER_TYPE_INT, STP_PARAMETER_CLASS_OUTPUT,
+      STP_PARAMETER_LEVEL_ADVANCED4, 0, 1, STP_CHANNEL_NONE, 1, 0
+    }, 0, 64, 0
+  },
+  {
+    {
+      "CompressionThreads", N_("Compression Threads"), "Color=No,Category=Advanced Output Control",
+      N_("Number of threads used to compress the channels of each pass "
+	 "on printers with split channels"),
+      STP_PARAMETER_TYPE_INT, STP_PARAMETER_CLASS_OUTPUT,
+      STP_PARAMETER_LEVEL_ADVANCED4, 0, 1, STP_CHANNEL_NONE, 1, 0
+    }, 1, 16, 1
+  },
 };
 
 static const int int_parameter_count =
@@ -3730,6 +3752,11 @@ setup_misc(stp_vars_t *v)
   if (stp_check_int_parameter(v, "PlatenGap", STP_PARAMETER_ACTIVE))
     stp_set_int_parameter(pd->media_settings, "PlatenGap",
 			  stp_get_int_parameter(v, "PlatenGap"));
+  if (stp_check_int_parameter(v, "PipelineDepth", STP_PARAMETER_ACTIVE))
+    pd->pipeline_depth = stp_get_int_parameter(v, "PipelineDepth");
+  pd->compression_threads = 1;
+  if (stp_check_int_parameter(v, "CompressionThreads", STP_PARAMETER_ACTIVE))
+    pd->compression_threads = stp_get_int_parameter(v, "CompressionThreads");
 }
 
 static void
@@ -4254,6 +4281,273 @@ set_mask(unsigned char *cd_mask, int x_center, int scaled_x_where,
     }
 }
 
+static void
+set_cd_mask(const escp2_privdata_t *pd, int y, unsigned char *cd_mask)
+{
+  int x_center = pd->cd_x_offset * pd->res->printed_hres / pd->micro_units;
+  double outer_r_sq =
+    (double) pd->cd_outer_radius * (double) pd->cd_outer_radius;
+  double inner_r_sq =
+    (double) pd->cd_inner_radius * (double) pd->cd_inner_radius;
+  int y_distance_from_center =
+    pd->cd_outer_radius -
+    ((y + pd->cd_y_offset) * pd->micro_units / pd->res->printed_vres);
+  if (y_distance_from_center < 0)
+    y_distance_from_center = -y_distance_from_center;
+  memset(cd_mask, 0, (pd->image_printed_width + 7) / 8);
+  if (y_distance_from_center < pd->cd_outer_radius)
+    {
+      double y_sq = (double) y_distance_from_center *
+	(double) y_distance_from_center;
+      int x_where = sqrt(outer_r_sq - y_sq) + .5;
+      int scaled_x_where = x_where * pd->res->printed_hres / pd->micro_units;
+      set_mask(cd_mask, x_center, scaled_x_where,
+	       pd->image_printed_width, 1, 0);
+      if (y_distance_from_center < pd->cd_inner_radius)
+	{
+	  x_where = sqrt(inner_r_sq - y_sq) + .5;
+	  scaled_x_where = x_where * pd->res->printed_hres / pd->micro_units;
+	  set_mask(cd_mask, x_center, scaled_x_where,
+		   pd->image_printed_width, 1, 1);
+	}
+    }
+}
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * Pipelined printing.  Color conversion, dithering, and weaving each run
+ * in their own thread, handing rows along through a ring of
+ * pipeline_depth row buffers.  Every stage still sees the rows in order
+ * and makes the same calls as the serial loop in escp2_print_data, so
+ * the output is identical.  The image is read from the color thread,
+ * not the thread that called stp_print.
+ */
+
+typedef struct
+{
+  int duplicate_line;
+  unsigned zero_mask;
+  unsigned short *input;	/* Color converted row */
+  unsigned char *cd_mask;
+  unsigned char **cols;		/* Dithered row */
+} pipeline_row_t;
+
+typedef struct
+{
+  stp_vars_t *v;
+  stp_image_t *image;
+  int depth;
+  size_t input_size;
+  size_t line_width;
+  pipeline_row_t *rows;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int converted;		/* Rows completed by each stage */
+  int dithered;
+  int written;
+  int row_count;		/* Rows to print; cut short on error */
+  int status;
+} pipeline_t;
+
+/*
+ * Wait until *counter passes row, or there are no more rows.  Returns
+ * false if the row will never arrive.
+ */
+static int
+pipeline_wait(pipeline_t *pl, const int *counter, int row)
+{
+  int ret;
+  pthread_mutex_lock(&(pl->lock));
+  while (*counter <= row && row < pl->row_count)
+    pthread_cond_wait(&(pl->cond), &(pl->lock));
+  ret = row < pl->row_count;
+  pthread_mutex_unlock(&(pl->lock));
+  return ret;
+}
+
+static void
+pipeline_finish_row(pipeline_t *pl, int *counter, int row)
+{
+  pthread_mutex_lock(&(pl->lock));
+  *counter = row + 1;
+  pthread_cond_broadcast(&(pl->cond));
+  pthread_mutex_unlock(&(pl->lock));
+}
+
+static void *
+pipeline_color_thread(void *arg)
+{
+  pipeline_t *pl = (pipeline_t *) arg;
+  stp_vars_t *v = pl->v;
+  escp2_privdata_t *pd = get_privdata(v);
+  int errdiv  = stp_image_height(pl->image) / pd->image_printed_height;
+  int errmod  = stp_image_height(pl->image) % pd->image_printed_height;
+  int errval  = 0;
+  int errlast = -1;
+  int errline  = 0;
+  unsigned zero_mask = 0;
+  int y;
+
+  for (y = 0; y < pd->image_printed_height; y++)
+    {
+      pipeline_row_t *row = &(pl->rows[y % pl->depth]);
+      int duplicate_line = 1;
+
+      /* Wait for the weave to be done with this buffer */
+      pthread_mutex_lock(&(pl->lock));
+      while (y - pl->written >= pl->depth && y < pl->row_count)
+	pthread_cond_wait(&(pl->cond), &(pl->lock));
+      if (y >= pl->row_count)
+	{
+	  pthread_mutex_unlock(&(pl->lock));
+	  return NULL;
+	}
+      pthread_mutex_unlock(&(pl->lock));
+
+      if (errline != errlast)
+	{
+	  errlast = errline;
+	  duplicate_line = 0;
+	  if (stp_color_get_row(v, pl->image, errline, &zero_mask))
+	    {
+	      pthread_mutex_lock(&(pl->lock));
+	      pl->status = 2;
+	      pl->row_count = y;
+	      pthread_cond_broadcast(&(pl->cond));
+	      pthread_mutex_unlock(&(pl->lock));
+	      return NULL;
+	    }
+	}
+      row->duplicate_line = duplicate_line;
+      row->zero_mask = zero_mask;
+      /* The channels are set up by the first stp_color_get_row */
+      if (!row->input)
+	{
+	  pl->input_size = stpi_channel_get_output_size(v);
+	  row->input = stp_malloc(pl->input_size);
+	}
+      memcpy(row->input, stp_channel_get_output(v), pl->input_size);
+      if (row->cd_mask)
+	set_cd_mask(pd, y, row->cd_mask);
+      pipeline_finish_row(pl, &(pl->converted), y);
+
+      errval += errmod;
+      errline += errdiv;
+      if (errval >= pd->image_printed_height)
+	{
+	  errval -= pd->image_printed_height;
+	  errline ++;
+	}
+    }
+  return NULL;
+}
+
+static void *
+pipeline_dither_thread(void *arg)
+{
+  pipeline_t *pl = (pipeline_t *) arg;
+  stp_vars_t *v = pl->v;
+  escp2_privdata_t *pd = get_privdata(v);
+  int y, i;
+
+  for (y = 0; pipeline_wait(pl, &(pl->converted), y); y++)
+    {
+      pipeline_row_t *row = &(pl->rows[y % pl->depth]);
+      stp_dither_internal(v, y, row->input, row->duplicate_line,
+			  row->zero_mask, row->cd_mask);
+      for (i = 0; i < pd->channels_in_use; i++)
+	if (pd->cols[i])
+	  memcpy(row->cols[i], pd->cols[i], pl->line_width);
+      pipeline_finish_row(pl, &(pl->dithered), y);
+    }
+  return NULL;
+}
+
+static void
+free_pipeline_rows(pipeline_t *pl, int channels)
+{
+  int i, j;
+  for (i = 0; i < pl->depth; i++)
+    {
+      pipeline_row_t *row = &(pl->rows[i]);
+      STP_SAFE_FREE(row->input);
+      STP_SAFE_FREE(row->cd_mask);
+      if (row->cols)
+	{
+	  for (j = 0; j < channels; j++)
+	    STP_SAFE_FREE(row->cols[j]);
+	  stp_free(row->cols);
+	}
+    }
+  stp_free(pl->rows);
+}
+
+/*
+ * Returns -1 if the threads could not be started, in which case
+ * nothing has been printed and the caller should print serially.
+ */
+static int
+escp2_print_data_pipelined(stp_vars_t *v, stp_image_t *image)
+{
+  escp2_privdata_t *pd = get_privdata(v);
+  pthread_t color_thread, dither_thread;
+  pipeline_t pl;
+  int y, i, j;
+
+  memset(&pl, 0, sizeof(pl));
+  pl.v = v;
+  pl.image = image;
+  pl.depth = pd->pipeline_depth;
+  pl.line_width = (pd->image_printed_width + 7) / 8 * pd->bitwidth;
+  pl.row_count = pd->image_printed_height;
+  pl.status = 1;
+  pl.rows = stp_zalloc(sizeof(pipeline_row_t) * pl.depth);
+  for (i = 0; i < pl.depth; i++)
+    {
+      pipeline_row_t *row = &(pl.rows[i]);
+      if (pd->cd_outer_radius > 0)
+	row->cd_mask = stp_malloc(1 + (pd->image_printed_width + 7) / 8);
+      row->cols = stp_zalloc(sizeof(unsigned char *) * pd->channels_in_use);
+      for (j = 0; j < pd->channels_in_use; j++)
+	if (pd->cols[j])
+	  row->cols[j] = stp_malloc(pl.line_width);
+    }
+
+  pthread_mutex_init(&(pl.lock), NULL);
+  pthread_cond_init(&(pl.cond), NULL);
+  if (pthread_create(&dither_thread, NULL, pipeline_dither_thread, &pl) != 0)
+    {
+      pl.status = -1;
+      goto out;
+    }
+  if (pthread_create(&color_thread, NULL, pipeline_color_thread, &pl) != 0)
+    {
+      /* Nothing has been converted yet, so the dither thread just exits */
+      pthread_mutex_lock(&(pl.lock));
+      pl.row_count = 0;
+      pthread_cond_broadcast(&(pl.cond));
+      pthread_mutex_unlock(&(pl.lock));
+      pthread_join(dither_thread, NULL);
+      pl.status = -1;
+      goto out;
+    }
+
+  for (y = 0; pipeline_wait(&pl, &(pl.dithered), y); y++)
+    {
+      stp_write_weave(v, pl.rows[y % pl.depth].cols);
+      pipeline_finish_row(&pl, &(pl.written), y);
+    }
+
+  pthread_join(color_thread, NULL);
+  pthread_join(dither_thread, NULL);
+ out:
+  pthread_cond_destroy(&(pl.cond));
+  pthread_mutex_destroy(&(pl.lock));
+  free_pipeline_rows(&pl, pd->channels_in_use);
+  return pl.status;
+}
+#endif /* HAVE_PTHREAD_H */
+
 static int
 escp2_print_data(stp_vars_t *v, stp_image_t *image)
 {
@@ -4264,16 +4558,21 @@ escp2_print_data(stp_vars_t *v, stp_image_t *image)
   int errlast = -1;
   int errline  = 0;
   int y;
-  double outer_r_sq = 0;
-  double inner_r_sq = 0;
-  int x_center = pd->cd_x_offset * pd->res->printed_hres / pd->micro_units;
   unsigned char *cd_mask = NULL;
-  if (pd->cd_outer_radius > 0)
+
+#ifdef HAVE_PTHREAD_H
+  if (pd->pipeline_depth > 0)
     {
-      cd_mask = stp_malloc(1 + (pd->image_printed_width + 7) / 8);
-      outer_r_sq = (double) pd->cd_outer_radius * (double) pd->cd_outer_radius;
-      inner_r_sq = (double) pd->cd_inner_radius * (double) pd->cd_inner_radius;
+      int status = escp2_print_data_pipelined(v, image);
+      if (status >= 0)
+	return status;
+      stp_dprintf(STP_DBG_ESCP2, v,
+		  "Unable to start pipeline threads, printing serially\n");
     }
+#endif
+
+  if (pd->cd_outer_radius > 0)
+    cd_mask = stp_malloc(1 + (pd->image_printed_width + 7) / 8);
 
   for (y = 0; y < pd->image_printed_height; y ++)
     {
@@ -4289,30 +4588,7 @@ escp2_print_data(stp_vars_t *v, stp_image_t *image)
 	}
 
       if (cd_mask)
-	{
-	  int y_distance_from_center =
-	    pd->cd_outer_radius -
-	    ((y + pd->cd_y_offset) * pd->micro_units / pd->res->printed_vres);
-	  if (y_distance_from_center < 0)
-	    y_distance_from_center = -y_distance_from_center;
-	  memset(cd_mask, 0, (pd->image_printed_width + 7) / 8);
-	  if (y_distance_from_center < pd->cd_outer_radius)
-	    {
-	      double y_sq = (double) y_distance_from_center *
-		(double) y_distance_from_center;
-	      int x_where = sqrt(outer_r_sq - y_sq) + .5;
-	      int scaled_x_where = x_where * pd->res->printed_hres / pd->micro_units;
-	      set_mask(cd_mask, x_center, scaled_x_where,
-		       pd->image_printed_width, 1, 0);
-	      if (y_distance_from_center < pd->cd_inner_radius)
-		{
-		  x_where = sqrt(inner_r_sq - y_sq) + .5;
-		  scaled_x_where = x_where * pd->res->printed_hres / pd->micro_units;
-		  set_mask(cd_mask, x_center, scaled_x_where,
-			   pd->image_printed_width, 1, 1);
-		}
-	    }
-	}
+	set_cd_mask(pd, y, cd_mask);
 
       stp_dither(v, y, duplicate_line, zero_mask, cd_mask);
 
@@ -4493,6 +4769,14 @@ escp2_do_print(stp_vars_t *v, stp_image_t *image, int print_op)
     stp_free(pd->split_channels);
   if (pd->comp_buf)
     stp_free(pd->comp_buf);
+  if (pd->split_comp_bufs)
+    {
+      for (i = 0; i < pd->channels_in_use; i++)
+	STP_SAFE_FREE(pd->split_comp_bufs[i]);
+      stp_free(pd->split_comp_bufs);
+      stp_free(pd->split_comp_sizes);
+      stp_free(pd->split_comp_lens);
+    }
   stp_free(pd);
 
   return status;
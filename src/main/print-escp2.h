@@ -565,6 +565,7 @@ typedef struct
   const stp_raw_t *printer_weave; /* Printer weave parameters */
   int use_printer_weave;	/* Use the printer weaving mechanism */
   int extra_vertical_passes;	/* Quality enhancement */
+  int pipeline_depth;		/* Rows buffered between threaded stages */
 
   /* page parameters */		/* Indexed from top left */
   int page_left;		/* Left edge of page (points) */
@@ -601,6 +602,10 @@ typedef struct
   int last_pass_offset;		/* Starting row of last pass we printed */
   int last_pass;		/* Last pass printed */
   unsigned char *comp_buf;	/* Compression buffer for C120-type printers */
+  int compression_threads;	/* Threads compressing split channels */
+  unsigned char **split_comp_bufs; /* Compressed pass data per channel */
+  size_t *split_comp_sizes;	/* Allocated size of split_comp_bufs */
+  size_t *split_comp_lens;	/* Compressed bytes per split channel */
 
 } escp2_privdata_t;
 
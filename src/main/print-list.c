@@ -44,8 +44,26 @@ struct stp_list_item
   void *data;			/*!< Data		*/
   struct stp_list_item *prev;	/*!< Previous node	*/
   struct stp_list_item *next;	/*!< Next node		*/
+  struct stp_list_item *chain[2]; /*!< Next nodes in name/long name index */
 };
 
+/** A hash index on the name or long name of the nodes in a list. */
+typedef struct
+{
+  struct stp_list_item **buckets;	/*!< Chains of nodes, or NULL	*/
+  size_t size;				/*!< Number of buckets (2^n)	*/
+} stp_list_index_t;
+
+#define INDEX_NAME	0
+#define INDEX_LONG_NAME	1
+
+/*
+ * Lists shorter than this are searched linearly; longer lists with a
+ * name function get a hash index, which item creation and destruction
+ * keep up to date.
+ */
+#define INDEX_MIN_LENGTH 16
+
 /** The internal representation of an stp_list_t list. */
 struct stp_list
 {
@@ -59,61 +77,142 @@ struct stp_list
   stp_node_namefunc namefunc;			/*!< Callback to get node name		*/
   stp_node_namefunc long_namefunc;		/*!< Callback to get node long name	*/
   stp_node_sortfunc sortfunc;			/*!< Callback to compare (sort) nodes	*/
-  char *name_cache;				/*!< Cached name			*/
-  struct stp_list_item *name_cache_node;	/*!< Cached node (for name)		*/
-  char *long_name_cache;			/*!< Cached long name			*/
-  struct stp_list_item *long_name_cache_node;	/*!< Cached node (for long name)	*/
+  stp_list_index_t index[2];			/*!< Name and long name indices		*/
 };
 
 /**
- * Cache a list node by its short name.
+ * Clear cached nodes.
  * @param list the list to use.
- * @param name the short name.
- * @param cache the node to cache.
  */
-static void
-set_name_cache(stp_list_t *list,
-	       const char *name,
-	       stp_list_item_t *cache)
+static inline void
+clear_cache(stp_list_t *list)
+{
+  list->index_cache = 0;
+  list->index_cache_node = NULL;
+}
+
+static inline stp_node_namefunc
+index_namefunc(const stp_list_t *list, int which)
 {
-  if (list->name_cache)
-    stp_free(list->name_cache);
-  list->name_cache = NULL;
+  return which == INDEX_NAME ? list->namefunc : list->long_namefunc;
+}
+
+static inline size_t
+index_hash(const char *name)
+{
+  /* FNV-1a */
+  size_t hash = 2166136261u;
   if (name)
-    list->name_cache = stp_strdup(name);
-  list->name_cache_node = cache;
+    while (*name)
+      hash = (hash ^ (unsigned char) *name++) * 16777619u;
+  return hash;
+}
+
+static inline stp_list_item_t **
+index_bucket(const stp_list_t *list, int which, const stp_list_item_t *node)
+{
+  const stp_list_index_t *index = &(list->index[which]);
+  const char *name = (index_namefunc(list, which))(node->data);
+  return &(index->buckets[index_hash(name) & (index->size - 1)]);
+}
+
+static void
+index_add(stp_list_t *list, int which, stp_list_item_t *node)
+{
+  stp_list_item_t **bucket = index_bucket(list, which, node);
+  node->chain[which] = *bucket;
+  *bucket = node;
+}
+
+static void
+index_remove(stp_list_t *list, int which, stp_list_item_t *node)
+{
+  stp_list_item_t **bucket = index_bucket(list, which, node);
+  while (*bucket && *bucket != node)
+    bucket = &((*bucket)->chain[which]);
+  if (*bucket)
+    *bucket = node->chain[which];
+  node->chain[which] = NULL;
+}
+
+static void
+index_free(stp_list_t *list, int which)
+{
+  STP_SAFE_FREE(list->index[which].buckets);
+  list->index[which].size = 0;
 }
 
 /**
- * Cache a list node by its long name.
+ * (Re)build the index on names or long names if the list is long enough
+ * to need one, sized for the current length of the list.
  * @param list the list to use.
- * @param long_name the long name.
- * @param cache the node to cache.
+ * @param which INDEX_NAME or INDEX_LONG_NAME.
  */
 static void
-set_long_name_cache(stp_list_t *list,
-		    const char *long_name,
-		    stp_list_item_t *cache)
+index_build(stp_list_t *list, int which)
 {
-  if (list->long_name_cache)
-    stp_free(list->long_name_cache);
-  list->long_name_cache = NULL;
-  if (long_name)
-    list->long_name_cache = stp_strdup(long_name);
-  list->long_name_cache_node = cache;
+  stp_list_index_t *index = &(list->index[which]);
+  stp_list_item_t *node;
+  size_t size = 32;
+
+  index_free(list, which);
+  if (!index_namefunc(list, which) || list->length < INDEX_MIN_LENGTH)
+    return;
+  while (size < list->length)
+    size *= 2;
+  index->buckets = stp_zalloc(size * sizeof(stp_list_item_t *));
+  index->size = size;
+  for (node = list->start; node; node = node->next)
+    index_add(list, which, node);
+  stp_deprintf(STP_DBG_LIST, "stp_list index %d built, %lu buckets\n",
+	       which, (unsigned long) size);
 }
 
 /**
- * Clear cached nodes.
+ * Keep the indices current after a node has been added to the list.
  * @param list the list to use.
+ * @param node the new node.
  */
-static inline void
-clear_cache(stp_list_t *list)
+static void
+index_insert_node(stp_list_t *list, stp_list_item_t *node)
 {
-  list->index_cache = 0;
-  list->index_cache_node = NULL;
-  set_name_cache(list, NULL, NULL);
-  set_long_name_cache(list, NULL, NULL);
+  int which;
+  for (which = INDEX_NAME; which <= INDEX_LONG_NAME; which++)
+    {
+      if (!list->index[which].buckets ||
+	  list->length > 2 * list->index[which].size)
+	index_build(list, which);
+      else
+	index_add(list, which, node);
+    }
+}
+
+/**
+ * Find the first node in list order with the given name or long name.
+ * Duplicate names are rare; if the bucket holds more than one match,
+ * the list is searched to find which comes first.
+ * @returns the node, or NULL if there is no node of that name.
+ */
+static stp_list_item_t *
+index_find(const stp_list_t *list, int which, const char *name)
+{
+  const stp_list_index_t *index = &(list->index[which]);
+  stp_node_namefunc namefunc = index_namefunc(list, which);
+  stp_list_item_t *node = index->buckets[index_hash(name) & (index->size - 1)];
+  stp_list_item_t *found = NULL;
+
+  for (; node; node = node->chain[which])
+    if (strcmp(name, namefunc(node->data)) == 0)
+      {
+	if (found)
+	  {
+	    for (node = list->start; node; node = node->next)
+	      if (strcmp(name, namefunc(node->data)) == 0)
+		return node;
+	  }
+	found = node;
+      }
+  return found;
 }
 
 void
@@ -148,10 +247,10 @@ stp_list_create(void)
   list->long_namefunc = NULL;
   list->sortfunc = NULL;
   list->copyfunc = NULL;
-  list->name_cache = NULL;
-  list->name_cache_node = NULL;
-  list->long_name_cache = NULL;
-  list->long_name_cache_node = NULL;
+  list->index[INDEX_NAME].buckets = NULL;
+  list->index[INDEX_NAME].size = 0;
+  list->index[INDEX_LONG_NAME].buckets = NULL;
+  list->index[INDEX_LONG_NAME].size = 0;
 
   stp_deprintf(STP_DBG_LIST, "stp_list_head constructor\n");
   return list;
@@ -195,6 +294,8 @@ stp_list_destroy(stp_list_t *list)
 
   check_list(list);
   clear_cache(list);
+  index_free(list, INDEX_NAME);
+  index_free(list, INDEX_LONG_NAME);
   cur = list->start;
   while(cur)
     {
@@ -320,7 +421,6 @@ stp_list_get_item_by_index(const stp_list_t *list, int idx)
 
 /**
  * Find an item in a list by its name.
- * This internal helper is not optimised to use any caching.
  * @param list the list to use.
  * @param name the name to find.
  * @returns a pointer to the list item, or NULL if the name is
@@ -337,63 +437,29 @@ stp_list_get_item_by_name_internal(const stp_list_t *list, const char *name)
   return node;
 }
 
+/*
+ * Lookups by name use the hash index, or search short lists from the
+ * start.  They do not update any cached state in the list.
+ */
+
 /* get the first node with name; requires a callback function to
    read data */
 stp_list_item_t *
 stp_list_get_item_by_name(const stp_list_t *list, const char *name)
 {
-  stp_list_item_t *node = NULL;
-  stp_list_t *ulist = deconst_list(list);
   check_list(list);
 
   if (!list->namefunc || !name)
     return NULL;
 
-  if (list->name_cache && list->name_cache_node)
-    {
-      const char *new_name;
-      node = list->name_cache_node;
-      /* Is this the item we've cached? */
-      if (strcmp(name, list->name_cache) == 0 &&
-	  strcmp(name, list->namefunc(node->data)) == 0)
-	return node;
-
-      /* If not, check the next item in case we're searching the list */
-      node = node->next;
-      if (node)
-	{
-	  new_name = list->namefunc(node->data);
-	  if (strcmp(name, new_name) == 0)
-	    {
-	      set_name_cache(ulist, new_name, node);
-	      return node;
-	    }
-	}
-      /* If not, check the index cache */
-      node = list->index_cache_node;
-      if (node)
-	{
-	  new_name = list->namefunc(node->data);
-	  if (strcmp(name, new_name) == 0)
-	    {
-	      set_name_cache(ulist, new_name, node);
-	      return node;
-	    }
-	}
-    }
-
-  node = stp_list_get_item_by_name_internal(list, name);
-
-  if (node)
-    set_name_cache(ulist, name, node);
-
-  return node;
+  if (list->index[INDEX_NAME].buckets)
+    return index_find(list, INDEX_NAME, name);
+  return stp_list_get_item_by_name_internal(list, name);
 }
 
 
 /**
  * Find an item in a list by its long name.
- * This internal helper is not optimised to use any caching.
  * @param list the list to use.
  * @param long_name the long name to find.
  * @returns a pointer to the list item, or NULL if the long name is
@@ -416,52 +482,14 @@ stp_list_get_item_by_long_name_internal(const stp_list_t *list,
 stp_list_item_t *
 stp_list_get_item_by_long_name(const stp_list_t *list, const char *long_name)
 {
-  stp_list_item_t *node = NULL;
-  stp_list_t *ulist = deconst_list(list);
   check_list(list);
 
   if (!list->long_namefunc || !long_name)
     return NULL;
 
-  if (list->long_name_cache && list->long_name_cache_node)
-    {
-      const char *new_long_name;
-      node = list->long_name_cache_node;
-      /* Is this the item we've cached? */
-      if (strcmp(long_name, list->long_name_cache) == 0 &&
-	  strcmp(long_name, list->long_namefunc(node->data)) == 0)
-	return node;
-
-      /* If not, check the next item in case we're searching the list */
-      node = node->next;
-      if (node)
-	{
-	  new_long_name = list->long_namefunc(node->data);
-	  if (strcmp(long_name, new_long_name) == 0)
-	    {
-	      set_long_name_cache(ulist, new_long_name, node);
-	      return node;
-	    }
-	}
-      /* If not, check the index cache */
-      node = list->index_cache_node;
-      if (node)
-	{
-	  new_long_name = list->long_namefunc(node->data);
-	  if (strcmp(long_name, new_long_name) == 0)
-	    {
-	      set_long_name_cache(ulist, new_long_name, node);
-	      return node;
-	    }
-	}
-    }
-
-  node = stp_list_get_item_by_long_name_internal(list, long_name);
-
-  if (node)
-    set_long_name_cache(ulist, long_name, node);
-
-  return node;
+  if (list->index[INDEX_LONG_NAME].buckets)
+    return index_find(list, INDEX_LONG_NAME, long_name);
+  return stp_list_get_item_by_long_name_internal(list, long_name);
 }
 
 
@@ -501,6 +529,7 @@ stp_list_set_namefunc(stp_list_t *list, stp_node_namefunc namefunc)
 {
   check_list(list);
   list->namefunc = namefunc;
+  index_build(list, INDEX_NAME);
 }
 
 stp_node_namefunc
@@ -516,6 +545,7 @@ stp_list_set_long_namefunc(stp_list_t *list, stp_node_namefunc long_namefunc)
 {
   check_list(list);
   list->long_namefunc = long_namefunc;
+  index_build(list, INDEX_LONG_NAME);
 }
 
 stp_node_namefunc
@@ -566,6 +596,7 @@ stp_list_item_create(stp_list_t *list,
 
   ln = stp_malloc(sizeof(stp_list_item_t));
   ln->prev = ln->next = NULL;
+  ln->chain[INDEX_NAME] = ln->chain[INDEX_LONG_NAME] = NULL;
 
   if (data)
     ln->data = stpi_cast_safe(data);
@@ -646,6 +677,8 @@ stp_list_item_create(stp_list_t *list,
   /* increment reference count */
   list->length++;
 
+  index_insert_node(list, ln);
+
   stp_deprintf(STP_DBG_LIST, "stp_list_node constructor\n");
   return 0;
 }
@@ -660,6 +693,11 @@ stp_list_item_destroy(stp_list_t *list, stp_list_item_t *item)
   /* decrement reference count */
   list->length--;
 
+  /* The node's name is needed to find it, so do this before freeing */
+  if (list->index[INDEX_NAME].buckets)
+    index_remove(list, INDEX_NAME, item);
+  if (list->index[INDEX_LONG_NAME].buckets)
+    index_remove(list, INDEX_LONG_NAME, item);
   if (list->freefunc)
     list->freefunc((void *) item->data);
   if (item->prev)
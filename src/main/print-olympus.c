@@ -197,6 +197,10 @@ typedef struct {
   int row_interlacing;
   unsigned char empty_byte[MAX_INK_CHANNELS];  /* one for each color plane */
   unsigned short **image_data;
+  unsigned short *image_buf;	/* Page, or current row when streaming */
+  stp_image_t *image;		/* Source of rows when streaming */
+  int streaming;		/* Convert rows as they are printed */
+  int stream_error;
   int outh_px, outw_px, outt_px, outb_px, outl_px, outr_px;
   int imgh_px, imgw_px;
   int prnh_px, prnw_px, prnt_px, prnb_px, prnl_px, prnr_px;
@@ -5536,57 +5540,102 @@ dyesub_interpolate(int oldval, int oldsize, int newsize)
 static void
 dyesub_free_image(dyesub_print_vars_t *pv, stp_image_t *image)
 {
-  unsigned short** image_data = pv->image_data;
-  int image_px_height = pv->image_rows;
-  int i;
+  STP_SAFE_FREE(pv->image_data);
+  STP_SAFE_FREE(pv->image_buf);
+}
 
-  for (i = 0; i< image_px_height; i++)
-    if (image_data[i])
-      stp_free(image_data[i]);
-  if (image_data)
-    stp_free(image_data);
+/*
+ * Return the converted data for an image row.  When streaming, rows are
+ * requested in nondecreasing order; any rows skipped over are still read
+ * so that the image is consumed in sequence.
+ */
+static inline const unsigned short *
+dyesub_image_row(stp_vars_t *v, dyesub_print_vars_t *pv, int row)
+{
+  unsigned int zero_mask;
+  if (!pv->streaming)
+    return pv->image_data[row];
+  while (pv->image_rows <= row)
+    {
+      if (stp_color_get_row(v, pv->image, pv->image_rows, &zero_mask))
+	{
+	  stp_deprintf(STP_DBG_DYESUB,
+		       "dyesub_image_row: "
+		       "stp_color_get_row(..., %d, ...) == 0\n",
+		       pv->image_rows);
+	  pv->stream_error = 1;
+	}
+      else if (pv->image_rows == row)
+	memcpy(pv->image_buf, stp_channel_get_output(v),
+	       pv->imgw_px * pv->ink_channels * sizeof(unsigned short));
+      pv->image_rows++;
+    }
+  return pv->image_buf;
 }
 
-static unsigned short **
+/*
+ * Printers that take the whole page in one pass, in portrait mode, consume
+ * the image rows in order, so each row can be converted as it is needed
+ * and only one row is held in memory.  Otherwise (separate passes per
+ * plane, or a rotated image) the page is buffered in a single allocation.
+ */
+static int
 dyesub_read_image(stp_vars_t *v,
 		dyesub_print_vars_t *pv,
 		stp_image_t *image)
 {
   int image_px_width  = stp_image_width(image);
   int image_px_height = stp_image_height(image);
-  int row_size = image_px_width * pv->ink_channels * sizeof(short);
-  unsigned short **image_data;
-  unsigned int zero_mask;
+  size_t row_size = image_px_width * pv->ink_channels;
   int i;
 
-  image_data = stp_zalloc(image_px_height * sizeof(unsigned short *));
   pv->image_rows = 0;
-  if (!image_data)
-    return NULL;	/* ? out of memory ? */
+  pv->image = image;
+  pv->streaming = !pv->plane_interlacing &&
+    pv->print_mode != DYESUB_LANDSCAPE;
+  stp_deprintf(STP_DBG_DYESUB, "dyesub_read_image: %s\n",
+	       pv->streaming ? "streaming" : "buffered");
 
-  for (i = 0; i < image_px_height; i++)
+  if (pv->streaming)
     {
-      if (stp_color_get_row(v, image, i, &zero_mask))
-        {
-	  stp_deprintf(STP_DBG_DYESUB,
-	  	"dyesub_read_image: "
-		"stp_color_get_row(..., %d, ...) == 0\n", i);
-	  dyesub_free_image(pv, image);
-	  return NULL;
-	}	
-      image_data[i] = stp_malloc(row_size);
-      pv->image_rows = i+1;
-      if (!image_data[i])
-        {
-	  stp_deprintf(STP_DBG_DYESUB,
-	  	"dyesub_read_image: "
-		"(image_data[%d] = stp_malloc()) == NULL\n", i);
+      /*
+       * Read the first row now, so that the color conversion is set up
+       * before the driver adjusts the curves, as in the buffered case.
+       */
+      pv->image_buf = stp_zalloc(row_size * sizeof(unsigned short));
+      if (!pv->image_buf)
+	return 0;
+      (void) dyesub_image_row(v, pv, 0);
+      if (pv->stream_error)
+	{
 	  dyesub_free_image(pv, image);
-	  return NULL;
-	}	
-      memcpy(image_data[i], stp_channel_get_output(v), row_size);
+	  return 0;
+	}
+      return 1;
+    }
+
+  pv->image_data = stp_malloc(image_px_height * sizeof(unsigned short *));
+  pv->image_buf = stp_malloc(image_px_height * row_size *
+			     sizeof(unsigned short));
+  if (!pv->image_data || !pv->image_buf)
+    {
+      stp_deprintf(STP_DBG_DYESUB,
+		   "dyesub_read_image: stp_malloc() == NULL\n");
+      dyesub_free_image(pv, image);
+      return 0;	/* ? out of memory ? */
     }
-  return image_data;
+
+  for (i = 0; i < image_px_height; i++)
+    pv->image_data[i] = pv->image_buf + i * row_size;
+  if (stpi_color_get_rows(v, image, 0, image_px_height, pv->image_buf, NULL))
+    {
+      stp_deprintf(STP_DBG_DYESUB,
+		   "dyesub_read_image: stpi_color_get_rows(...) != 0\n");
+      dyesub_free_image(pv, image);
+      return 0;
+    }
+  pv->image_rows = image_px_height;
+  return 1;
 }
 
 static int
@@ -5597,7 +5646,8 @@ dyesub_print_pixel(stp_vars_t *v,
 		int col,
 		int plane)
 {
-  unsigned short ink[MAX_INK_CHANNELS], *out;
+  unsigned short ink[MAX_INK_CHANNELS];
+  const unsigned short *out;
   int i, j, b;
 
   if (pv->print_mode == DYESUB_LANDSCAPE)
@@ -5606,7 +5656,7 @@ dyesub_print_pixel(stp_vars_t *v,
       row = (pv->imgw_px - 1) - row;
     }
 
-  out = &(pv->image_data[row][col * pv->out_channels]);
+  out = &(dyesub_image_row(v, pv, row)[col * pv->out_channels]);
 
   for (i = 0; i < pv->ink_channels; i++)
     {
@@ -5911,7 +5961,15 @@ dyesub_do_print(stp_vars_t *v, stp_image_t *image)
 #endif    
   }
 
-  pv.image_data = dyesub_read_image(v, &pv, image);
+  pv.plane_interlacing = dyesub_feature(caps, DYESUB_FEATURE_PLANE_INTERLACE);
+  pv.row_interlacing = dyesub_feature(caps, DYESUB_FEATURE_ROW_INTERLACE);
+  pv.plane_lefttoright = dyesub_feature(caps, DYESUB_FEATURE_PLANE_LEFTTORIGHT);
+  pv.print_mode = page_mode;
+  if (!dyesub_read_image(v, &pv, image))
+    {
+      stp_image_conclude(image);
+      return 2;
+    }
   if (ink_type) {
 	  if (dyesub_feature(caps, DYESUB_FEATURE_RGBtoYCBCR)) {
 		  pv.empty_byte[0] = 0xff; /* Y */
@@ -5931,16 +5989,7 @@ dyesub_do_print(stp_vars_t *v, stp_image_t *image)
 	  pv.empty_byte[1] = 0x0;
 	  pv.empty_byte[2] = 0x0;
   }
-  
-  pv.plane_interlacing = dyesub_feature(caps, DYESUB_FEATURE_PLANE_INTERLACE);
-  pv.row_interlacing = dyesub_feature(caps, DYESUB_FEATURE_ROW_INTERLACE);
-  pv.plane_lefttoright = dyesub_feature(caps, DYESUB_FEATURE_PLANE_LEFTTORIGHT);
-  pv.print_mode = page_mode;
-  if (!pv.image_data)
-    {
-      stp_image_conclude(image);
-      return 2;
-    }
+
   /* /FIXME */
 
   /* FIXME:  Provide a way of disabling/altering these curves */
@@ -6020,6 +6069,14 @@ dyesub_do_print(stp_vars_t *v, stp_image_t *image)
   /* printer end */
   dyesub_exec(v, caps->printer_end_func, "caps->printer_end");
 
+  if (pv.streaming)
+    {
+      /* Read any rows below the printed area */
+      if (pv.image_rows < pv.imgh_px)
+	(void) dyesub_image_row(v, &pv, pv.imgh_px - 1);
+      if (pv.stream_error)
+	status = 2;
+    }
   dyesub_free_image(&pv, image);
   stp_image_conclude(image);
   return status;
@@ -44,16 +44,26 @@
  */
 static void	pcl_mode0(stp_vars_t *, unsigned char *, int, int);
 static void	pcl_mode2(stp_vars_t *, unsigned char *, int, int);
+static void	pcl_mode3(stp_vars_t *, unsigned char *, int, int);
 
 #ifndef MAX
 #  define MAX(a, b) ((a) > (b) ? (a) : (b))
 #endif /* !MAX */
 
+#define PCL_MAX_PLANES		12	/* 6 colors, 2 planes each with CRet */
+
 typedef struct
 {
   int do_blank;
   int blank_lines;
   unsigned char *comp_buf;
+  unsigned char *delta_buf;	/* Mode 3 data for each plane of the row */
+  unsigned char *seed_rows;	/* Previous row of each plane */
+  int comp_size;		/* Size of each plane's slot in the buffers */
+  int plane;			/* Plane of the current row being sent */
+  int comp_mode;		/* Compression mode the printer is in */
+  int tiff_len[PCL_MAX_PLANES];
+  int delta_len[PCL_MAX_PLANES];
   void (*writefunc)(stp_vars_t *, unsigned char *, int, int);	/* PCL output function */
   int do_cret;
   int do_cretb;
@@ -330,6 +340,7 @@ typedef struct {
 #define PCL_PRINTER_CUSTOM_SIZE	32	/* Custom sizes supported */
 #define PCL_PRINTER_BLANKLINE	64	/* Blank line removal supported */
 #define PCL_PRINTER_DUPLEX	128	/* Printer can have duplexer */
+#define PCL_PRINTER_DELTA_ROW	256	/* Mode 3 (delta row) compression */
 
 /*
  * FIXME - the 520 shouldn't be lumped in with the 500 as it supports
@@ -810,7 +821,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {7, 41, 18, 18},
     {7, 41, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_DJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_DJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     dj500_papersizes,
     basic_papertypes,
     dj_papersources,
@@ -823,7 +835,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {7, 33, 18, 18},
     {7, 33, 10, 10},	/* Check/Fix */
     PCL_COLOR_CMY,
-    PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     dj500_papersizes,
     basic_papertypes,
     dj_papersources,
@@ -850,7 +863,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {3, 33, 18, 18},
     {5, 33, 10, 10},
     PCL_COLOR_CMYK,
-    PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_DJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
 /* The 550/560 support COM10 and DL envelope, but the control codes
    are negative, indicating landscape mode. This needs thinking about! */
     dj340_papersizes,
@@ -1098,7 +1112,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     ljsmall_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1111,7 +1126,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     ljsmall_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1124,7 +1140,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},
     {12, 12, 18, 18},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     ljsmall_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1137,7 +1154,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1150,7 +1168,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},
     {12, 12, 18, 18},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1163,7 +1182,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},
     {12, 12, 18, 18},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_LJ | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     ljtabloid_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1176,7 +1196,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     ljsmall_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1189,7 +1210,8 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
-    PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE,
+    PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
+      PCL_PRINTER_DELTA_ROW,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1203,7 +1225,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX | PCL_PRINTER_DELTA_ROW,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1217,7 +1239,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX | PCL_PRINTER_DELTA_ROW,
     ljsmall_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1231,7 +1253,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX | PCL_PRINTER_DELTA_ROW,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1245,7 +1267,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX | PCL_PRINTER_DELTA_ROW,
     ljsmall_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1259,7 +1281,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX | PCL_PRINTER_DELTA_ROW,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1273,7 +1295,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 18, 18},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX | PCL_PRINTER_DELTA_ROW,
     ljtabloid_papersizes,
     emptylist,
     laserjet_papersources,
@@ -1287,7 +1309,7 @@ static const pcl_cap_t pcl_model_capabilities[] =
     {12, 12, 10, 10},	/* Check/Fix */
     PCL_COLOR_NONE,
     PCL_PRINTER_LJ | PCL_PRINTER_NEW_ERG | PCL_PRINTER_TIFF | PCL_PRINTER_BLANKLINE |
-      PCL_PRINTER_DUPLEX,
+      PCL_PRINTER_DUPLEX | PCL_PRINTER_DELTA_ROW,
     ljbig_papersizes,
     emptylist,
     laserjet_papersources,
@@ -2165,6 +2187,8 @@ pcl_printfunc(stp_vars_t *v)
 	      stp_deprintf(STP_DBG_PCL, "Blank Lines = %d\n", pd->blank_lines);
 	      stp_zprintf(v, "\033*b%dY", pd->blank_lines);
 	      pd->blank_lines=0;
+	      if (pd->seed_rows)	/* Vertical moves clear the seed rows */
+		memset(pd->seed_rows, 0, PCL_MAX_PLANES * pd->height);
 	    }
 	  else;
 	}
@@ -2747,11 +2771,33 @@ pcl_do_print(stp_vars_t *v, stp_image_t *image)
 
 /* Allocate buffer for pcl_mode2 tiff compression */
 
+  privdata.delta_buf = NULL;
+  privdata.seed_rows = NULL;
   if ((caps->stp_printer_type & PCL_PRINTER_TIFF) == PCL_PRINTER_TIFF &&
       !(stp_get_debug_level() & STP_DBG_NO_COMPRESSION))
   {
-    privdata.comp_buf = stp_malloc((privdata.height + 128 + 7) * 129 / 128);
-    privdata.writefunc = pcl_mode2;
+    privdata.comp_size = (privdata.height + 128 + 7) * 129 / 128;
+    if ((caps->stp_printer_type & PCL_PRINTER_DELTA_ROW) ==
+	PCL_PRINTER_DELTA_ROW)
+    {
+     /*
+      * Both encodings of every plane of a row are kept until the row is
+      * complete, so that the whole row can be sent in the smaller one.
+      */
+      privdata.comp_size = MAX(privdata.comp_size,
+			       (privdata.height + 7) / 8 * 9);
+      privdata.comp_buf = stp_malloc(PCL_MAX_PLANES * privdata.comp_size);
+      privdata.delta_buf = stp_malloc(PCL_MAX_PLANES * privdata.comp_size);
+      privdata.seed_rows = stp_zalloc(PCL_MAX_PLANES * privdata.height);
+      privdata.plane = 0;
+      privdata.comp_mode = 2;
+      privdata.writefunc = pcl_mode3;
+    }
+    else
+    {
+      privdata.comp_buf = stp_malloc(privdata.comp_size);
+      privdata.writefunc = pcl_mode2;
+    }
   }
   else
   {
@@ -2948,6 +2994,8 @@ pcl_do_print(stp_vars_t *v, stp_image_t *image)
 
   if (privdata.comp_buf != NULL)
     stp_free(privdata.comp_buf);
+  STP_SAFE_FREE(privdata.delta_buf);
+  STP_SAFE_FREE(privdata.seed_rows);
 
   if ((caps->stp_printer_type & PCL_PRINTER_NEW_ERG) == PCL_PRINTER_NEW_ERG)
     stp_puts("\033*rC", v);
@@ -3036,6 +3084,150 @@ pcl_mode2(stp_vars_t *v,		/* I - Print file or command */
 }
 
 
+/*
+ * 'pcl_pack_delta()' - Encode a line as mode 3 (delta row) replacements
+ *                      against the seed row, returning the encoded length.
+ */
+
+static int
+pcl_pack_delta(const unsigned char *line,	/* I - Output bitmap data */
+	       const unsigned char *seed,	/* I - Previous row of plane */
+	       int           height,		/* I - Height of bitmap data */
+	       unsigned char *comp_buf)		/* O - Encoded data */
+{
+  unsigned char	*comp_ptr = comp_buf;	/* Current slot in buffer */
+  int		last = 0;		/* First byte after last replacement */
+  int		i = 0;
+
+  while (i < height)
+  {
+    int start, count, offset;
+
+    if (line[i] == seed[i])
+    {
+      i++;
+      continue;
+    }
+
+   /*
+    * Each command replaces up to 8 bytes; the offset counts the unchanged
+    * bytes since the previous replacement, with 31 meaning that further
+    * offset bytes follow.
+    */
+
+    start = i;
+    do
+      i++;
+    while (i < height && i - start < 8 && line[i] != seed[i]);
+    count = i - start;
+    offset = start - last;
+    if (offset < 31)
+      *comp_ptr++ = ((count - 1) << 5) | offset;
+    else
+    {
+      *comp_ptr++ = ((count - 1) << 5) | 31;
+      offset -= 31;
+      while (offset >= 255)
+      {
+	*comp_ptr++ = 255;
+	offset -= 255;
+      }
+      *comp_ptr++ = offset;
+    }
+    memcpy(comp_ptr, line + start, count);
+    comp_ptr += count;
+    last = i;
+  }
+  return comp_ptr - comp_buf;
+}
+
+
+/*
+ * 'pcl_mode3()' - Send PCL graphics using mode 2 (TIFF) or mode 3 (delta
+ *                 row) compression, whichever is smaller for the row.
+ */
+
+static void
+pcl_mode3(stp_vars_t *v,		/* I - Print file or command */
+          unsigned char *line,		/* I - Output bitmap data */
+          int           height,		/* I - Height of bitmap data */
+          int           last_plane)	/* I - True if this is the last plane */
+{
+  pcl_privdata_t *privdata =
+    (pcl_privdata_t *) stp_get_component_data(v, "Driver");
+  int		plane = privdata->plane;
+  unsigned char	*comp_buf = privdata->comp_buf + plane * privdata->comp_size;
+  unsigned char	*seed = privdata->seed_rows + plane * privdata->height;
+  unsigned char	*comp_ptr;		/* Current slot in buffer */
+  int		tiff_total = 0;
+  int		delta_total = 0;
+  int		mode;
+  int		i;
+
+  stp_pack_tiff(v, line, height, comp_buf, &comp_ptr, NULL, NULL);
+  privdata->tiff_len[plane] = comp_ptr - comp_buf;
+  privdata->delta_len[plane] =
+    pcl_pack_delta(line, seed, height,
+		   privdata->delta_buf + plane * privdata->comp_size);
+
+ /*
+  * Whatever the mode, the row just sent becomes the seed row for the
+  * next row of this plane.
+  */
+
+  memcpy(seed, line, height);
+  if (!last_plane && plane < PCL_MAX_PLANES - 1)
+  {
+    privdata->plane++;
+    return;
+  }
+
+ /*
+  * Switching modes costs an escape sequence, and usually another one to
+  * switch back later, so only switch when that still leaves us ahead.
+  */
+
+  for (i = 0; i <= plane; i++)
+  {
+    tiff_total += privdata->tiff_len[i];
+    delta_total += privdata->delta_len[i];
+  }
+  if (privdata->comp_mode == 3)
+    tiff_total += 10;
+  else
+    delta_total += 10;
+  mode = delta_total < tiff_total ? 3 : 2;
+  if (mode != privdata->comp_mode)
+  {
+    stp_zprintf(v, "\033*b%dM", mode);
+    privdata->comp_mode = mode;
+  }
+
+ /*
+  * Send a line of raster graphics...
+  */
+
+  for (i = 0; i <= plane; i++)
+  {
+    const unsigned char *data;
+    int len;
+    if (mode == 3)
+    {
+      data = privdata->delta_buf + i * privdata->comp_size;
+      len = privdata->delta_len[i];
+    }
+    else
+    {
+      data = privdata->comp_buf + i * privdata->comp_size;
+      len = privdata->tiff_len[i];
+    }
+    stp_zprintf(v, "\033*b%d%c", len, i == plane && last_plane ? 'W' : 'V');
+    stp_zfwrite((const char *)data, len, 1, v);
+  }
+  privdata->plane = 0;
+}
+
+
 static stp_family_t print_pcl_module_data =
   {
     &print_pcl_printfuncs,
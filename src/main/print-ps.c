@@ -47,6 +47,14 @@
 #define strcasecmp(s,t) _stricmp(s,t)
 #endif
 
+#if defined(HAVE_EMMINTRIN_H) && defined(__GNUC__) && \
+  (defined(__i386__) || defined(__x86_64__))
+#define STPI_PS_SSE2
+#include <emmintrin.h>
+
+#define SSE2_FUNC __attribute__((__target__("sse2")))
+#endif
+
 /*
  * Local variables...
  */
@@ -59,8 +67,19 @@ static stp_mxml_node_t *m_ppd = NULL;
  * Local functions...
  */
 
-static void	ps_hex(const stp_vars_t *, unsigned short *, int);
-static void	ps_ascii85(const stp_vars_t *, unsigned short *, int, int);
+static void	ps_narrow_row(const unsigned short *, unsigned char *, int);
+static void	ps_hex(const stp_vars_t *, const unsigned char *, int);
+static void	ps_ascii85(const stp_vars_t *, const unsigned char *, int, int);
+static void	ps_flush(const stp_vars_t *);
+
+#define PS_OUTBUF_SIZE 16384
+
+typedef struct
+{
+  int ascii85_column;		/* Current column of the ASCII85 stream */
+  int outbuf_used;		/* Encoded bytes waiting to be written */
+  unsigned char *outbuf;	/* PS_OUTBUF_SIZE bytes plus slack */
+} ps_privdata_t;
 
 static const stp_parameter_t the_parameters[] =
 {
@@ -88,6 +107,12 @@ static const stp_parameter_t the_parameters[] =
     STP_PARAMETER_TYPE_STRING_LIST, STP_PARAMETER_CLASS_CORE,
     STP_PARAMETER_LEVEL_BASIC, 1, 1, STP_CHANNEL_NONE, 1, 0
   },
+  {
+    "ImageCompression", N_("Image Compression"), "Color=No,Category=Advanced Printer Setup",
+    N_("Compression of the image data (PostScript Level 2 and above)"),
+    STP_PARAMETER_TYPE_STRING_LIST, STP_PARAMETER_CLASS_FEATURE,
+    STP_PARAMETER_LEVEL_ADVANCED, 1, 1, STP_CHANNEL_NONE, 1, 0
+  },
 };
 
 static const int the_parameter_count =
@@ -337,6 +362,18 @@ ps_parameters_internal(const stp_vars_t *v, const char *name,
 	      description->is_active = 0;
 	    return;
 	  }
+	else if (strcmp(name, "ImageCompression") == 0)
+	  {
+	    description->bounds.str = stp_string_list_create();
+	    stp_string_list_add_string
+	      (description->bounds.str, "None", _("None"));
+	    stp_string_list_add_string
+	      (description->bounds.str, "RunLength", _("Run Length"));
+	    description->deflt.str =
+	      stp_string_list_param(description->bounds.str, 0)->name;
+	    description->is_active = stp_get_model_id(v) > 0;
+	    return;
+	  }
       }
   }
 
@@ -919,6 +956,7 @@ ps_print_internal(stp_vars_t *v, stp_image_t *image)
 		image_width;
   int		color_out = 0;
   int		cmyk_out = 0;
+  ps_privdata_t	privdata;
 
   if (print_mode && strcmp(print_mode, "Color") == 0)
     color_out = 1;
@@ -1022,8 +1060,15 @@ ps_print_internal(stp_vars_t *v, stp_image_t *image)
 
   out_channels = stp_color_init(v, image, 256);
 
+  privdata.ascii85_column = 0;
+  privdata.outbuf_used = 0;
+  privdata.outbuf = stp_malloc(PS_OUTBUF_SIZE + 16);
+  stp_allocate_component_data(v, "Driver", NULL, NULL, &privdata);
+
   if (model == 0)
   {
+    unsigned char *row_buf = stp_malloc(image_width * out_channels);
+
     stp_zprintf(v, "/picture %d string def\n", image_width * out_channels);
 
     stp_zprintf(v, "%d %d 8\n", image_width, image_height);
@@ -1061,13 +1106,20 @@ ps_print_internal(stp_vars_t *v, stp_image_t *image)
 	      pos[3] = p0;
 	    }
 	}
-      ps_hex(v, out, image_width * out_channels);
+      ps_narrow_row(out, row_buf, image_width * out_channels);
+      ps_hex(v, row_buf, image_width * out_channels);
     }
+    stp_free(row_buf);
   }
   else
   {
-    unsigned short *tmp_buf =
-      stp_malloc(sizeof(unsigned short) * (image_width * out_channels + 4));
+    int row_bytes = image_width * out_channels;
+    const char *compression = stp_get_string_parameter(v, "ImageCompression");
+    int use_rle = compression && strcmp(compression, "RunLength") == 0;
+    unsigned char *row_buf = stp_malloc(row_bytes + 4);
+    unsigned char *comp_buf = NULL;
+    if (use_rle)
+      comp_buf = stp_malloc((row_bytes + 128 + 7) * 129 / 128 + 4);
     if (cmyk_out)
       stp_puts("/DeviceCMYK setcolorspace\n", v);
     else if (color_out)
@@ -1089,7 +1141,10 @@ ps_print_internal(stp_vars_t *v, stp_image_t *image)
     else
       stp_puts("\t/Decode [ 0 1 ]\n", v);
 
-    stp_puts("\t/DataSource currentfile /ASCII85Decode filter\n", v);
+    if (use_rle)
+      stp_puts("\t/DataSource currentfile /ASCII85Decode filter /RunLengthDecode filter\n", v);
+    else
+      stp_puts("\t/DataSource currentfile /ASCII85Decode filter\n", v);
 
     if ((image_width * 72 / out_width) < 100)
       stp_puts("\t/Interpolate true\n", v);
@@ -1099,9 +1154,16 @@ ps_print_internal(stp_vars_t *v, stp_image_t *image)
     stp_puts(">>\n", v);
     stp_puts("image\n", v);
 
+   /*
+    * ASCII85 encodes groups of 4 bytes, so whatever doesn't fill a group
+    * at the end of a row is carried over to the start of the next one.
+    */
+
     for (y = 0, out_offset = 0; y < image_height; y ++)
     {
-      unsigned short *where;
+      unsigned char *where;
+      unsigned char *bytes;
+      int x;
       /* FIXME!!! */
       if (stp_color_get_row(v, image, y /*, out + out_offset */ , &zero_mask))
 	{
@@ -1109,20 +1171,11 @@ ps_print_internal(stp_vars_t *v, stp_image_t *image)
 	  break;
 	}
       out = stp_channel_get_input(v);
-      if (out_offset > 0)
-	{
-	  memcpy(tmp_buf + out_offset, out,
-		 image_width * out_channels * sizeof(unsigned short));
-	  where = tmp_buf;
-	}
-      else
-	where = out;
 
       /* Convert from KCMY to CMYK */
       if (cmyk_out)
 	{
-	  int x;
-	  unsigned short *pos = where;
+	  unsigned short *pos = out;
 	  for (x = 0; x < image_width; x++, pos += 4)
 	    {
 	      unsigned short p0 = pos[0];
@@ -1133,7 +1186,21 @@ ps_print_internal(stp_vars_t *v, stp_image_t *image)
 	    }
 	}
 
-      out_ps_height = out_offset + image_width * out_channels;
+      where = use_rle ? comp_buf : row_buf;
+      bytes = use_rle ? row_buf : row_buf + out_offset;
+      ps_narrow_row(out, bytes, row_bytes);
+
+      if (use_rle)
+	{
+	  unsigned char *comp_ptr;
+	  stp_pack_tiff(v, bytes, row_bytes, where + out_offset, &comp_ptr,
+			NULL, NULL);
+	  out_ps_height = comp_ptr - where;
+	  if (y == image_height - 1)
+	    where[out_ps_height++] = 128;	/* End of data */
+	}
+      else
+	out_ps_height = out_offset + row_bytes;
 
       if (y < (image_height - 1))
       {
@@ -1147,11 +1214,13 @@ ps_print_internal(stp_vars_t *v, stp_image_t *image)
       }
 
       if (out_offset > 0)
-        memcpy(tmp_buf, where + out_ps_height - out_offset,
-	       out_offset * sizeof(unsigned short));
+        memmove(where, where + out_ps_height - out_offset, out_offset);
     }
-    stp_free(tmp_buf);
+    stp_free(row_buf);
+    STP_SAFE_FREE(comp_buf);
   }
+  ps_flush(v);
+  stp_free(privdata.outbuf);
   stp_image_conclude(image);
 
   stp_puts("grestore\n", v);
@@ -1189,43 +1258,171 @@ ps_print(const stp_vars_t *v, stp_image_t *image)
 }
 
 
+#ifdef STPI_PS_SSE2
+/*
+ * SSE2 versions of the row narrowing and hex encoding, selected at
+ * runtime like the ones in bit-ops.c.  Each handles as many whole 16
+ * byte blocks as it can; the scalar code finishes the rest.
+ */
+
+static SSE2_FUNC int
+ps_narrow_row_sse2(const unsigned short *data, unsigned char *bytes,
+		   int length)
+{
+  int i;
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      __m128i a = _mm_loadu_si128((const __m128i *) (data + i));
+      __m128i b = _mm_loadu_si128((const __m128i *) (data + i + 8));
+      a = _mm_srli_epi16(a, 8);
+      b = _mm_srli_epi16(b, 8);
+      _mm_storeu_si128((__m128i *) (bytes + i), _mm_packus_epi16(a, b));
+    }
+  return i;
+}
+
+/* Convert nibbles 0-15 to the characters 0-9, A-F */
+static inline SSE2_FUNC __m128i
+ps_hex_digits_sse2(__m128i nibbles)
+{
+  __m128i letters = _mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9));
+  nibbles = _mm_add_epi8(nibbles, _mm_set1_epi8('0'));
+  return _mm_add_epi8(nibbles, _mm_and_si128(letters, _mm_set1_epi8(7)));
+}
+
+static SSE2_FUNC int
+ps_hex_sse2(const unsigned char *data, unsigned char *out, int length)
+{
+  const __m128i mask = _mm_set1_epi8(15);
+  int i;
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      __m128i in = _mm_loadu_si128((const __m128i *) (data + i));
+      __m128i hi = _mm_and_si128(_mm_srli_epi16(in, 4), mask);
+      __m128i lo = _mm_and_si128(in, mask);
+      hi = ps_hex_digits_sse2(hi);
+      lo = ps_hex_digits_sse2(lo);
+      _mm_storeu_si128((__m128i *) (out + 2 * i), _mm_unpacklo_epi8(hi, lo));
+      _mm_storeu_si128((__m128i *) (out + 2 * i + 16),
+		       _mm_unpackhi_epi8(hi, lo));
+    }
+  return i;
+}
+#endif
+
+
+/*
+ * 'ps_narrow_row()' - Reduce a row of 16-bit samples to 8-bit bytes.
+ */
+
+static void
+ps_narrow_row(const unsigned short *data,	/* I - Samples */
+	      unsigned char        *bytes,	/* O - Bytes */
+	      int                  length)	/* I - Number of samples */
+{
+  int		i = 0;			/* Looping var */
+
+#ifdef STPI_PS_SSE2
+  if (stpi_cpu_has_sse2())
+    i = ps_narrow_row_sse2(data, bytes, length);
+#endif
+  for (; i + 4 <= length; i += 4)
+  {
+    bytes[i] = data[i] >> 8;
+    bytes[i + 1] = data[i + 1] >> 8;
+    bytes[i + 2] = data[i + 2] >> 8;
+    bytes[i + 3] = data[i + 3] >> 8;
+  }
+  for (; i < length; i ++)
+    bytes[i] = data[i] >> 8;
+}
+
+
+/*
+ * 'ps_flush()' - Write out any encoded data that is still buffered.
+ */
+
+static void
+ps_flush(const stp_vars_t *v)		/* I - File to print to */
+{
+  ps_privdata_t *pd = (ps_privdata_t *) stp_get_component_data(v, "Driver");
+
+  if (pd->outbuf_used > 0)
+    stp_zfwrite((const char *)pd->outbuf, pd->outbuf_used, 1, v);
+  pd->outbuf_used = 0;
+}
+
+
 /*
  * 'ps_hex()' - Print binary data as a series of hexadecimal numbers.
  */
 
 static void
 ps_hex(const stp_vars_t *v,	/* I - File to print to */
-       unsigned short   *data,	/* I - Data to print */
+       const unsigned char *data,	/* I - Data to print */
        int              length)	/* I - Number of bytes to print */
 {
-  int		col;		/* Current column */
+  ps_privdata_t *pd = (ps_privdata_t *) stp_get_component_data(v, "Driver");
+  unsigned char	*outbuf = pd->outbuf;
+  int		outp = pd->outbuf_used;
   static const char	*hex = "0123456789ABCDEF";
+#ifdef STPI_PS_SSE2
+  int		sse2 = stpi_cpu_has_sse2();
+#endif
 
-  col = 0;
   while (length > 0)
   {
-    unsigned char pixel = (*data & 0xff00) >> 8;
-   /*
-    * Put the hex chars out to the file; note that we don't use stp_zprintf()
-    * for speed reasons...
-    */
-
-    stp_putc(hex[pixel >> 4], v);
-    stp_putc(hex[pixel & 15], v);
+    int count = length > 36 ? 36 : length;	/* 72 columns per line */
+    int i = 0;
 
-    data ++;
-    length --;
+#ifdef STPI_PS_SSE2
+    if (sse2)
+      i = ps_hex_sse2(data, outbuf + outp, count);
+#endif
+    for (; i < count; i ++)
+    {
+      outbuf[outp + 2 * i] = hex[data[i] >> 4];
+      outbuf[outp + 2 * i + 1] = hex[data[i] & 15];
+    }
+    outp += 2 * count;
+    outbuf[outp++] = '\n';
 
-    col += 2;
-    if (col >= 72)
+    if (outp >= PS_OUTBUF_SIZE - 80)
     {
-      col = 0;
-      stp_putc('\n', v);
+      stp_zfwrite((const char *)outbuf, outp, 1, v);
+      outp = 0;
     }
+
+    data += count;
+    length -= count;
   }
+  pd->outbuf_used = outp;
+}
+
+
+/*
+ * 'ps_ascii85_word()' - Encode one 4-byte group as 5 base-85 digits.
+ */
 
-  if (col > 0)
-    stp_putc('\n', v);
+static inline void
+ps_ascii85_word(unsigned      b,	/* I - Binary data word */
+		unsigned char *c)	/* O - ASCII85 encoded chars */
+{
+ /*
+  * Splitting the word at 85^2 lets the two halves be converted
+  * independently; the constant divisors become reciprocal multiplies.
+  */
+
+  unsigned	hi = b / (85 * 85);
+  unsigned	lo = b - hi * (85 * 85);
+  unsigned	top = hi / (85 * 85);
+  unsigned	mid = hi - top * (85 * 85);
+
+  c[0] = top + '!';
+  c[1] = mid / 85 + '!';
+  c[2] = mid % 85 + '!';
+  c[3] = lo / 85 + '!';
+  c[4] = lo % 85 + '!';
 }
 
 
@@ -1235,89 +1432,65 @@ ps_hex(const stp_vars_t *v,	/* I - File to print to */
 
 static void
 ps_ascii85(const stp_vars_t *v,	/* I - File to print to */
-	   unsigned short *data,	/* I - Data to print */
+	   const unsigned char *data,	/* I - Data to print */
 	   int            length,	/* I - Number of bytes to print */
 	   int            last_line)	/* I - Last line of raster data? */
 {
+  ps_privdata_t *pd = (ps_privdata_t *) stp_get_component_data(v, "Driver");
+  unsigned char	*outbuf = pd->outbuf;
+  int		outp = pd->outbuf_used;
+  int		column = pd->ascii85_column;	/* Current column */
   int		i;			/* Looping var */
   unsigned	b;			/* Binary data word */
-  unsigned char	c[5];			/* ASCII85 encoded chars */
-  static int	column = 0;		/* Current column */
-
-#define OUTBUF_SIZE 4096
-  unsigned char outbuffer[OUTBUF_SIZE+10];
-  int outp=0;
 
   while (length > 3)
   {
-    unsigned char d0 = (data[0] & 0xff00) >> 8;
-    unsigned char d1 = (data[1] & 0xff00) >> 8;
-    unsigned char d2 = (data[2] & 0xff00) >> 8;
-    unsigned char d3 = (data[3] & 0xff00) >> 8;
-    b = (((((d0 << 8) | d1) << 8) | d2) << 8) | d3;
+    b = ((unsigned) data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
 
     if (b == 0)
     {
-      outbuffer[outp++]='z';
+      outbuf[outp++] = 'z';
       column ++;
     }
     else
     {
-      outbuffer[outp+4] = (b % 85) + '!';
-      b /= 85;
-      outbuffer[outp+3] = (b % 85) + '!';
-      b /= 85;
-      outbuffer[outp+2] = (b % 85) + '!';
-      b /= 85;
-      outbuffer[outp+1] = (b % 85) + '!';
-      b /= 85;
-      outbuffer[outp] = b + '!';
-
-      outp+=5;
+      ps_ascii85_word(b, outbuf + outp);
+      outp += 5;
       column += 5;
     }
 
     if (column > 72)
     {
-      outbuffer[outp++]='\n';
+      outbuf[outp++] = '\n';
       column = 0;
     }
 
-    if(outp>=OUTBUF_SIZE)
-	{
-		stp_zfwrite((const char *)outbuffer, outp, 1, v);
-		outp=0;
-	}
+    if (outp >= PS_OUTBUF_SIZE)
+    {
+      stp_zfwrite((const char *)outbuf, outp, 1, v);
+      outp = 0;
+    }
 
     data += 4;
     length -= 4;
   }
 
-  if(outp)
-    stp_zfwrite((const char *)outbuffer, outp, 1, v);
-
   if (last_line)
   {
     if (length > 0)
     {
-      for (b = 0, i = length; i > 0; b = (b << 8) | data[0], data ++, i --);
-
-      c[4] = (b % 85) + '!';
-      b /= 85;
-      c[3] = (b % 85) + '!';
-      b /= 85;
-      c[2] = (b % 85) + '!';
-      b /= 85;
-      c[1] = (b % 85) + '!';
-      b /= 85;
-      c[0] = b + '!';
-
-      stp_zfwrite((const char *)c, length + 1, 1, v);
+      for (b = 0, i = 0; i < 4; i ++)
+	b = (b << 8) | (i < length ? data[i] : 0);
+      ps_ascii85_word(b, outbuf + outp);
+      outp += length + 1;
     }
 
-    stp_puts("~>\n", v);
+    memcpy(outbuf + outp, "~>\n", 3);
+    outp += 3;
     column = 0;
   }
+  pd->outbuf_used = outp;
+  pd->ascii85_column = column;
 }
 
 
@@ -86,13 +86,81 @@ typedef struct
     }									\
 }
 
+/*
+ * Pass output to the outfunc through the vars' output buffer.  Writes
+ * too large for the buffer go straight through, together with whatever
+ * is pending if a gather function is available.
+ */
+static void
+write_output(const stp_vars_t *v, const char *buf, size_t bytes)
+{
+  stpi_outbuf_t *ob = stpi_vars_get_outbuf(v);
+  if (bytes == 0)
+    return;
+  if (ob->bytes + bytes <= ob->size)
+    {
+      if (!ob->data)
+	ob->data = stp_malloc(ob->size);
+      memcpy(ob->data + ob->bytes, buf, bytes);
+      ob->bytes += bytes;
+    }
+  else if (bytes < ob->size)
+    {
+      stp_flush_output(v);
+      memcpy(ob->data, buf, bytes);
+      ob->bytes = bytes;
+    }
+  else if (ob->bytes > 0 && stp_get_outvfunc(v))
+    {
+      stp_outvec_t vec[2];
+      vec[0].data = ob->data;
+      vec[0].bytes = ob->bytes;
+      vec[1].data = buf;
+      vec[1].bytes = bytes;
+      ob->bytes = 0;
+      (stp_get_outvfunc(v))((void *)(stp_get_outdata(v)), vec, 2);
+    }
+  else
+    {
+      stp_flush_output(v);
+      (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), buf, bytes);
+    }
+}
+
+void
+stp_flush_output(const stp_vars_t *v)
+{
+  stpi_outbuf_t *ob = stpi_vars_get_outbuf(v);
+  if (ob->bytes > 0)
+    {
+      size_t bytes = ob->bytes;
+      ob->bytes = 0;
+      (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), ob->data, bytes);
+    }
+}
+
 void
 stp_zprintf(const stp_vars_t *v, const char *format, ...)
 {
+  stpi_outbuf_t *ob = stpi_vars_get_outbuf(v);
   char *result;
   int bytes;
+  /* Format directly into the output buffer if there is room */
+  if (ob->data && ob->size - ob->bytes > 1)
+    {
+      va_list args;
+      size_t room = ob->size - ob->bytes;
+      va_start(args, format);
+      bytes = vsnprintf(ob->data + ob->bytes, room, format, args);
+      va_end(args);
+      if (bytes >= 0 && (size_t) bytes < room)
+	{
+	  ob->bytes += bytes;
+	  return;
+	}
+    }
   STPI_VASPRINTF(result, bytes, format);
-  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), result, bytes);
+  write_output(v, result, bytes);
   stp_free(result);
 }
 
@@ -121,20 +189,26 @@ stp_catprintf(char **strp, const char *format, ...)
 void
 stp_zfwrite(const char *buf, size_t bytes, size_t nitems, const stp_vars_t *v)
 {
-  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), buf, bytes * nitems);
+  write_output(v, buf, bytes * nitems);
 }
 
 void
 stp_write_raw(const stp_raw_t *raw, const stp_vars_t *v)
 {
-  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), raw->data, raw->bytes);
+  write_output(v, raw->data, raw->bytes);
 }
 
 void
 stp_putc(int ch, const stp_vars_t *v)
 {
-  unsigned char a = (unsigned char) ch;
-  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), (char *) &a, 1);
+  stpi_outbuf_t *ob = stpi_vars_get_outbuf(v);
+  if (ob->data && ob->bytes < ob->size)
+    ob->data[ob->bytes++] = (unsigned char) ch;
+  else
+    {
+      unsigned char a = (unsigned char) ch;
+      write_output(v, (char *) &a, 1);
+    }
 }
 
 #define BYTE(expr, byteno) (((expr) >> (8 * byteno)) & 0xff)
@@ -142,45 +216,53 @@ stp_putc(int ch, const stp_vars_t *v)
 void
 stp_put16_le(unsigned short sh, const stp_vars_t *v)
 {
-  stp_putc(BYTE(sh, 0), v);
-  stp_putc(BYTE(sh, 1), v);
+  char buf[2];
+  buf[0] = BYTE(sh, 0);
+  buf[1] = BYTE(sh, 1);
+  write_output(v, buf, 2);
 }
 
 void
 stp_put16_be(unsigned short sh, const stp_vars_t *v)
 {
-  stp_putc(BYTE(sh, 1), v);
-  stp_putc(BYTE(sh, 0), v);
+  char buf[2];
+  buf[0] = BYTE(sh, 1);
+  buf[1] = BYTE(sh, 0);
+  write_output(v, buf, 2);
 }
 
 void
 stp_put32_le(unsigned int in, const stp_vars_t *v)
 {
-  stp_putc(BYTE(in, 0), v);
-  stp_putc(BYTE(in, 1), v);
-  stp_putc(BYTE(in, 2), v);
-  stp_putc(BYTE(in, 3), v);
+  char buf[4];
+  buf[0] = BYTE(in, 0);
+  buf[1] = BYTE(in, 1);
+  buf[2] = BYTE(in, 2);
+  buf[3] = BYTE(in, 3);
+  write_output(v, buf, 4);
 }
 
 void
 stp_put32_be(unsigned int in, const stp_vars_t *v)
 {
-  stp_putc(BYTE(in, 3), v);
-  stp_putc(BYTE(in, 2), v);
-  stp_putc(BYTE(in, 1), v);
-  stp_putc(BYTE(in, 0), v);
+  char buf[4];
+  buf[0] = BYTE(in, 3);
+  buf[1] = BYTE(in, 2);
+  buf[2] = BYTE(in, 1);
+  buf[3] = BYTE(in, 0);
+  write_output(v, buf, 4);
 }
 
 void
 stp_puts(const char *s, const stp_vars_t *v)
 {
-  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), s, strlen(s));
+  write_output(v, s, strlen(s));
 }
 
 void
 stp_putraw(const stp_raw_t *r, const stp_vars_t *v)
 {
-  (stp_get_outfunc(v))((void *)(stp_get_outdata(v)), r->data, r->bytes);
+  write_output(v, r->data, r->bytes);
 }
 
 void
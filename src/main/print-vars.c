@@ -77,6 +77,9 @@ struct stp_vars			/* Plug-in variables */
   stp_list_t *internal_data;
   void (*outfunc)(void *data, const char *buffer, size_t bytes);
   void *outdata;
+  stp_outvfunc_t outvfunc;
+  stpi_outbuf_t outbuf;
+  stp_image_row_ptr_func_t image_row_ptr_func;
   void (*errfunc)(void *data, const char *buffer, size_t bytes);
   void *errdata;
   int verified;			/* Ensure that params are OK! */
@@ -84,6 +87,8 @@ struct stp_vars			/* Plug-in variables */
 
 static int standard_vars_initialized = 0;
 
+#define DEFAULT_OUTPUT_BUFFER_SIZE 65536
+
 
 void
 stp_parameter_description_destroy(stp_parameter_t *desc)
@@ -321,6 +326,7 @@ initialize_standard_vars(void)
       default_vars.driver = stp_strdup("ps2");
       default_vars.color_conversion = stp_strdup("traditional");
       default_vars.internal_data = create_compdata_list();
+      default_vars.outbuf.size = DEFAULT_OUTPUT_BUFFER_SIZE;
       standard_vars_initialized = 1;
     }
 }
@@ -350,6 +356,8 @@ stp_vars_destroy(stp_vars_t *v)
 {
   int i;
   CHECK_VARS(v);
+  stp_flush_output(v);
+  STP_SAFE_FREE(v->outbuf.data);
   for (i = 0; i < STP_PARAMETER_TYPE_INVALID; i++)
     stp_list_destroy(v->params[i]);
   stp_list_destroy(v->internal_data);
@@ -418,10 +426,60 @@ DEF_FUNCS(width, int, stp)
 DEF_FUNCS(height, int, stp)
 DEF_FUNCS(page_width, int, stp)
 DEF_FUNCS(page_height, int, stp)
-DEF_FUNCS(outdata, void *, stp)
 DEF_FUNCS(errdata, void *, stp)
-DEF_FUNCS(outfunc, stp_outfunc_t, stp)
 DEF_FUNCS(errfunc, stp_outfunc_t, stp)
+DEF_FUNCS(image_row_ptr_func, stp_image_row_ptr_func_t, stp)
+
+/*
+ * Anything already buffered belongs to the old destination, so it
+ * must be written before the output function or its data change.
+ */
+#define DEF_OUTPUT_FUNCS(s, t, pre)			\
+void							\
+pre##_set_##s(stp_vars_t *v, t val)			\
+{							\
+  CHECK_VARS(v);                                        \
+  if (v->s != val)					\
+    stp_flush_output(v);				\
+  v->verified = 0;					\
+  v->s = val;						\
+}							\
+							\
+t							\
+pre##_get_##s(const stp_vars_t *v)			\
+{							\
+  CHECK_VARS(v);                                        \
+  return v->s;						\
+}
+
+DEF_OUTPUT_FUNCS(outdata, void *, stp)
+DEF_OUTPUT_FUNCS(outfunc, stp_outfunc_t, stp)
+DEF_OUTPUT_FUNCS(outvfunc, stp_outvfunc_t, stp)
+
+void
+stp_set_output_buffer_size(stp_vars_t *v, size_t size)
+{
+  CHECK_VARS(v);
+  if (size == v->outbuf.size)
+    return;
+  stp_flush_output(v);
+  STP_SAFE_FREE(v->outbuf.data);
+  v->outbuf.size = size;
+}
+
+size_t
+stp_get_output_buffer_size(const stp_vars_t *v)
+{
+  CHECK_VARS(v);
+  return v->outbuf.size;
+}
+
+stpi_outbuf_t *
+stpi_vars_get_outbuf(const stp_vars_t *v)
+{
+  CHECK_VARS(v);
+  return &(((stp_vars_t *) stpi_cast_safe(v))->outbuf);
+}
 
 void
 stp_set_verified(stp_vars_t *v, int val)
@@ -1439,10 +1497,18 @@ stp_vars_copy(stp_vars_t *vd, const stp_vars_t *vs)
   stp_set_height(vd, stp_get_height(vs));
   stp_set_page_width(vd, stp_get_page_width(vs));
   stp_set_page_height(vd, stp_get_page_height(vs));
+  /*
+   * Output already written through vs must not be overtaken by output
+   * written through vd.
+   */
+  stp_flush_output(vs);
   stp_set_outdata(vd, stp_get_outdata(vs));
   stp_set_errdata(vd, stp_get_errdata(vs));
   stp_set_outfunc(vd, stp_get_outfunc(vs));
+  stp_set_outvfunc(vd, stp_get_outvfunc(vs));
   stp_set_errfunc(vd, stp_get_errfunc(vs));
+  stp_set_output_buffer_size(vd, stp_get_output_buffer_size(vs));
+  stp_set_image_row_ptr_func(vd, stp_get_image_row_ptr_func(vs));
   for (i = 0; i < STP_PARAMETER_TYPE_INVALID; i++)
     {
       stp_list_destroy(vd->params[i]);
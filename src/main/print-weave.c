@@ -94,6 +94,10 @@ typedef struct stpi_softweave
   unsigned char *s[STP_MAX_WEAVE];
   unsigned char *fold_buf;
   unsigned char *comp_buf;
+  unsigned char **free_linebufs;	/* Row buffers not attached to a pass */
+  int free_linebuf_count;
+  unsigned char *blank_row;	/* Packed form of an empty row */
+  size_t blank_row_size;
   stp_weave_t wcache;
   int rcache;
   int vcache;
@@ -331,10 +335,66 @@ calculate_raw_row_parameters(raw_t *w,		/* I - weave parameters */
 	*startrow = row - (*jet * w->separation);
 }
 
+/*
+ * The raw weave repeats every separation * jets rows, with the pass
+ * number advancing by separation * oversampling each time, so the
+ * search above only needs to be done once per row of a period.  The
+ * schedule holds the results for one period, and is filled in as rows
+ * are looked up.
+ */
+typedef struct
+{
+  int pass;			/* Pass number, less one band's worth */
+  int jet;			/* -1 if not yet computed */
+} raw_slot_t;
+
+static raw_slot_t *
+allocate_raw_schedule(const raw_t *w)
+{
+  int count = w->separation * w->jets * w->oversampling;
+  raw_slot_t *schedule = stp_malloc(count * sizeof(raw_slot_t));
+  int i;
+  for (i = 0; i < count; i++)
+    schedule[i].jet = -1;
+  return schedule;
+}
+
+static void
+lookup_raw_row_parameters(raw_t *w,		/* I - weave parameters */
+			  raw_slot_t *schedule,	/* I - schedule for w */
+			  int row,		/* I - row number */
+			  int subpass,		/* I - subpass number */
+			  int *pass,		/* O - pass number */
+			  int *jet,		/* O - jet number in pass */
+			  int *startrow)	/* O - starting row of pass */
+{
+	int period = w->separation * w->jets;
+	raw_slot_t *slot;
+	int band;
+
+	if (row < 0 || subpass < 0 || subpass >= w->oversampling) {
+		calculate_raw_row_parameters(w, row, subpass,
+		                             pass, jet, startrow);
+		return;
+	}
+	band = row / period;
+	slot = &(schedule[subpass * period + row % period]);
+	if (slot->jet < 0) {
+		int dummy;
+		calculate_raw_row_parameters(w, row % period + period, subpass,
+		                             &slot->pass, &slot->jet, &dummy);
+		slot->pass -= w->oversampling * w->separation;
+	}
+	*pass = slot->pass + band * w->oversampling * w->separation;
+	*jet = slot->jet;
+	*startrow = row - (*jet * w->separation);
+}
+
 /* COOKED WEAVE */
 
 typedef struct cooked {
 	raw_t rw;
+	raw_slot_t *schedule;
 	int first_row_printed;
 	int last_row_printed;
 
@@ -595,6 +655,7 @@ initialize_weave_params(int separation,		/* I - jet separation */
 	cooked_t *w = stp_malloc(sizeof(cooked_t));
 	if (w) {
 		initialize_raw_weave(&w->rw, separation, jets, oversample, strategy, v);
+		w->schedule = allocate_raw_schedule(&w->rw);
 		calculate_pass_map(v, w, pageheight, firstrow, lastrow);
 	}
 	return w;
@@ -609,6 +670,7 @@ stpi_destroy_weave_params(void *vw)
 	if (w->stagger_premap) stp_free(w->stagger_premap);
 	if (w->pass_postmap) stp_free(w->pass_postmap);
 	if (w->stagger_postmap) stp_free(w->stagger_postmap);
+	stp_free(w->schedule);
 	stp_free(w);
 }
 
@@ -629,9 +691,9 @@ stpi_calculate_row_parameters(void *vw,		/* I - weave parameters */
 
 	STPI_ASSERT(row >= w->first_row_printed, w->rw.v);
 	STPI_ASSERT(row <= w->last_row_printed, w->rw.v);
-	calculate_raw_row_parameters(&w->rw,
-	                             row + w->rw.separation * w->rw.jets,
-	                             subpass, &raw_pass, &jet, &startrow);
+	lookup_raw_row_parameters(&w->rw, w->schedule,
+	                          row + w->rw.separation * w->rw.jets,
+	                          subpass, &raw_pass, &jet, &startrow);
 	startrow -= w->rw.separation * w->rw.jets;
 	jetsused = w->rw.jets;
 	phantomrows = 0;
@@ -976,6 +1038,10 @@ stpi_destroy_weave(void *vsw)
   for (i = 0; i < STP_MAX_WEAVE; i++)
     if (sw->s[i])
       stp_free(sw->s[i]);
+  for (i = 0; i < sw->free_linebuf_count; i++)
+    stp_free(sw->free_linebufs[i]);
+  stp_free(sw->free_linebufs);
+  STP_SAFE_FREE(sw->blank_row);
   for (i = 0; i < sw->vmod; i++)
     {
       for (j = 0; j < sw->ncolors; j++)
@@ -1122,6 +1188,7 @@ stp_initialize_weave(stp_vars_t *v,
   sw->linebounds = allocate_linebounds(sw->vmod, ncolors);
   sw->passes = stp_zalloc(sw->vmod * sizeof(stp_pass_t));
   sw->linecounts = allocate_linecount(sw->vmod, ncolors);
+  sw->free_linebufs = stp_malloc(sw->vmod * ncolors * sizeof(unsigned char *));
   sw->rcache = -2;
   sw->vcache = -2;
   sw->fillfunc = fillfunc;
@@ -1307,6 +1374,13 @@ stp_get_pass_by_pass(const stp_vars_t *v, int pass)
   return &(sw->passes[pass % sw->vmod]);
 }
 
+/*
+ * Row buffers are only attached to a pass when it gets something to
+ * print, and go back to a pool when the pass is flushed, so passes that
+ * are entirely blank (margins, unused inks) don't need any memory.
+ * Until then, all a pass can contain is empty rows, which are just
+ * counted (in lineoffsets) and filled in when the buffer is attached.
+ */
 static void
 check_linebases(stp_vars_t *v, stpi_softweave_t *sw,
 		int row, int cpass, int head_offset, int color)
@@ -1314,8 +1388,38 @@ check_linebases(stp_vars_t *v, stpi_softweave_t *sw,
   stp_linebufs_t *bufs =
     (stp_linebufs_t *) stpi_get_linebases(v, sw, row, cpass, head_offset);
   if (!(bufs->v[color]))
-    bufs->v[color] =
-      stp_zalloc (sw->virtual_jets * sw->bitwidth * sw->horizontal_width);
+    {
+      const stp_lineoff_t *lineoffs =
+	stpi_get_lineoffsets(v, sw, row, cpass, head_offset);
+      size_t size = sw->virtual_jets * sw->bitwidth * sw->horizontal_width;
+      size_t i;
+      /*
+       * A recycled buffer still holds the last pass it was attached to,
+       * and the flush may read beyond the rows written to this one.
+       */
+      if (sw->free_linebuf_count > 0)
+	{
+	  bufs->v[color] = sw->free_linebufs[--sw->free_linebuf_count];
+	  memset(bufs->v[color], 0, size);
+	}
+      else
+	bufs->v[color] = stp_zalloc(size);
+      if (sw->blank_row_size > 0)
+	for (i = 0; i < lineoffs->v[color]; i += sw->blank_row_size)
+	  memcpy(bufs->v[color] + i, sw->blank_row, sw->blank_row_size);
+    }
+}
+
+static void
+release_linebases(stpi_softweave_t *sw, stp_linebufs_t *bufs)
+{
+  int j;
+  for (j = 0; j < sw->ncolors; j++)
+    if (bufs->v[j])
+      {
+	sw->free_linebufs[sw->free_linebuf_count++] = bufs->v[j];
+	bufs->v[j] = NULL;
+      }
 }
 
 /*
@@ -1431,7 +1535,6 @@ initialize_row(stp_vars_t *v, stpi_softweave_t *sw,
 		stpi_get_linecount(v, sw, row, i, sw->head_offset[j]);
 	      stp_linebounds_t *linebounds =
 		stpi_get_linebounds(v, sw, row, i, sw->head_offset[j]);
-	      check_linebases(v, sw, row, i, sw->head_offset[j], j);
 	      weave_parameters_by_row(v, sw, row+sw->head_offset[j], i, &w);
 	      pass = stpi_get_pass_by_row(v, sw, row, i, sw->head_offset[j]);
 
@@ -1465,6 +1568,7 @@ initialize_row(stp_vars_t *v, stpi_softweave_t *sw,
 
 	      if((linecount->v[j] == 0) && (w.jet > 0))
 		{
+		  check_linebases(v, sw, row, i, sw->head_offset[j], j);
 		  (sw->fillfunc)(v, row, i, width, w.jet, j);
 		}
 	    }
@@ -1528,6 +1632,23 @@ add_to_row_1(stp_vars_t *v, stpi_softweave_t *sw, int row, unsigned char *buf,
       stp_eprintf(v, "ERROR: %s\n", _("Please report the above information to gimp-print-devel@lists.sourceforge.net"));
       stp_abort();
     }
+  if (!bufs->v[color])
+    {
+      if (!setactive && !sw->blank_row && nbytes > 0)
+	{
+	  sw->blank_row = stp_malloc(nbytes);
+	  memcpy(sw->blank_row, buf, nbytes);
+	  sw->blank_row_size = nbytes;
+	}
+      if (!setactive && sw->blank_row && nbytes == sw->blank_row_size &&
+	  memcmp(buf, sw->blank_row, nbytes) == 0)
+	{
+	  lineoffs->v[color] += nbytes;
+	  return;
+	}
+      check_linebases(v, sw, sw->lineno, h_pass, sw->head_offset[color],
+		      color);
+    }
   memcpy(bufs->v[color] + lineoffs->v[color], buf, nbytes);
   lineoffs->v[color] += nbytes;
   if (setactive)
@@ -1561,6 +1682,7 @@ stpi_flush_passes(stp_vars_t *v, int flushall)
       if (pass->pass < 0 || (!flushall && pass->physpassend >= sw->lineno))
 	return;
       (sw->flushfunc)(v, pass->pass, pass->subpass);
+      release_linebases(sw, &(sw->linebases[pass->pass % sw->vmod]));
       sw->last_pass = pass->pass;
       pass->pass = -1;
     }
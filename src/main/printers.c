@@ -544,7 +544,9 @@ stp_print(const stp_vars_t *v, stp_image_t *image)
 {
   const stp_printfuncs_t *printfuncs =
     stpi_get_printfuncs(stp_get_printer(v));
-  return (printfuncs->print)(v, image);
+  int status = (printfuncs->print)(v, image);
+  stp_flush_output(v);
+  return status;
 }
 
 int
@@ -556,7 +558,11 @@ stp_start_job(const stp_vars_t *v, stp_image_t *image)
       strcmp(stp_get_string_parameter(v, "JobMode"), "Page") == 0)
     return 1;
   if (printfuncs->start_job)
-    return (printfuncs->start_job)(v, image);
+    {
+      int status = (printfuncs->start_job)(v, image);
+      stp_flush_output(v);
+      return status;
+    }
   else
     return 1;
 }
@@ -570,7 +576,11 @@ stp_end_job(const stp_vars_t *v, stp_image_t *image)
       strcmp(stp_get_string_parameter(v, "JobMode"), "Page") == 0)
     return 1;
   if (printfuncs->end_job)
-    return (printfuncs->end_job)(v, image);
+    {
+      int status = (printfuncs->end_job)(v, image);
+      stp_flush_output(v);
+      return status;
+    }
   else
     return 1;
 }
@@ -0,0 +1,663 @@
+/*
+ * "$Id$"
+ *
+ *   Precompiled XML data - load parsed XML trees from a binary file.
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * The XML data files are read on every start, and parsing them a
+ * character at a time accounts for most of the startup time.  At build
+ * time the parsed trees of all of the data files are written to one
+ * binary file (STP_XML_PRECOMPILED_NAME) in the XML data directory.
+ * stp_xml_load_file() rebuilds a tree from that file when it holds an
+ * up to date copy of the requested XML file, and parses the XML
+ * otherwise.
+ *
+ * The file is mapped (or read) whole.  All values are 32 bit words in
+ * the byte order of the machine that wrote it; a file written with a
+ * different byte order, format or library version is ignored.
+ *
+ *   header	precompiled_header_t
+ *   files	file_count precompiled_file_t, sorted by name
+ *   nodes	32 bit words describing the trees (see below)
+ *   strings	NUL-terminated strings, referenced by byte offset
+ *
+ * Each node is written as its type and number of children, followed by
+ * its value and then its children:
+ *
+ *   STP_MXML_ELEMENT	name, attribute count, (name, value) pairs
+ *   STP_MXML_TEXT	whitespace, string
+ *   STP_MXML_OPAQUE	string
+ *   STP_MXML_INTEGER	value
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <gutenprint/gutenprint.h>
+#include "gutenprint-internal.h"
+#include <gutenprint/gutenprint-intl-internal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#define PRECOMPILED_MAGIC "STPXMLDB"
+#define PRECOMPILED_FORMAT 1
+#define PRECOMPILED_BYTE_ORDER 0x01020304u
+#define PRECOMPILED_MAX_DEPTH 256
+
+typedef unsigned int stpi_word_t;
+
+typedef struct
+{
+  char magic[8];
+  stpi_word_t format;
+  stpi_word_t byte_order;
+  char version[32];
+  stpi_word_t file_count;
+  stpi_word_t files_offset;	/* All offsets in bytes from the start */
+  stpi_word_t nodes_offset;
+  stpi_word_t node_words;
+  stpi_word_t strings_offset;
+  stpi_word_t strings_size;
+} precompiled_header_t;
+
+typedef struct
+{
+  stpi_word_t name;		/* Path relative to the data directory */
+  stpi_word_t size;		/* Size of the XML file */
+  stpi_word_t first_word;	/* Index of the root node */
+  stpi_word_t word_count;
+} precompiled_file_t;
+
+/* A precompiled file found (or not) in one data directory */
+typedef struct
+{
+  char *dir;
+  const unsigned char *data;	/* NULL if there is no usable file */
+  size_t size;
+  int mapped;
+  time_t mtime;
+  const precompiled_header_t *header;
+  const precompiled_file_t *files;
+  const stpi_word_t *nodes;
+  const char *strings;
+} precompiled_t;
+
+static stp_list_t *precompiled_dirs = NULL;
+
+static const char *
+precompiled_namefunc(const void *item)
+{
+  return ((const precompiled_t *) item)->dir;
+}
+
+static void
+precompiled_freefunc(void *item)
+{
+  precompiled_t *pc = (precompiled_t *) item;
+#ifdef HAVE_SYS_MMAN_H
+  if (pc->mapped)
+    (void) munmap((void *) pc->data, pc->size);
+  else
+#endif
+    STP_SAFE_FREE(pc->data);
+  stp_free(pc->dir);
+  stp_free(pc);
+}
+
+static int
+precompiled_check(precompiled_t *pc)
+{
+  const precompiled_header_t *h = (const precompiled_header_t *) pc->data;
+  char version[sizeof(h->version)];
+  stpi_word_t i;
+
+  if (pc->size < sizeof(precompiled_header_t) ||
+      memcmp(h->magic, PRECOMPILED_MAGIC, sizeof(h->magic)) != 0 ||
+      h->format != PRECOMPILED_FORMAT ||
+      h->byte_order != PRECOMPILED_BYTE_ORDER)
+    return 0;
+  memset(version, 0, sizeof(version));
+  strncpy(version, VERSION, sizeof(version) - 1);
+  if (memcmp(h->version, version, sizeof(version)) != 0)
+    return 0;
+  if (h->files_offset % sizeof(stpi_word_t) != 0 ||
+      h->nodes_offset % sizeof(stpi_word_t) != 0 ||
+      h->files_offset > pc->size ||
+      h->file_count > (pc->size - h->files_offset) / sizeof(precompiled_file_t) ||
+      h->nodes_offset > pc->size ||
+      h->node_words > (pc->size - h->nodes_offset) / sizeof(stpi_word_t) ||
+      h->strings_offset > pc->size ||
+      h->strings_size > pc->size - h->strings_offset ||
+      h->strings_size == 0 ||
+      pc->data[h->strings_offset + h->strings_size - 1] != '\0')
+    return 0;
+  pc->header = h;
+  pc->files = (const precompiled_file_t *) (pc->data + h->files_offset);
+  pc->nodes = (const stpi_word_t *) (pc->data + h->nodes_offset);
+  pc->strings = (const char *) (pc->data + h->strings_offset);
+  for (i = 0; i < h->file_count; i++)
+    if (pc->files[i].name >= h->strings_size ||
+	pc->files[i].first_word > h->node_words ||
+	pc->files[i].word_count > h->node_words - pc->files[i].first_word)
+      return 0;
+  return 1;
+}
+
+static void
+precompiled_open(precompiled_t *pc)
+{
+  char *file = stpi_path_merge(pc->dir, STP_XML_PRECOMPILED_NAME);
+  struct stat sbuf;
+  int fd = open(file, O_RDONLY);
+
+  if (fd < 0)
+    {
+      stp_free(file);
+      return;
+    }
+  if (fstat(fd, &sbuf) == 0 && sbuf.st_size > 0)
+    {
+      pc->size = sbuf.st_size;
+      pc->mtime = sbuf.st_mtime;
+#ifdef HAVE_SYS_MMAN_H
+      pc->data = mmap(NULL, pc->size, PROT_READ, MAP_SHARED, fd, 0);
+      if (pc->data == (const unsigned char *) MAP_FAILED)
+	pc->data = NULL;
+      else
+	pc->mapped = 1;
+#endif
+      if (!pc->data)
+	{
+	  unsigned char *buf = stp_malloc(pc->size);
+	  if (read(fd, buf, pc->size) == (ssize_t) pc->size)
+	    pc->data = buf;
+	  else
+	    stp_free(buf);
+	}
+    }
+  close(fd);
+  if (pc->data && !precompiled_check(pc))
+    {
+      stp_deprintf(STP_DBG_XML, "stp_xml_load_file: ignoring %s\n", file);
+#ifdef HAVE_SYS_MMAN_H
+      if (pc->mapped)
+	(void) munmap((void *) pc->data, pc->size);
+      else
+#endif
+	stp_free((void *) pc->data);
+      pc->data = NULL;
+      pc->mapped = 0;
+    }
+  else if (pc->data)
+    stp_deprintf(STP_DBG_XML, "stp_xml_load_file: using %s (%u files)\n",
+		 file, pc->header->file_count);
+  stp_free(file);
+}
+
+/*
+ * Return the precompiled data for a data directory, opening it the
+ * first time the directory is seen.
+ */
+static const precompiled_t *
+precompiled_get(const char *dir)
+{
+  stp_list_item_t *item;
+  precompiled_t *pc;
+  if (!precompiled_dirs)
+    {
+      precompiled_dirs = stp_list_create();
+      stp_list_set_namefunc(precompiled_dirs, precompiled_namefunc);
+      stp_list_set_freefunc(precompiled_dirs, precompiled_freefunc);
+    }
+  item = stp_list_get_item_by_name(precompiled_dirs, dir);
+  if (item)
+    return (const precompiled_t *) stp_list_item_get_data(item);
+  pc = stp_zalloc(sizeof(precompiled_t));
+  pc->dir = stp_strdup(dir);
+  precompiled_open(pc);
+  stp_list_item_create(precompiled_dirs, NULL, pc);
+  return pc;
+}
+
+static const precompiled_file_t *
+precompiled_find(const precompiled_t *pc, const char *name)
+{
+  int lo = 0;
+  int hi = pc->header->file_count - 1;
+  while (lo <= hi)
+    {
+      int mid = (lo + hi) / 2;
+      int cmp = strcmp(name, pc->strings + pc->files[mid].name);
+      if (cmp == 0)
+	return &(pc->files[mid]);
+      else if (cmp < 0)
+	hi = mid - 1;
+      else
+	lo = mid + 1;
+    }
+  return NULL;
+}
+
+typedef struct
+{
+  const precompiled_t *pc;
+  const stpi_word_t *words;
+  stpi_word_t count;
+  stpi_word_t pos;
+  int error;
+} precompiled_reader_t;
+
+static stpi_word_t
+read_word(precompiled_reader_t *r)
+{
+  if (r->pos >= r->count)
+    {
+      r->error = 1;
+      return 0;
+    }
+  return r->words[r->pos++];
+}
+
+static const char *
+read_string(precompiled_reader_t *r)
+{
+  stpi_word_t offset = read_word(r);
+  if (offset >= r->pc->header->strings_size)
+    {
+      r->error = 1;
+      return "";
+    }
+  return r->pc->strings + offset;
+}
+
+static stp_mxml_node_t *
+read_node(precompiled_reader_t *r, stp_mxml_node_t *parent, int depth)
+{
+  stp_mxml_node_t *node = NULL;
+  stpi_word_t type = read_word(r);
+  stpi_word_t children = read_word(r);
+  stpi_word_t i;
+
+  if (r->error || depth > PRECOMPILED_MAX_DEPTH)
+    {
+      r->error = 1;
+      return NULL;
+    }
+  switch (type)
+    {
+    case STP_MXML_ELEMENT:
+      {
+	stpi_word_t attrs;
+	node = stp_mxmlNewElement(parent, read_string(r));
+	attrs = read_word(r);
+	if (r->error || attrs > r->count - r->pos)
+	  break;
+	if (attrs > 0)
+	  {
+	    /* mxml frees these with free() */
+	    node->value.element.attrs = malloc(attrs * sizeof(stp_mxml_attr_t));
+	    for (i = 0; i < attrs; i++)
+	      {
+		node->value.element.attrs[i].name = strdup(read_string(r));
+		node->value.element.attrs[i].value = strdup(read_string(r));
+		node->value.element.num_attrs++;
+	      }
+	  }
+      }
+      break;
+    case STP_MXML_TEXT:
+      {
+	int whitespace = read_word(r);
+	node = stp_mxmlNewText(parent, whitespace, read_string(r));
+      }
+      break;
+    case STP_MXML_OPAQUE:
+      node = stp_mxmlNewOpaque(parent, read_string(r));
+      break;
+    case STP_MXML_INTEGER:
+      node = stp_mxmlNewInteger(parent, (int) read_word(r));
+      break;
+    default:
+      r->error = 1;
+      return NULL;
+    }
+  for (i = 0; i < children && !r->error; i++)
+    (void) read_node(r, node, depth + 1);
+  return node;
+}
+
+/*
+ * Rebuild the tree of file from the precompiled data, if there is an up
+ * to date copy of it.  Returns NULL otherwise.
+ */
+static stp_mxml_node_t *
+precompiled_load(const char *file)
+{
+  stp_list_t *dir_list;
+  stp_list_item_t *item;
+  stp_mxml_node_t *doc = NULL;
+  struct stat sbuf;
+
+  if (stat(file, &sbuf) != 0)
+    return NULL;
+  dir_list = stpi_data_path();
+  for (item = stp_list_get_start(dir_list); item && !doc;
+       item = stp_list_item_next(item))
+    {
+      const char *dir = (const char *) stp_list_item_get_data(item);
+      size_t len = strlen(dir);
+      const precompiled_t *pc;
+      const precompiled_file_t *entry;
+      precompiled_reader_t reader;
+      const char *name = file + len;
+
+      if (strncmp(file, dir, len) != 0 || *name != '/')
+	continue;
+      while (*name == '/')
+	name++;
+      pc = precompiled_get(dir);
+      if (!pc->data || !(entry = precompiled_find(pc, name)))
+	continue;
+      if (entry->size != sbuf.st_size || sbuf.st_mtime > pc->mtime)
+	{
+	  stp_deprintf(STP_DBG_XML,
+		       "stp_xml_load_file: %s has changed since it was precompiled\n",
+		       file);
+	  continue;
+	}
+      reader.pc = pc;
+      reader.words = pc->nodes + entry->first_word;
+      reader.count = entry->word_count;
+      reader.pos = 0;
+      reader.error = 0;
+      doc = read_node(&reader, NULL, 0);
+      if (reader.error)
+	{
+	  stp_erprintf("stp_xml_load_file: %s: corrupt precompiled data\n",
+		       file);
+	  if (doc)
+	    stp_mxmlDelete(doc);
+	  doc = NULL;
+	}
+    }
+  stp_list_destroy(dir_list);
+  return doc;
+}
+
+/*
+ * Load an XML data file, from the precompiled data if possible.
+ */
+stp_mxml_node_t *
+stp_xml_load_file(const char *file)
+{
+  stp_mxml_node_t *doc = precompiled_load(file);
+  if (doc)
+    {
+      stp_deprintf(STP_DBG_XML, "stp_xml_load_file: %s (precompiled)\n", file);
+      return doc;
+    }
+  return stp_mxmlLoadFromFile(NULL, file, STP_MXML_NO_CALLBACK);
+}
+
+/*
+ * Writing the precompiled file.
+ */
+
+typedef struct
+{
+  char *string;
+  stpi_word_t offset;
+} string_entry_t;
+
+typedef struct
+{
+  stpi_word_t *words;
+  size_t count;
+  size_t size;
+  stp_list_t *strings;		/* string_entry_t, indexed by string */
+  size_t strings_size;
+  int error;
+} precompiled_writer_t;
+
+static const char *
+string_entry_namefunc(const void *item)
+{
+  return ((const string_entry_t *) item)->string;
+}
+
+static void
+string_entry_freefunc(void *item)
+{
+  string_entry_t *entry = (string_entry_t *) item;
+  stp_free(entry->string);
+  stp_free(entry);
+}
+
+static void
+write_word(precompiled_writer_t *w, stpi_word_t word)
+{
+  if (w->count >= w->size)
+    {
+      w->size = w->size ? w->size * 2 : 65536;
+      w->words = stp_realloc(w->words, w->size * sizeof(stpi_word_t));
+    }
+  w->words[w->count++] = word;
+}
+
+static stpi_word_t
+add_string(precompiled_writer_t *w, const char *string)
+{
+  stp_list_item_t *item;
+  string_entry_t *entry;
+  if (!string)
+    string = "";
+  item = stp_list_get_item_by_name(w->strings, string);
+  if (item)
+    return ((string_entry_t *) stp_list_item_get_data(item))->offset;
+  entry = stp_malloc(sizeof(string_entry_t));
+  entry->string = stp_strdup(string);
+  entry->offset = w->strings_size;
+  w->strings_size += strlen(string) + 1;
+  stp_list_item_create(w->strings, NULL, entry);
+  return entry->offset;
+}
+
+static void
+write_string(precompiled_writer_t *w, const char *string)
+{
+  write_word(w, add_string(w, string));
+}
+
+static void
+write_node(precompiled_writer_t *w, stp_mxml_node_t *node)
+{
+  stp_mxml_node_t *child;
+  stpi_word_t children = 0;
+  int i;
+
+  for (child = node->child; child; child = child->next)
+    children++;
+  write_word(w, node->type);
+  write_word(w, children);
+  switch (node->type)
+    {
+    case STP_MXML_ELEMENT:
+      write_string(w, node->value.element.name);
+      write_word(w, node->value.element.num_attrs);
+      for (i = 0; i < node->value.element.num_attrs; i++)
+	{
+	  write_string(w, node->value.element.attrs[i].name);
+	  write_string(w, node->value.element.attrs[i].value);
+	}
+      break;
+    case STP_MXML_TEXT:
+      write_word(w, node->value.text.whitespace);
+      write_string(w, node->value.text.string);
+      break;
+    case STP_MXML_OPAQUE:
+      write_string(w, node->value.opaque);
+      break;
+    case STP_MXML_INTEGER:
+      write_word(w, (stpi_word_t) node->value.integer);
+      break;
+    default:
+      w->error = 1;
+      break;
+    }
+  for (child = node->child; child; child = child->next)
+    write_node(w, child);
+}
+
+static int
+compare_files(const void *a, const void *b)
+{
+  const char *const *fa = (const char *const *) a;
+  const char *const *fb = (const char *const *) b;
+  return strcmp(*fa, *fb);
+}
+
+/*
+ * Parse the XML files named (relative to dir) and write their trees to
+ * output.  Returns 0 on success.
+ */
+int
+stp_xml_write_precompiled(const char *output, const char *dir,
+			  int count, const char **files)
+{
+  precompiled_writer_t w;
+  precompiled_header_t header;
+  precompiled_file_t *entries;
+  const char **sorted;
+  char *string_data;
+  stp_list_item_t *item;
+  FILE *fp;
+  int status = 0;
+  int i;
+
+  memset(&w, 0, sizeof(w));
+  w.strings = stp_list_create();
+  stp_list_set_namefunc(w.strings, string_entry_namefunc);
+  stp_list_set_freefunc(w.strings, string_entry_freefunc);
+  (void) add_string(&w, "");
+
+  sorted = stp_malloc(count * sizeof(const char *));
+  memcpy(sorted, files, count * sizeof(const char *));
+  qsort(sorted, count, sizeof(const char *), compare_files);
+  entries = stp_zalloc(count * sizeof(precompiled_file_t));
+
+  for (i = 0; i < count; i++)
+    {
+      char *file = stpi_path_merge(dir, sorted[i]);
+      struct stat sbuf;
+      stp_mxml_node_t *doc;
+      if (stat(file, &sbuf) != 0 ||
+	  !(doc = stp_mxmlLoadFromFile(NULL, file, STP_MXML_NO_CALLBACK)))
+	{
+	  stp_erprintf("stp_xml_write_precompiled: cannot read %s: %s\n",
+		       file, strerror(errno));
+	  stp_free(file);
+	  status = 1;
+	  break;
+	}
+      if (doc->next)
+	{
+	  stp_erprintf("stp_xml_write_precompiled: %s: more than one root node\n",
+		       file);
+	  stp_mxmlDelete(doc);
+	  stp_free(file);
+	  status = 1;
+	  break;
+	}
+      entries[i].name = add_string(&w, sorted[i]);
+      entries[i].size = sbuf.st_size;
+      entries[i].first_word = w.count;
+      write_node(&w, doc);
+      entries[i].word_count = w.count - entries[i].first_word;
+      stp_mxmlDelete(doc);
+      stp_free(file);
+      if (w.error)
+	{
+	  stp_erprintf("stp_xml_write_precompiled: %s: unsupported node type\n",
+		       sorted[i]);
+	  status = 1;
+	  break;
+	}
+    }
+
+  if (status == 0)
+    {
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, PRECOMPILED_MAGIC, sizeof(header.magic));
+      header.format = PRECOMPILED_FORMAT;
+      header.byte_order = PRECOMPILED_BYTE_ORDER;
+      strncpy(header.version, VERSION, sizeof(header.version) - 1);
+      header.file_count = count;
+      header.files_offset = sizeof(header);
+      header.nodes_offset = header.files_offset +
+	count * sizeof(precompiled_file_t);
+      header.node_words = w.count;
+      header.strings_offset = header.nodes_offset +
+	w.count * sizeof(stpi_word_t);
+      header.strings_size = w.strings_size;
+
+      string_data = stp_zalloc(w.strings_size);
+      for (item = stp_list_get_start(w.strings); item;
+	   item = stp_list_item_next(item))
+	{
+	  const string_entry_t *entry =
+	    (const string_entry_t *) stp_list_item_get_data(item);
+	  strcpy(string_data + entry->offset, entry->string);
+	}
+
+      fp = fopen(output, "wb");
+      if (!fp ||
+	  fwrite(&header, sizeof(header), 1, fp) != 1 ||
+	  (count > 0 &&
+	   fwrite(entries, sizeof(precompiled_file_t), count, fp) != count) ||
+	  (w.count > 0 &&
+	   fwrite(w.words, sizeof(stpi_word_t), w.count, fp) != w.count) ||
+	  fwrite(string_data, 1, w.strings_size, fp) != w.strings_size)
+	{
+	  stp_erprintf("stp_xml_write_precompiled: cannot write %s: %s\n",
+		       output, strerror(errno));
+	  status = 1;
+	}
+      if (fp && fclose(fp) != 0)
+	status = 1;
+      stp_free(string_data);
+    }
+
+  stp_free(entries);
+  stp_free(sorted);
+  STP_SAFE_FREE(w.words);
+  stp_list_destroy(w.strings);
+  return status;
+}
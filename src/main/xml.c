@@ -249,23 +249,27 @@ stp_xml_parse_file(const char *file) /* File to parse */
 {
   stp_mxml_node_t *doc;
   stp_mxml_node_t *cur;
-  FILE *fp;
 
   stp_deprintf(STP_DBG_XML, "stp_xml_parse_file: reading  `%s'...\n", file);
 
-  fp = fopen(file, "r");
-  if (!fp)
+  stp_xml_init();
+
+  doc = stp_xml_load_file(file);
+  if (!doc)
     {
-      stp_erprintf("stp_xml_parse_file: unable to open %s: %s\n", file,
-		   strerror(errno));
+      FILE *fp = fopen(file, "r");
+      if (!fp)
+	stp_erprintf("stp_xml_parse_file: unable to open %s: %s\n", file,
+		     strerror(errno));
+      else
+	{
+	  fclose(fp);
+	  stp_erprintf("stp_xml_parse_file: %s: parse error\n", file);
+	}
+      stp_xml_exit();
       return 1;
     }
 
-  stp_xml_init();
-
-  doc = stp_mxmlLoadFile(NULL, fp, STP_MXML_NO_CALLBACK);
-  fclose(fp);
-
   cur = doc->child;
   while (cur &&
 	 (cur->type != STP_MXML_ELEMENT ||
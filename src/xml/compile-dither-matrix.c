@@ -0,0 +1,36 @@
+/*
+ * "$Id$"
+ *
+ * Convert a dither matrix XML file to the binary matrix format
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Usage: compile-dither-matrix input.xml output.bin
+ */
+
+#include <stdio.h>
+#include <gutenprint/gutenprint.h>
+#include <gutenprint/gutenprint-module.h>
+#include "config.h"
+
+int
+main(int argc, char **argv)
+{
+  if (argc != 3)
+    {
+      fprintf(stderr, "Usage: %s input.xml output.bin\n", argv[0]);
+      return 1;
+    }
+  stp_init();
+  return stp_dither_matrix_write_binary(argv[1], argv[2]);
+}
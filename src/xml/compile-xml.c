@@ -0,0 +1,39 @@
+/*
+ * "$Id$"
+ *
+ * Write the parsed XML data files to a precompiled binary file
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Usage: compile-xml output srcdir file...
+ *
+ * The files are named relative to srcdir, as they will be relative to
+ * the installed XML data directory.
+ */
+
+#include <stdio.h>
+#include <gutenprint/gutenprint.h>
+#include <gutenprint/gutenprint-module.h>
+#include "config.h"
+
+int
+main(int argc, char **argv)
+{
+  if (argc < 3)
+    {
+      fprintf(stderr, "Usage: %s output srcdir file...\n", argv[0]);
+      return 1;
+    }
+  return stp_xml_write_precompiled(argv[1], argv[2], argc - 3,
+				   (const char **) (argv + 3));
+}
@@ -0,0 +1,292 @@
+/*
+ *   Test the bit folding, unpacking and packing routines against simple
+ *   reference implementations.
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <gutenprint/gutenprint.h>
+#include <gutenprint/gutenprint-module.h>
+
+int global_test_count = 0;
+int global_error_count = 0;
+
+#define MAX_LENGTH 300
+#define MAX_PLANES 8
+
+static const int test_lengths[] =
+  { 1, 2, 7, 15, 16, 17, 31, 32, 33, 48, 63, 64, 65, 100, 255, MAX_LENGTH };
+
+static void
+TEST(const char *name, int length)
+{
+  global_test_count++;
+  printf("%d: Checking %s, length %d... ", global_test_count, name, length);
+  fflush(stdout);
+}
+
+static void
+TEST_CHECK(int conditional)
+{
+  if (conditional)
+    printf("PASS\n");
+  else
+    {
+      global_error_count++;
+      printf("FAIL\n");
+    }
+  fflush(stdout);
+}
+
+static int
+get_bit(const unsigned char *buf, int bit)
+{
+  return (buf[bit / 8] >> (7 - (bit % 8))) & 1;
+}
+
+static void
+set_bit(unsigned char *buf, int bit)
+{
+  buf[bit / 8] |= 1 << (7 - (bit % 8));
+}
+
+/*
+ * Folding interleaves the planes bit by bit, with the last plane in the
+ * most significant position.
+ */
+static void
+reference_fold(const unsigned char *line, int planes, int length,
+	       unsigned char *out)
+{
+  int i, j;
+  memset(out, 0, length * planes);
+  for (i = 0; i < length * 8; i++)
+    for (j = 0; j < planes; j++)
+      if (get_bit(line + j * length, i))
+	set_bit(out, i * planes + planes - 1 - j);
+}
+
+/*
+ * Unpacking distributes successive pixels round robin across the planes.
+ */
+static void
+reference_unpack(const unsigned char *in, int planes, int length,
+		 unsigned char **outs)
+{
+  int i, j;
+  for (j = 0; j < planes; j++)
+    memset(outs[j], 0, MAX_LENGTH + 1);
+  for (i = 0; i < length * 8; i++)
+    if (get_bit(in, i))
+      set_bit(outs[i % planes], i / planes);
+}
+
+/*
+ * Straightforward PackBits encoder: a literal ends where three equal
+ * bytes begin.
+ */
+static int
+reference_pack_tiff(const unsigned char *line, int length,
+		    unsigned char *out, int *first, int *last)
+{
+  unsigned char *o = out;
+  int i = 0;
+  *first = length;
+  *last = 0;
+  for (i = 0; i < length; i++)
+    if (line[i])
+      {
+	if (*first == length)
+	  *first = i;
+	*last = i;
+      }
+  i = 0;
+  while (i < length)
+    {
+      int start = i;
+      int count;
+      while (i < length - 2 &&
+	     !(line[i] == line[i + 1] && line[i + 1] == line[i + 2]))
+	i++;
+      if (i >= length - 2 && length - start > 2)
+	i = length - 2;
+      for (count = i - start; count > 0; )
+	{
+	  int n = count > 128 ? 128 : count;
+	  *o++ = n - 1;
+	  memcpy(o, line + start, n);
+	  o += n;
+	  start += n;
+	  count -= n;
+	}
+      start = i;
+      while (i < length && line[i] == line[start])
+	i++;
+      for (count = i - start; count > 0; count -= 128)
+	{
+	  int n = count > 128 ? 128 : count;
+	  *o++ = 1 - n;
+	  *o++ = line[start];
+	}
+    }
+  return o - out;
+}
+
+static void
+fill_random(unsigned char *buf, int length)
+{
+  int i;
+  for (i = 0; i < length; i++)
+    buf[i] = rand() & 0xff;
+}
+
+static void
+test_fold(int planes, void (*fold)(const unsigned char *, int,
+				   unsigned char *), const char *name)
+{
+  unsigned char line[MAX_LENGTH * 8];
+  unsigned char out[MAX_LENGTH * 8 + 1];
+  unsigned char ref[MAX_LENGTH * 8];
+  int i;
+  for (i = 0; i < sizeof(test_lengths) / sizeof(int); i++)
+    {
+      int length = test_lengths[i];
+      fill_random(line, length * planes);
+      reference_fold(line, planes, length, ref);
+      out[length * planes] = 0x5a;
+      TEST(name, length);
+      (*fold)(line, length, out);
+      TEST_CHECK(memcmp(out, ref, length * planes) == 0 &&
+		 out[length * planes] == 0x5a);
+    }
+}
+
+static void
+test_unpack(int planes)
+{
+  unsigned char in[MAX_LENGTH];
+  unsigned char out_buf[MAX_PLANES][MAX_LENGTH + 1];
+  unsigned char ref_buf[MAX_PLANES][MAX_LENGTH + 1];
+  unsigned char *outs[MAX_PLANES];
+  unsigned char *refs[MAX_PLANES];
+  char name[64];
+  int i, j;
+  (void) sprintf(name, "stp_unpack %d planes", planes);
+  for (j = 0; j < planes; j++)
+    {
+      outs[j] = out_buf[j];
+      refs[j] = ref_buf[j];
+    }
+  for (i = 0; i < sizeof(test_lengths) / sizeof(int); i++)
+    {
+      int length = test_lengths[i];
+      int out_length = (length * 8 / planes + 7) / 8;
+      int ok = 1;
+      fill_random(in, length);
+      reference_unpack(in, planes, length, refs);
+      for (j = 0; j < planes; j++)
+	memset(outs[j], 0, MAX_LENGTH + 1);
+      TEST(name, length);
+      stp_unpack(length, 1, planes, in, outs);
+      for (j = 0; j < planes; j++)
+	if (memcmp(outs[j], refs[j], out_length) != 0)
+	  ok = 0;
+      TEST_CHECK(ok);
+    }
+}
+
+/*
+ * Fill with a mixture of literal stretches and runs of varying length,
+ * with zero margins, so that all paths through the encoder are used.
+ */
+static void
+fill_runs(unsigned char *buf, int length)
+{
+  int i = 0;
+  int margin = rand() % (length / 4 + 1);
+  memset(buf, 0, length);
+  i = margin;
+  while (i < length - margin)
+    {
+      int n = 1 + rand() % 40;
+      unsigned char c = rand() & 0xff;
+      if (rand() & 1)
+	while (n-- > 0 && i < length - margin)
+	  buf[i++] = c;
+      else
+	while (n-- > 0 && i < length - margin)
+	  buf[i++] = rand() % 3;
+    }
+}
+
+static void
+test_pack_tiff(stp_vars_t *v)
+{
+  static unsigned char line[MAX_LENGTH * 8];
+  static unsigned char out[MAX_LENGTH * 9];
+  static unsigned char ref[MAX_LENGTH * 9];
+  int i, pass;
+  for (pass = 0; pass < 3; pass++)
+    for (i = 0; i < sizeof(test_lengths) / sizeof(int); i++)
+      {
+	int length = test_lengths[i] * (pass + 1);
+	int first, last, rfirst, rlast, ref_length, ret;
+	unsigned char *comp_ptr;
+	if (pass == 0)
+	  fill_runs(line, length);
+	else if (pass == 1)
+	  fill_random(line, length);
+	else
+	  memset(line, 0, length);
+	ref_length = reference_pack_tiff(line, length, ref, &rfirst, &rlast);
+	TEST("stp_pack_tiff", length);
+	ret = stp_pack_tiff(v, line, length, out, &comp_ptr, &first, &last);
+	TEST_CHECK(comp_ptr - out == ref_length &&
+		   memcmp(out, ref, ref_length) == 0 &&
+		   first == rfirst && last == rlast &&
+		   ret == (rfirst <= rlast));
+      }
+}
+
+int
+main(int argc, char **argv)
+{
+  stp_vars_t *v;
+  stp_init();
+  srand(1);
+  v = stp_vars_create();
+
+  test_fold(2, stp_fold, "stp_fold");
+  test_fold(3, stp_fold_3bit, "stp_fold_3bit");
+  test_fold(4, stp_fold_4bit, "stp_fold_4bit");
+  test_fold(8, stp_fold_8bit, "stp_fold_8bit");
+  test_unpack(2);
+  test_unpack(4);
+  test_unpack(8);
+  test_pack_tiff(v);
+  stp_vars_destroy(v);
+
+  if (global_error_count)
+    printf("%d/%d tests FAILED.\n", global_error_count, global_test_count);
+  else
+    printf("All tests passed successfully.\n");
+  return global_error_count ? 1 : 0;
+}
@@ -0,0 +1,194 @@
+/*
+ *   Test the channel scaling and ink limiting against the exact
+ *   floating point computation.
+ *
+ *   This program is free software; you can redistribute it and/or modify it
+ *   under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation; either version 2 of the License, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ *   or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ *   for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <gutenprint/gutenprint.h>
+#include <gutenprint/gutenprint-module.h>
+
+int global_test_count = 0;
+int global_error_count = 0;
+
+#define WIDTH 1000
+#define MAX_CHANNELS 11
+
+static const int test_channels[] = { 1, 4, 6, 7, 8, 11 };
+static const double test_limits[] = { 0.0, 0.5, 1.5, 3.0 };
+
+static int
+image_width(stp_image_t *image)
+{
+  return WIDTH;
+}
+
+static stp_image_t test_image =
+{
+  NULL,
+  NULL,
+  image_width,
+};
+
+static void
+TEST(int channels, double limit)
+{
+  global_test_count++;
+  printf("%d: Checking %d channels, ink limit %.2f... ",
+	 global_test_count, channels, limit);
+  fflush(stdout);
+}
+
+static void
+TEST_CHECK(int conditional)
+{
+  if (conditional)
+    printf("PASS\n");
+  else
+    {
+      global_error_count++;
+      printf("FAIL\n");
+    }
+  fflush(stdout);
+}
+
+static unsigned short
+random_value(void)
+{
+  switch (rand() % 8)
+    {
+    case 0:
+      return 0;
+    case 1:
+      return 65535;
+    default:
+      return rand() & 0xffff;
+    }
+}
+
+/*
+ * Scaling is exact.  Each ink limited value may be at most one less
+ * than the exact (truncated) value, and the total must not exceed the
+ * limit.
+ */
+static int
+check_pixel(const unsigned short *in, const unsigned short *out,
+	    const unsigned *density, int channels, unsigned ink_limit,
+	    unsigned max_density)
+{
+  unsigned scaled[MAX_CHANNELS];
+  unsigned total = 0;
+  unsigned out_total = 0;
+  int i;
+  for (i = 0; i < channels; i++)
+    {
+      scaled[i] = (32767u + in[i] * density[i]) / 65535u;
+      total += scaled[i];
+      out_total += out[i];
+    }
+  if (ink_limit == 0 || ink_limit >= max_density || total <= ink_limit)
+    {
+      for (i = 0; i < channels; i++)
+	if (out[i] != scaled[i])
+	  return 0;
+    }
+  else
+    {
+      double ratio = (double) ink_limit / (double) total;
+      for (i = 0; i < channels; i++)
+	{
+	  unsigned short expected = scaled[i] * ratio;
+	  if (out[i] > expected || out[i] + 1 < expected)
+	    return 0;
+	}
+      if (out_total > ink_limit)
+	return 0;
+    }
+  return 1;
+}
+
+static void
+test_convert(int channels, double limit)
+{
+  stp_vars_t *v = stp_vars_create();
+  unsigned short in[WIDTH * MAX_CHANNELS];
+  unsigned density[MAX_CHANNELS];
+  unsigned max_density = 0;
+  unsigned short *input;
+  const unsigned short *output;
+  int ok = 1;
+  int i;
+
+  stp_set_string_parameter(v, "STPIOutputType", "CMYK");
+  stp_set_string_parameter(v, "ColorCorrection", "None");
+  stp_set_float_parameter(v, "CyanBalance", 1.0);
+  stp_set_float_parameter(v, "MagentaBalance", 1.0);
+  stp_set_float_parameter(v, "YellowBalance", 1.0);
+  for (i = 0; i < channels; i++)
+    {
+      stp_channel_add(v, i, 0, 1.0);
+      if (i % 3 == 1)
+	stp_channel_set_density_adjustment(v, i, 0, (rand() % 1000) / 999.0);
+      density[i] = stp_channel_get_density_adjustment(v, i, 0) * 65535 + .5;
+      max_density += density[i];
+    }
+  stp_channel_set_ink_limit(v, limit);
+  stp_channel_initialize(v, &test_image, channels);
+  input = stp_channel_get_input(v);
+  for (i = 0; i < WIDTH * channels; i++)
+    in[i] = random_value();
+  /* Runs of identical pixels */
+  for (i = WIDTH / 2; i < WIDTH / 2 + 20; i++)
+    memcpy(in + i * channels, in + (WIDTH / 2) * channels,
+	   channels * sizeof(unsigned short));
+  memcpy(input, in, WIDTH * channels * sizeof(unsigned short));
+
+  TEST(channels, limit);
+  stp_channel_convert(v, NULL);
+  output = stp_channel_get_output(v);
+  for (i = 0; i < WIDTH; i++)
+    if (!check_pixel(in + i * channels, output + i * channels, density,
+		     channels, 65535 * limit, max_density))
+      {
+	ok = 0;
+	break;
+      }
+  TEST_CHECK(ok);
+  stp_vars_destroy(v);
+}
+
+int
+main(int argc, char **argv)
+{
+  int i, j;
+  stp_init();
+  srand(1);
+
+  for (i = 0; i < sizeof(test_channels) / sizeof(int); i++)
+    for (j = 0; j < sizeof(test_limits) / sizeof(double); j++)
+      test_convert(test_channels[i], test_limits[j]);
+
+  if (global_error_count)
+    printf("%d/%d tests FAILED.\n", global_error_count, global_test_count);
+  else
+    printf("All tests passed successfully.\n");
+  return global_error_count ? 1 : 0;
+}